@@ -32,6 +32,11 @@ extern "C"
 
 typedef struct ctf_file ctf_file_t;
 typedef struct ctf_archive ctf_archive_t;
+typedef struct ctf_name_cursor ctf_name_cursor_t;
+typedef struct ctf_pub ctf_pub_t;
+typedef struct ctf_lookupset ctf_lookupset_t;
+typedef struct ctf_idmap ctf_idmap_t;
+typedef struct ctf_future ctf_future_t;
 typedef long ctf_id_t;
 
 /* If the debugger needs to provide the CTF library with a set of raw buffers
@@ -66,6 +71,23 @@ typedef struct ctf_membinfo
   unsigned long ctm_offset;	/* Offset of member in bits.  */
 } ctf_membinfo_t;
 
+/* What ctf_type_info() returns about a type.  The size, alignment and
+   encoding are those of the type it resolves to; the encoding is zero unless
+   that is an integer or floating-point type.  */
+
+typedef struct ctf_typeinfo
+{
+  int cti_kind;			/* Kind (CTF_K_* constant).  */
+  int cti_root;			/* Nonzero if visible at the root.  */
+  const char *cti_name;		/* Name, or "" if anonymous.  */
+  uint32_t cti_vlen;		/* Number of members, enumerators or args.  */
+  ssize_t cti_size;		/* Size in bytes.  */
+  ssize_t cti_align;		/* Alignment in bytes.  */
+  ctf_id_t cti_ref;		/* Type referenced, or CTF_ERR if none.  */
+  ctf_id_t cti_resolved;	/* Type after typedefs and qualifiers.  */
+  ctf_encoding_t cti_encoding;	/* Encoding of integer or float.  */
+} ctf_typeinfo_t;
+
 typedef struct ctf_arinfo
 {
   ctf_id_t ctr_contents;	/* Type of array contents.  */
@@ -73,6 +95,22 @@ typedef struct ctf_arinfo
   uint32_t ctr_nelems;		/* Number of elements.  */
 } ctf_arinfo_t;
 
+/* Specifications of members and enumerators to be added in bulk by
+   ctf_add_struct_members() and ctf_add_enumerators().  */
+
+typedef struct ctf_member_spec
+{
+  const char *ctms_name;	/* Name of member (NULL if anonymous).  */
+  ctf_id_t ctms_type;		/* Type of member.  */
+  unsigned long ctms_offset;	/* Offset in bits, or (unsigned long) -1.  */
+} ctf_member_spec_t;
+
+typedef struct ctf_enum_spec
+{
+  const char *ctes_name;	/* Name of enumerator.  */
+  int ctes_value;		/* Value of enumerator.  */
+} ctf_enum_spec_t;
+
 typedef struct ctf_funcinfo
 {
   ctf_id_t ctc_return;		/* Function return type.  */
@@ -91,6 +129,25 @@ typedef struct ctf_snapshot_id
   unsigned long snapshot_id;	/* Snapshot id at time of snapshot.  */
 } ctf_snapshot_id_t;
 
+/* A query for ctf_type_select() and ctf_type_count().  A type matches if
+   it satisfies every criterion.  */
+
+typedef struct ctf_typequery
+{
+  int ctq_kind;			/* Kind to match (CTF_K_*), or -1 for any.  */
+  int ctq_rootonly;		/* Nonzero to match only root-visible types.  */
+  size_t ctq_minsize;		/* Minimum size in bytes.  */
+  size_t ctq_maxsize;		/* Maximum size in bytes, or 0 for no limit.  */
+  ctf_id_t ctq_ref;		/* Type referenced (pointers, typedefs,
+				   cv-quals, function returns), or 0 for any.  */
+  const char *ctq_name;		/* Name to match, or NULL for any.  */
+} ctf_typequery_t;
+
+/* The namespace searched by ctf_lookup_prefix() and ctf_lookup_glob() is
+   a CTF_K_* kind that has names, or this, for variables.  */
+
+#define	CTF_NS_VARIABLE	(-1)
+
 #define	CTF_FUNC_VARARG	0x1	/* Function arguments end with varargs.  */
 
 /* Functions that return integer status or a ctf_id_t use the following value
@@ -146,7 +203,8 @@ enum
    ECTF_OVERROLLBACK,		/* Attempt to roll back past a ctf_update.  */
    ECTF_COMPRESS,		/* Failed to compress CTF data.  */
    ECTF_ARCREATE,		/* Error creating CTF archive.  */
-   ECTF_ARNNAME			/* Name not found in CTF archive.  */
+   ECTF_ARNNAME,		/* Name not found in CTF archive.  */
+   ECTF_NEXT_END		/* End of iteration.  */
   };
 
 /* The CTF data model is inferred to be the caller's data model or the data
@@ -167,6 +225,15 @@ enum
 #define	CTF_ADD_NONROOT	0	/* Type only visible in nested scope.  */
 #define	CTF_ADD_ROOT	1	/* Type visible at top-level scope.  */
 
+/* A ctf_visit_f passed to ctf_type_visit_limit() may return this to skip the
+   members of the type it was just passed, rather than aborting the visit.  */
+
+#define	CTF_VISIT_SKIP	(-2)
+
+/* Flags for ctf_idmap_create().  */
+
+#define	CTF_IDMAP_BYNAME 0x1	/* Match changed types by name.  */
+
 /* These typedefs are used to define the signature for callback functions
    that can be used with the iteration and visit functions below.  */
 
@@ -185,15 +252,28 @@ extern ctf_file_t *ctf_bufopen (const ctf_sect_t *, const ctf_sect_t *,
 extern ctf_file_t *ctf_fdopen (int, int *);
 extern ctf_file_t *ctf_open (const char *, int *);
 extern ctf_file_t *ctf_create (int *);
+extern ctf_file_t *ctf_btf_bufopen (const void *, size_t, ctf_file_t *,
+				    int *);
+extern ctf_file_t *ctf_btf_open (const char *, ctf_file_t *, int *);
 extern void ctf_close (ctf_file_t *);
 extern ctf_sect_t ctf_getdatasect (const ctf_file_t *);
 
 extern int ctf_arc_write (const char *, ctf_file_t **, size_t,
 			  const char **, size_t);
+extern int ctf_arc_write_delta (const char *, ctf_file_t **, size_t,
+				const char **, size_t, const char *);
+extern int ctf_arc_upgrade (const char *, const char *, size_t);
 extern ctf_archive_t *ctf_arc_open (const char *, int *);
 extern void ctf_arc_close (ctf_archive_t *);
 extern ctf_file_t *ctf_arc_open_by_name (const ctf_archive_t *,
 					 const char *, int *);
+extern ctf_future_t *ctf_open_async (const char *, int *);
+extern int ctf_arc_prefetch (const ctf_archive_t *, const char **, size_t,
+			     ctf_future_t **);
+extern int ctf_future_ready (ctf_future_t *);
+extern ctf_file_t *ctf_future_get (ctf_future_t *, int *);
+extern void ctf_future_close (ctf_future_t *);
+extern int ctf_open_many (const char **, size_t, ctf_file_t **, int *);
 
 extern ctf_file_t *ctf_parent_file (ctf_file_t *);
 extern const char *ctf_parent_name (ctf_file_t *);
@@ -208,6 +288,9 @@ extern int ctf_getmodel (ctf_file_t *);
 extern void ctf_setspecific (ctf_file_t *, void *);
 extern void *ctf_getspecific (ctf_file_t *);
 
+extern void ctf_residency_set_budget (size_t);
+extern size_t ctf_residency_trim (size_t);
+
 extern int ctf_errno (ctf_file_t *);
 extern const char *ctf_errmsg (int);
 extern int ctf_version (int);
@@ -218,6 +301,29 @@ extern int ctf_func_args (ctf_file_t *, unsigned long, uint32_t, ctf_id_t *);
 extern ctf_id_t ctf_lookup_by_name (ctf_file_t *, const char *);
 extern ctf_id_t ctf_lookup_by_symbol (ctf_file_t *, unsigned long);
 extern ctf_id_t ctf_lookup_variable (ctf_file_t *, const char *);
+extern ctf_name_cursor_t *ctf_lookup_prefix (ctf_file_t *, int, const char *);
+extern ctf_name_cursor_t *ctf_lookup_glob (ctf_file_t *, int, const char *);
+extern ctf_id_t ctf_name_next (ctf_name_cursor_t *, const char **);
+extern void ctf_name_cursor_close (ctf_name_cursor_t *);
+
+extern ctf_lookupset_t *ctf_lookupset_create (int *);
+extern void ctf_lookupset_destroy (ctf_lookupset_t *);
+extern int ctf_lookupset_add (ctf_lookupset_t *, ctf_file_t *, int);
+extern int ctf_lookupset_add_archive (ctf_lookupset_t *,
+				      const ctf_archive_t *, int);
+extern int ctf_lookupset_remove (ctf_lookupset_t *, ctf_file_t *);
+extern int ctf_lookupset_remove_archive (ctf_lookupset_t *,
+					 const ctf_archive_t *);
+extern ctf_id_t ctf_lookupset_by_name (ctf_lookupset_t *, const char *,
+				       ctf_file_t **);
+extern ctf_id_t ctf_lookupset_variable (ctf_lookupset_t *, const char *,
+					ctf_file_t **);
+extern int ctf_lookupset_errno (ctf_lookupset_t *);
+
+extern ctf_idmap_t *ctf_idmap_create (ctf_file_t *, ctf_file_t *, int, int *);
+extern ctf_id_t ctf_idmap_lookup (const ctf_idmap_t *, ctf_id_t);
+extern int ctf_idmap_unmatched (const ctf_idmap_t *, ctf_type_f *, void *);
+extern void ctf_idmap_free (ctf_idmap_t *);
 
 extern ctf_id_t ctf_type_resolve (ctf_file_t *, ctf_id_t);
 extern ssize_t ctf_type_lname (ctf_file_t *, ctf_id_t, char *, size_t);
@@ -228,7 +334,10 @@ extern int ctf_type_kind (ctf_file_t *, ctf_id_t);
 extern ctf_id_t ctf_type_reference (ctf_file_t *, ctf_id_t);
 extern ctf_id_t ctf_type_pointer (ctf_file_t *, ctf_id_t);
 extern int ctf_type_encoding (ctf_file_t *, ctf_id_t, ctf_encoding_t *);
+extern int ctf_type_info (ctf_file_t *, ctf_id_t, ctf_typeinfo_t *);
 extern int ctf_type_visit (ctf_file_t *, ctf_id_t, ctf_visit_f *, void *);
+extern int ctf_type_visit_limit (ctf_file_t *, ctf_id_t, int, ctf_visit_f *,
+				 void *);
 extern int ctf_type_cmp (ctf_file_t *, ctf_id_t, ctf_file_t *, ctf_id_t);
 extern int ctf_type_compat (ctf_file_t *, ctf_id_t, ctf_file_t *, ctf_id_t);
 
@@ -248,7 +357,13 @@ extern int ctf_label_info (ctf_file_t *, const char *, ctf_lblinfo_t *);
 extern int ctf_member_iter (ctf_file_t *, ctf_id_t, ctf_member_f *, void *);
 extern int ctf_enum_iter (ctf_file_t *, ctf_id_t, ctf_enum_f *, void *);
 extern int ctf_type_iter (ctf_file_t *, ctf_type_f *, void *);
+extern int ctf_type_iter_range (ctf_file_t *, ctf_id_t, ctf_id_t,
+				ctf_type_f *, void *);
+extern int ctf_type_partition (ctf_file_t *, int, ctf_id_t *);
 extern int ctf_label_iter (ctf_file_t *, ctf_label_f *, void *);
+extern int ctf_type_select (ctf_file_t *, const ctf_typequery_t *,
+			    ctf_type_f *, void *);
+extern long ctf_type_count (ctf_file_t *, const ctf_typequery_t *);
 extern int ctf_variable_iter (ctf_file_t *, ctf_variable_f *, void *);
 extern int ctf_archive_iter (const ctf_archive_t *, ctf_archive_member_f *,
 			     void *);
@@ -284,18 +399,30 @@ extern int ctf_add_enumerator (ctf_file_t *, ctf_id_t, const char *, int);
 extern int ctf_add_member (ctf_file_t *, ctf_id_t, const char *, ctf_id_t);
 extern int ctf_add_member_offset (ctf_file_t *, ctf_id_t, const char *,
 				  ctf_id_t, unsigned long);
+extern int ctf_add_struct_members (ctf_file_t *, ctf_id_t,
+				   const ctf_member_spec_t *, size_t);
+extern int ctf_add_enumerators (ctf_file_t *, ctf_id_t,
+				const ctf_enum_spec_t *, size_t);
 
 extern int ctf_add_variable (ctf_file_t *, const char *, ctf_id_t);
 
 extern int ctf_set_array (ctf_file_t *, ctf_id_t, const ctf_arinfo_t *);
 
 extern int ctf_update (ctf_file_t *);
+extern ctf_pub_t *ctf_publish (ctf_file_t *);
+extern ctf_file_t *ctf_pin (ctf_pub_t *);
+extern void ctf_unpin (ctf_file_t *);
 extern ctf_snapshot_id_t ctf_snapshot (ctf_file_t *);
 extern int ctf_rollback (ctf_file_t *, ctf_snapshot_id_t);
 extern int ctf_discard (ctf_file_t *);
 extern int ctf_write (ctf_file_t *, int);
 extern int ctf_gzwrite (ctf_file_t * fp, gzFile fd);
 extern int ctf_compress_write (ctf_file_t * fp, int fd);
+extern int ctf_compress_write_chunked (ctf_file_t *, int, size_t);
+extern int ctf_setcompression (ctf_file_t *, int, int);
+extern void ctf_getcompression (ctf_file_t *, int *, int *);
+extern int ctf_serialize_to_fd (ctf_file_t *, int);
+extern int ctf_compress_serialize_to_fd (ctf_file_t *, int);
 
 #ifdef	__cplusplus
 }
@@ -157,6 +157,31 @@ typedef struct ctf_header
 #define CTF_VERSION CTF_VERSION_2 /* Current version.  */
 
 #define CTF_F_COMPRESS	0x1	/* Data buffer is compressed by libctf.  */
+#define CTF_F_CHUNKED	0x2	/* ... in independently-compressed chunks.  */
+
+/* A chunked container (one with both CTF_F_COMPRESS and CTF_F_CHUNKED set)
+   has a ctf_chunkidx_t immediately after the header, followed by ctc_nchunks
+   ctf_chunk_t entries, followed by the chunks themselves, each a complete zlib
+   stream.  The chunks inflate in order to the data following the header, and
+   so can be inflated independently and in parallel.
+
+   No chunk spans the start or end of the type section, and chunks within the
+   type section start and end on type boundaries, so that the type chunks can
+   also be inflated one by one as their types are needed: ctk_type gives the
+   index of the first type in each such chunk, and is zero in all others.  */
+
+typedef struct ctf_chunkidx
+{
+  uint32_t ctc_nchunks;		/* Number of chunks.  */
+  uint32_t ctc_ntypes;		/* Number of types.  */
+} ctf_chunkidx_t;
+
+typedef struct ctf_chunk
+{
+  uint32_t ctk_len;		/* Compressed length.  */
+  uint32_t ctk_size;		/* Uncompressed length.  */
+  uint32_t ctk_type;		/* Index of first type in a type chunk.  */
+} ctf_chunk_t;
 
 typedef struct ctf_lblent
 {
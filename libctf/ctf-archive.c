@@ -17,27 +17,203 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include <ctf-impl.h>
 
+/* Hash table of CTF files already written to an archive, used to store
+   byte-identical files only once.  */
+struct arc_dedup
+{
+  uint32_t hash;		/* Hash of contents.  */
+  size_t file;			/* Index into the array of CTF files.  */
+  off_t off;			/* Offset written at (0 if unused slot).  */
+};
+
+/* The delta archives being materialized while opening their bases, innermost
+   first, so that a chain of bases leading back to itself is caught.  */
+struct arc_chain
+{
+  dev_t dev;
+  ino_t ino;
+  const struct arc_chain *next;
+};
+
+static int arc_write (const char *file, ctf_file_t ** ctf_files,
+		      size_t ctf_file_cnt, const char **names, size_t threshold,
+		      const char *basefile, const ctf_archive_t * base);
 static off_t arc_write_one_ctf (ctf_file_t * f, int fd, size_t threshold);
+static off_t arc_write_one_delta (ctf_file_t * f, const ctf_archive_t * base,
+				  const char *name, int fd, size_t threshold);
+static char *arc_base_path (const char *file, const char *basefile);
+static ctf_archive_t *arc_open (const char *filename,
+				const struct arc_chain *chain, int *errp);
+static ctf_archive_t *arc_materialize (const char *filename,
+				       const ctf_archive_t * delta,
+				       size_t deltasz,
+				       const struct arc_chain *chain);
 static ctf_file_t *ctf_arc_open_by_offset (const ctf_archive_t * arc,
 					   size_t offset, int *errp);
-static int sort_modent_by_name (const void *one, const void *two);
-
-/* qsort cmp name */
-const char *sort_nametbl = NULL;
-
-/* bsearch() internal state.  */
-static __thread char *search_nametbl;
+static int sort_modent_by_name (const void *one, const void *two, void *n);
+static off_t arc_dedup_find (ctf_file_t **ctf_files, const struct arc_dedup *,
+			     size_t dedupsz, size_t i, uint32_t hash);
+static void arc_dedup_add (struct arc_dedup *, size_t dedupsz, size_t i,
+			   uint32_t hash, off_t off);
+
+/* bsearch() key: the name being sought, and the name table of the archive being
+   searched.  */
+typedef struct ctf_arc_search_key
+{
+  const char *name;
+  const char *nametbl;
+} ctf_arc_search_key_t;
 
 /* Write out a CTF archive.  The entries in CTF_FILES are referenced by name:
    the names are passed in the names array, which must have CTF_FILES entries.
+   Entries whose contents are identical are stored only once.
 
    Returns 0 on success, or an errno, or an ECTF_* value.  */
 int
 ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
 	       const char **names, size_t threshold)
+{
+  return arc_write (file, ctf_files, ctf_file_cnt, names, threshold, NULL,
+		    NULL);
+}
+
+/* Write out a delta archive, in which each entry is stored as a delta against
+   the entry of the same name in the archive BASEFILE, if there is one.
+   BASEFILE, if not absolute, is relative to the directory containing FILE: it
+   must exist, unchanged, whenever the delta archive is opened.  Deltas whose
+   size exceeds THRESHOLD are compressed.
+
+   Returns 0 on success, or an errno, or an ECTF_* value.  */
+int
+ctf_arc_write_delta (const char *file, ctf_file_t ** ctf_files,
+		     size_t ctf_file_cnt, const char **names, size_t threshold,
+		     const char *basefile)
+{
+  ctf_archive_t *base;
+  char *basepath;
+  int err;
+
+  if ((basepath = arc_base_path (file, basefile)) == NULL)
+    return errno;
+
+  if ((base = ctf_arc_open (basepath, &err)) == NULL)
+    {
+      free (basepath);
+      return err;
+    }
+
+  err = arc_write (file, ctf_files, ctf_file_cnt, names, threshold, basefile,
+		   base);
+
+  ctf_arc_close (base);
+  free (basepath);
+  return err;
+}
+
+/* Collect the names of the members of an archive.  */
+
+typedef struct arc_names
+{
+  const char **names;
+  size_t n;
+  size_t alloc;
+} arc_names_t;
+
+static int
+arc_collect_name (const char *name, const void *content _libctf_unused_,
+		  size_t len _libctf_unused_, void *data)
+{
+  arc_names_t *an = data;
+
+  if (an->n == an->alloc)
+    {
+      size_t alloc = an->alloc ? an->alloc * 2 : 64;
+      const char **names;
+
+      if ((names = realloc (an->names, alloc * sizeof (char *))) == NULL)
+	return ENOMEM;
+      an->names = names;
+      an->alloc = alloc;
+    }
+  an->names[an->n++] = name;
+  return 0;
+}
+
+/* Write a copy of the archive INFILE to OUTFILE, with every member in the
+   current CTF format, so that members in older formats need no longer be
+   upgraded whenever they are opened.  The members are opened, and so upgraded,
+   in parallel.  Members larger than THRESHOLD are compressed.
+
+   Returns 0 on success, or an errno, or an ECTF_* value.  */
+int
+ctf_arc_upgrade (const char *infile, const char *outfile, size_t threshold)
+{
+  ctf_archive_t *arc;
+  arc_names_t an = { NULL, 0, 0 };
+  ctf_future_t **futures = NULL;
+  ctf_file_t **files = NULL;
+  size_t i;
+  int err;
+
+  if ((arc = ctf_arc_open (infile, &err)) == NULL)
+    return err != 0 ? err : ECTF_CORRUPT;
+
+  if ((err = ctf_archive_raw_iter (arc, arc_collect_name, &an)) != 0)
+    goto out;
+
+  if (an.n == 0)
+    {
+      err = arc_write (outfile, NULL, 0, NULL, threshold, NULL, NULL);
+      goto out;
+    }
+
+  if ((futures = calloc (an.n, sizeof (ctf_future_t *))) == NULL
+      || (files = calloc (an.n, sizeof (ctf_file_t *))) == NULL)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+
+  if ((err = ctf_arc_prefetch (arc, an.names, an.n, futures)) != 0)
+    {
+      free (futures);
+      futures = NULL;
+      goto out;
+    }
+
+  for (i = 0; i < an.n; i++)
+    if ((files[i] = ctf_future_get (futures[i], &err)) == NULL)
+      {
+	ctf_dprintf ("ctf_arc_upgrade(): cannot open %s: %s\n",
+		     an.names[i], ctf_errmsg (err));
+	goto out;
+      }
+
+  err = arc_write (outfile, files, an.n, an.names, threshold, NULL, NULL);
+
+out:
+  for (i = 0; futures != NULL && files != NULL && i < an.n; i++)
+    {
+      ctf_close (files[i]);
+      ctf_future_close (futures[i]);
+    }
+  free (futures);
+  free (files);
+  free (an.names);
+  ctf_arc_close (arc);
+  return err;
+}
+
+/* Write out an archive, or a delta archive against BASE (named BASEFILE) if
+   BASE is non-NULL.  */
+static int
+arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
+	   const char **names, size_t threshold, const char *basefile,
+	   const ctf_archive_t * base)
 {
   const char *errmsg;
   struct ctf_archive *archdr;
@@ -48,12 +224,21 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
   ssize_t namesz;
   size_t ctf_startoffs;		/* Start of the section we are working over.  */
   char *nametbl = NULL;		/* The name table.  */
+  struct arc_dedup *dedup = NULL; /* Files written so far.  */
+  size_t dedupsz;
+  size_t basenamesz;
   char *np;
   off_t nameoffs;
   struct ctf_archive_modent *modent;
 
   ctf_dprintf ("Writing archive %s with %zi files\n", file, ctf_file_cnt);
 
+  /* Keep the data of every file in memory until we are done, since later
+     files are compared against earlier ones.  */
+
+  for (i = 0; i < ctf_file_cnt; i++)
+    ctf_resid_hold (ctf_files[i]);
+
   if ((fd = open (file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0)
     {
       errmsg = "ctf_arc_write(): cannot create %s: %s\n";
@@ -93,7 +278,7 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
 
   /* Fill in everything we can, which is everything other than the name
      table offset.  */
-  archdr->ctfa_magic = htole64 (CTFA_MAGIC);
+  archdr->ctfa_magic = htole64 (base ? CTFA_DELTA_MAGIC : CTFA_MAGIC);
   archdr->ctfa_nfiles = htole64 (ctf_file_cnt);
   archdr->ctfa_ctfs = htole64 (ctf_startoffs);
 
@@ -113,9 +298,11 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
      track them in a local strtab until the time is right, and sort the
      modents array after construction.
 
-    The name table is not sorted.  */
+    The name table is not sorted.  A delta archive's name table starts with
+    the name of its base.  */
 
-  for (i = 0, namesz = 0; i < le64toh (archdr->ctfa_nfiles); i++)
+  basenamesz = base ? strlen (basefile) + 1 : 0;
+  for (i = 0, namesz = basenamesz; i < le64toh (archdr->ctfa_nfiles); i++)
     namesz += strlen (names[i]) + 1;
 
   nametbl = malloc (namesz);
@@ -125,16 +312,52 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
       goto err_unmap;
     }
 
-  for (i = 0, namesz = 0,
+  for (dedupsz = 1; dedupsz < ctf_file_cnt * 2; dedupsz <<= 1);
+  if ((dedup = calloc (dedupsz, sizeof (struct arc_dedup))) == NULL)
+    {
+      errmsg = "Error writing named CTF to %s: %s\n";
+      goto err_free;
+    }
+
+  if (base)
+    strcpy (nametbl, basefile);
+
+  for (i = 0, namesz = basenamesz,
        modent = (ctf_archive_modent_t *) ((char *) archdr
 					  + sizeof (struct ctf_archive));
        i < le64toh (archdr->ctfa_nfiles); i++)
     {
+      uint32_t hash;
       off_t off;
 
       strcpy (&nametbl[namesz], names[i]);
 
-      off = arc_write_one_ctf (ctf_files[i], fd, threshold);
+      if ((errno = ctf_lazy_load_all (ctf_files[i])) != 0)
+	{
+	  errmsg = "ctf_arc_write(): Cannot load CTF file to write to "
+	    "%s: %s\n";
+	  goto err_free;
+	}
+
+      hash = ctf_hash_compute ((const char *) ctf_files[i]->ctf_base,
+			       ctf_files[i]->ctf_size);
+
+      /* Identical files in delta archives may have different bases, so
+	 cannot be shared.  */
+
+      if (!base
+	  && (off = arc_dedup_find (ctf_files, dedup, dedupsz, i, hash)) != 0)
+	{
+	  ctf_dprintf ("%s is identical to an earlier file: sharing it\n",
+		       names[i]);
+	  goto written;
+	}
+
+      if (base)
+	off = arc_write_one_delta (ctf_files[i], base, names[i], fd,
+				   threshold);
+      else
+	off = arc_write_one_ctf (ctf_files[i], fd, threshold);
       ctf_dprintf ("Written %s, offset now %zi\n", names[i], off);
       if ((off < 0) && (off > -ECTF_BASE))
 	{
@@ -148,18 +371,19 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
 	  errno = off * -1;
 	  goto err_free;
 	}
+      arc_dedup_add (dedup, dedupsz, i, hash, off);
 
+    written:
       modent->name_offset = htole64 (namesz);
       modent->ctf_offset = htole64 (off - ctf_startoffs);
       namesz += strlen (names[i]) + 1;
       modent++;
     }
 
-  sort_nametbl = nametbl;
-  qsort ((ctf_archive_modent_t *) ((char *) archdr
-				     + sizeof (struct ctf_archive)),
+  qsort_r ((ctf_archive_modent_t *) ((char *) archdr
+				       + sizeof (struct ctf_archive)),
 	   le64toh (archdr->ctfa_nfiles),
-	   sizeof (struct ctf_archive_modent), sort_modent_by_name);
+	   sizeof (struct ctf_archive_modent), sort_modent_by_name, nametbl);
 
    /* Now the name table.  */
 
@@ -183,6 +407,7 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
       np += len;
     }
   free (nametbl);
+  free (dedup);
 
   if (msync (archdr, headersz, MS_ASYNC) < 0)
     {
@@ -196,9 +421,12 @@ ctf_arc_write (const char *file, ctf_file_t ** ctf_files, size_t ctf_file_cnt,
       goto err_unlink;
     }
 
+  for (i = 0; i < ctf_file_cnt; i++)
+    ctf_resid_release (ctf_files[i]);
   return 0;
 
 err_free:
+  free (dedup);
   free (nametbl);
 err_unmap:
   munmap (archdr, headersz);
@@ -209,6 +437,8 @@ err_unlink:
 err:
   ctf_dprintf (errmsg, file, errno < ECTF_BASE ? strerror (errno) :
 	       ctf_errmsg (errno));
+  for (i = 0; i < ctf_file_cnt; i++)
+    ctf_resid_release (ctf_files[i]);
   return errno;
 }
 
@@ -274,14 +504,142 @@ arc_write_one_ctf (ctf_file_t * f, int fd, size_t threshold)
   return off;
 }
 
+/* Write one CTF file out as a delta against the member of the same name in
+   BASE, if there is one, compressing the delta if it is larger than THRESHOLD
+   and compression makes it smaller.  Return values are as for
+   arc_write_one_ctf().  */
+static off_t
+arc_write_one_delta (ctf_file_t * f, const ctf_archive_t * base,
+		     const char *name, int fd, size_t threshold)
+{
+  ctf_archive_delta_t hdr;
+  ctf_file_t *bfp;
+  const unsigned char *bbuf = NULL;
+  const unsigned char *payload;
+  unsigned char *ops, *zops = NULL;
+  size_t bsz = 0, opslen;
+  uLongf paylen;
+  uint64_t ctfsz;
+  off_t off, end_off;
+  int err;
+
+  if ((off = lseek (fd, 0, SEEK_CUR)) < 0)
+    return errno * -1;
+
+  if ((bfp = ctf_arc_open_by_name (base, name, &err)) == NULL)
+    {
+      if (err != ECTF_ARNNAME)
+	return err * -1;
+      ctf_dprintf ("%s is not in the base archive: storing it whole\n", name);
+    }
+  else
+    {
+      ctf_resid_hold (bfp);
+      if ((err = ctf_lazy_load_all (bfp)) != 0)
+	{
+	  ctf_resid_release (bfp);
+	  ctf_close (bfp);
+	  return err * -1;
+	}
+      bbuf = bfp->ctf_base;
+      bsz = bfp->ctf_size;
+    }
+
+  err = ctf_delta_encode (bbuf, bsz, f->ctf_base, f->ctf_size, &ops, &opslen);
+  if (bfp != NULL)
+    ctf_resid_release (bfp);
+  ctf_close (bfp);
+  if (err != 0)
+    return err * -1;
+
+  hdr.ctad_size = htole64 (f->ctf_size);
+  hdr.ctad_opslen = htole64 (opslen);
+  hdr.ctad_flags = 0;
+  payload = ops;
+  paylen = opslen;
+
+  if (opslen > threshold)
+    {
+      uLongf zlen = compressBound (opslen);
+
+      if ((zops = malloc (zlen)) == NULL)
+	{
+	  free (ops);
+	  return ENOMEM * -1;
+	}
+
+      if (compress2 (zops, &zlen, ops, opslen, f->ctf_zlevel) == Z_OK
+	  && zlen < opslen)
+	{
+	  hdr.ctad_flags = htole64 (CTFA_DELTA_F_COMPRESS);
+	  payload = zops;
+	  paylen = zlen;
+	}
+    }
+
+  ctfsz = htole64 (sizeof (hdr) + paylen);
+  if ((err = ctf_write_fd (fd, &ctfsz, sizeof (ctfsz))) == 0
+      && (err = ctf_write_fd (fd, &hdr, sizeof (hdr))) == 0)
+    err = ctf_write_fd (fd, payload, paylen);
+
+  free (zops);
+  free (ops);
+  if (err != 0)
+    return err * -1;
+
+  end_off = off + sizeof (ctfsz) + sizeof (hdr) + paylen;
+  end_off = LCTF_ALIGN_OFFS (end_off, 8);
+  if ((lseek (fd, end_off, SEEK_SET)) < 0)
+    return errno * -1;
+
+  return off;
+}
+
+/* Return the offset at which a CTF file identical to CTF_FILES[I], which has
+   hash HASH, was written, or 0 if none was.  */
+static off_t
+arc_dedup_find (ctf_file_t **ctf_files, const struct arc_dedup *dedup,
+		size_t dedupsz, size_t i, uint32_t hash)
+{
+  size_t h;
+
+  for (h = hash & (dedupsz - 1); dedup[h].off != 0;
+       h = (h + 1) & (dedupsz - 1))
+    {
+      const ctf_file_t *a = ctf_files[i];
+      const ctf_file_t *b = ctf_files[dedup[h].file];
+
+      if (dedup[h].hash == hash && a->ctf_size == b->ctf_size
+	  && memcmp (a->ctf_base, b->ctf_base, a->ctf_size) == 0)
+	return dedup[h].off;
+    }
+
+  return 0;
+}
+
+/* Note that CTF_FILES[I], with hash HASH, was written at offset OFF.  */
+static void
+arc_dedup_add (struct arc_dedup *dedup, size_t dedupsz, size_t i,
+	       uint32_t hash, off_t off)
+{
+  size_t h;
+
+  for (h = hash & (dedupsz - 1); dedup[h].off != 0;
+       h = (h + 1) & (dedupsz - 1));
+
+  dedup[h].hash = hash;
+  dedup[h].file = i;
+  dedup[h].off = off;
+}
+
 /* qsort() function to sort the array of struct ctf_archive_modents into
    ascending name order.  */
 static int
-sort_modent_by_name (const void *one, const void *two)
+sort_modent_by_name (const void *one, const void *two, void *n)
 {
   const struct ctf_archive_modent *a = one;
   const struct ctf_archive_modent *b = two;
-  const char* nametbl = sort_nametbl;
+  const char *nametbl = n;
 
   return strcmp (&nametbl[le64toh (a->name_offset)],
 		 &nametbl[le64toh (b->name_offset)]);
@@ -292,21 +650,30 @@ sort_modent_by_name (const void *one, const void *two)
 static int
 search_modent_by_name (const void *key, const void *ent)
 {
-  const char *k = key;
+  const ctf_arc_search_key_t *k = key;
   const struct ctf_archive_modent *v = ent;
 
-  return strcmp (k, &search_nametbl[le64toh (v->name_offset)]);
+  return strcmp (k->name, &k->nametbl[le64toh (v->name_offset)]);
 }
 
 /* Open a CTF archive.  Returns the archive, or NULL and an error in *err (if
    not NULL).  */
 ctf_archive_t *
 ctf_arc_open (const char *filename, int *errp)
+{
+  return arc_open (filename, NULL, errp);
+}
+
+/* Open a CTF archive as the base of the delta archives on CHAIN, if any.  */
+static ctf_archive_t *
+arc_open (const char *filename, const struct arc_chain *chain, int *errp)
 {
   const char *errmsg;
   int fd;
   struct stat s;
   ctf_archive_t *arc;		/* (Actually the whole file.)  */
+  const struct arc_chain *c;
+  struct arc_chain link;
 
   if ((fd = open (filename, O_RDONLY)) < 0)
     {
@@ -326,6 +693,32 @@ ctf_arc_open (const char *filename, int *errp)
       goto err_close;
     }
 
+  if (le64toh (arc->ctfa_magic) == CTFA_DELTA_MAGIC)
+    {
+      ctf_archive_t *delta = arc;
+
+      for (c = chain; c != NULL; c = c->next)
+	if (c->dev == s.st_dev && c->ino == s.st_ino)
+	  {
+	    errmsg = "ctf_arc_open(): delta archive %s is its own base: %s\n";
+	    errno = ECTF_CORRUPT;
+	    goto err_unmap;
+	  }
+
+      link.dev = s.st_dev;
+      link.ino = s.st_ino;
+      link.next = chain;
+      arc = arc_materialize (filename, delta, s.st_size, &link);
+      munmap (delta, s.st_size);
+      if (arc == NULL)
+	{
+	  errmsg = "ctf_arc_open(): cannot materialize delta archive %s: %s\n";
+	  goto err_close;
+	}
+      close (fd);
+      return arc;
+    }
+
   if (le64toh (arc->ctfa_magic) != CTFA_MAGIC)
     {
       errmsg = "ctf_arc_open(): Invalid magic number";
@@ -341,7 +734,7 @@ ctf_arc_open (const char *filename, int *errp)
   return arc;
 
 err_unmap:
-  munmap (NULL, s.st_size);
+  munmap (arc, s.st_size);
 err_close:
   close (fd);
 err:
@@ -352,7 +745,222 @@ err:
   return NULL;
 }
 
-/* Close an archive.  */
+/* Return the path of the base archive BASEFILE of the delta archive FILE, in
+   malloc()ed storage, or NULL and errno set on error.  */
+static char *
+arc_base_path (const char *file, const char *basefile)
+{
+  const char *slash;
+  char *path;
+
+  if (basefile[0] == '/' || (slash = strrchr (file, '/')) == NULL)
+    return strdup (basefile);
+
+  if ((path = malloc (slash - file + strlen (basefile) + 2)) == NULL)
+    return NULL;
+
+  memcpy (path, file, slash - file + 1);
+  strcpy (path + (slash - file + 1), basefile);
+  return path;
+}
+
+/* Turn the delta archive DELTA, of size DELTASZ, opened from FILENAME, into an
+   ordinary archive in anonymous memory, by applying each of its deltas to the
+   members of its base archive.  The base archive may itself be a delta
+   archive, as long as it does not lead back to one on CHAIN.  Returns NULL
+   and sets errno on error.  */
+static ctf_archive_t *
+arc_materialize (const char *filename, const ctf_archive_t * delta,
+		 size_t deltasz, const struct arc_chain *chain)
+{
+  const ctf_archive_modent_t *dmodent;
+  ctf_archive_modent_t *modent;
+  ctf_archive_t *base = NULL;
+  ctf_archive_t *arc = NULL;
+  const char *dnames;
+  char *basepath;
+  unsigned char *zops = NULL;
+  uint64_t nfiles, dctfs, dnameoffs;
+  size_t headersz, namesz, ctfsz, size = 0, off, i;
+  int err = ECTF_CORRUPT;
+
+  /* Validate the header, modents and name table.  */
+
+  if (deltasz < sizeof (struct ctf_archive))
+    goto err;
+
+  nfiles = le64toh (delta->ctfa_nfiles);
+  dctfs = le64toh (delta->ctfa_ctfs);
+  dnameoffs = le64toh (delta->ctfa_names);
+
+  if (nfiles > (deltasz - sizeof (struct ctf_archive))
+      / sizeof (ctf_archive_modent_t))
+    goto err;
+
+  headersz = sizeof (struct ctf_archive)
+    + nfiles * sizeof (ctf_archive_modent_t);
+
+  if (dctfs < headersz || dnameoffs < dctfs || dnameoffs >= deltasz)
+    goto err;
+
+  dmodent = (const ctf_archive_modent_t *) ((const char *) delta
+					    + sizeof (struct ctf_archive));
+  dnames = (const char *) delta + dnameoffs;
+  namesz = deltasz - dnameoffs;
+  if (dnames[namesz - 1] != '\0')
+    goto err;
+
+  /* Work out how big the materialized archive will be.  */
+
+  for (i = 0, ctfsz = 0; i < nfiles; i++)
+    {
+      const ctf_archive_delta_t *hdr;
+      uint64_t memsz, doff = le64toh (dmodent[i].ctf_offset);
+
+      if (le64toh (dmodent[i].name_offset) >= namesz
+	  || doff > dnameoffs - dctfs
+	  || dnameoffs - dctfs - doff < sizeof (uint64_t) + sizeof (*hdr))
+	goto err;
+
+      memcpy (&memsz, (const char *) delta + dctfs + doff, sizeof (memsz));
+      memsz = le64toh (memsz);
+      hdr = (const ctf_archive_delta_t *) ((const char *) delta + dctfs + doff
+					   + sizeof (uint64_t));
+
+      if (memsz < sizeof (*hdr)
+	  || memsz > dnameoffs - dctfs - doff - sizeof (uint64_t)
+	  || le64toh (hdr->ctad_size) > SIZE_MAX / 2
+	  || le64toh (hdr->ctad_opslen) > SIZE_MAX / 2)
+	goto err;
+
+      ctfsz += sizeof (uint64_t)
+	+ LCTF_ALIGN_OFFS (le64toh (hdr->ctad_size), 8);
+      if (ctfsz > SIZE_MAX / 2)
+	goto err;
+    }
+
+  size = headersz + ctfsz + namesz;
+  if ((arc = mmap (NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    {
+      arc = NULL;
+      err = errno;
+      goto err;
+    }
+
+  arc->ctfa_model = delta->ctfa_model;
+  arc->ctfa_nfiles = delta->ctfa_nfiles;
+  arc->ctfa_ctfs = htole64 (headersz);
+  arc->ctfa_names = htole64 (headersz + ctfsz);
+
+  /* The name table is copied whole, so name offsets are unchanged.  The name
+     of the base at its start is simply never referred to.  */
+
+  memcpy ((char *) arc + headersz + ctfsz, dnames, namesz);
+
+  if ((basepath = arc_base_path (filename, dnames)) == NULL)
+    {
+      err = errno;
+      goto err;
+    }
+  base = arc_open (basepath, chain, &err);
+  free (basepath);
+  if (base == NULL)
+    goto err;
+
+  modent = (ctf_archive_modent_t *) ((char *) arc
+				     + sizeof (struct ctf_archive));
+
+  for (i = 0, off = 0; i < nfiles; i++)
+    {
+      const char *src = (const char *) delta + dctfs
+	+ le64toh (dmodent[i].ctf_offset);
+      const ctf_archive_delta_t *hdr;
+      const unsigned char *ops;
+      const char *name;
+      unsigned char *dst;
+      ctf_file_t *bfp;
+      uint64_t memsz, tsz, opslen;
+
+      /* A previous member may have left err zero.  */
+      err = ECTF_CORRUPT;
+
+      memcpy (&memsz, src, sizeof (memsz));
+      hdr = (const ctf_archive_delta_t *) (src + sizeof (uint64_t));
+      ops = (const unsigned char *) (hdr + 1);
+      memsz = le64toh (memsz) - sizeof (*hdr);
+      tsz = le64toh (hdr->ctad_size);
+      opslen = le64toh (hdr->ctad_opslen);
+
+      if (le64toh (hdr->ctad_flags) & CTFA_DELTA_F_COMPRESS)
+	{
+	  uLongf zlen = opslen;
+
+	  if ((zops = malloc (opslen)) == NULL)
+	    {
+	      err = ENOMEM;
+	      goto err;
+	    }
+	  if (uncompress (zops, &zlen, ops, memsz) != Z_OK || zlen != opslen)
+	    goto err;
+	  ops = zops;
+	}
+      else if (opslen != memsz)
+	goto err;
+
+      name = &dnames[le64toh (dmodent[i].name_offset)];
+      if ((bfp = ctf_arc_open_by_name (base, name, &err)) == NULL
+	  && err != ECTF_ARNNAME)
+	goto err;
+
+      if (bfp != NULL)
+	{
+	  ctf_resid_hold (bfp);
+	  if ((err = ctf_lazy_load_all (bfp)) != 0)
+	    {
+	      ctf_resid_release (bfp);
+	      ctf_close (bfp);
+	      goto err;
+	    }
+	}
+
+      dst = (unsigned char *) arc + headersz + off;
+      err = ctf_delta_apply (bfp ? bfp->ctf_base : NULL,
+			     bfp ? bfp->ctf_size : 0, ops, opslen,
+			     dst + sizeof (uint64_t), tsz);
+      if (bfp != NULL)
+	ctf_resid_release (bfp);
+      ctf_close (bfp);
+      free (zops);
+      zops = NULL;
+      if (err != 0)
+	goto err;
+
+      tsz = htole64 (tsz);
+      memcpy (dst, &tsz, sizeof (tsz));
+
+      modent[i].name_offset = dmodent[i].name_offset;
+      modent[i].ctf_offset = htole64 (off);
+      off += sizeof (uint64_t) + LCTF_ALIGN_OFFS (le64toh (tsz), 8);
+    }
+
+  ctf_arc_close (base);
+
+  /* See the comment in ctf_arc_open().  */
+  arc->ctfa_magic = size;
+  return arc;
+
+err:
+  free (zops);
+  ctf_arc_close (base);
+  if (arc != NULL)
+    munmap (arc, size);
+  errno = err;
+  return NULL;
+}
+
+/* Close an archive.  Containers opened from it must be closed first, since
+   uncompressed and chunked members use the archive's data in place.  */
 void
 ctf_arc_close (ctf_archive_t * arc)
 {
@@ -369,14 +977,16 @@ ctf_file_t *
 ctf_arc_open_by_name (const ctf_archive_t * arc, const char *name, int *errp)
 {
   struct ctf_archive_modent *modent;
+  ctf_arc_search_key_t key;
 
   ctf_dprintf ("ctf_arc_open_by_name(%s): opening\n", name);
 
   modent = (ctf_archive_modent_t *) ((char *) arc
 				     + sizeof (struct ctf_archive));
 
-  search_nametbl = (char *) arc + le64toh (arc->ctfa_names);
-  modent = bsearch (name, modent, le64toh (arc->ctfa_nfiles),
+  key.name = name;
+  key.nametbl = (const char *) arc + le64toh (arc->ctfa_names);
+  modent = bsearch (&key, modent, le64toh (arc->ctfa_nfiles),
 		    sizeof (struct ctf_archive_modent),
 		    search_modent_by_name);
 
@@ -413,7 +1023,7 @@ ctf_arc_open_by_offset (const ctf_archive_t * arc, size_t offset, int *errp)
   ctfsect.cts_entsize = 1;
   ctfsect.cts_offset = 0;
   ctfsect.cts_data = (void *) ((char *) arc + offset + sizeof (uint64_t));
-  fp = ctf_bufopen (&ctfsect, NULL, NULL, errp);
+  fp = ctf_bufopen_lazy (&ctfsect, NULL, NULL, errp);
   if (fp)
     ctf_setmodel (fp, le64toh (arc->ctfa_model));
   return fp;
@@ -0,0 +1,359 @@
+/* Opening CTF containers in the background.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Consumers often know which containers they will need well before they need
+   them.  ctf_open_async() and ctf_arc_prefetch() start opening them on a
+   small pool of background threads, returning a future for each, which
+   ctf_future_get() waits for (only if it is not already done) and turns into
+   the container.  ctf_open_many() opens a whole batch of files this way, so
+   that their reads overlap rather than being issued one file at a time.
+
+   The pool is shared by the whole process.  Its threads are started as work
+   is queued, up to CTF_ASYNC_THREADS of them, and exit when the queue is
+   empty, so an idle process has no threads left over.  */
+
+#define CTF_ASYNC_THREADS 4		/* Most background threads.  */
+
+/* A future, and the job that completes it.  */
+
+struct ctf_future
+{
+  ctf_list_t cfu_list;		/* Job queue forward/back pointers.  */
+  int cfu_fd;			/* File to open, or -1.  */
+  const ctf_archive_t *cfu_arc;	/* Archive to open a member of, or NULL.  */
+  char *cfu_name;		/* That member, or file to open if no fd.  */
+  ctf_file_t *cfu_fp;		/* Result, until handed out.  */
+  int cfu_err;			/* Error, if no result.  */
+  int cfu_started;		/* Nonzero once the job has started.  */
+  int cfu_done;			/* Nonzero once the job has finished.  */
+  int cfu_taken;		/* Nonzero once the result is handed out.  */
+  int cfu_refs;			/* References from caller and queue.  */
+};
+
+static pthread_mutex_t ctf_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctf_async_cond = PTHREAD_COND_INITIALIZER;
+static ctf_list_t ctf_async_queue;	/* Jobs not yet started.  */
+static unsigned long ctf_async_nqueued;	/* Number of jobs queued.  */
+static int ctf_async_nidle;		/* Threads waiting for the lock.  */
+static int ctf_async_nthreads;		/* Threads running.  */
+
+/* Drop a reference to a future.  Called with the lock held.  */
+
+static void
+ctf_future_unref (ctf_future_t *fu)
+{
+  if (--fu->cfu_refs > 0)
+    return;
+
+  ctf_close (fu->cfu_fp);
+  free (fu->cfu_name);
+  ctf_free (fu, sizeof (ctf_future_t));
+}
+
+static void
+ctf_async_run (ctf_future_t *fu)
+{
+  ctf_file_t *fp;
+  int err = 0;
+
+  if (fu->cfu_arc != NULL)
+    fp = ctf_arc_open_by_name (fu->cfu_arc, fu->cfu_name, &err);
+  else if (fu->cfu_fd < 0)
+    fp = ctf_open (fu->cfu_name, &err);
+  else
+    {
+      fp = ctf_fdopen (fu->cfu_fd, &err);
+      (void) close (fu->cfu_fd);
+      fu->cfu_fd = -1;
+    }
+
+  pthread_mutex_lock (&ctf_async_lock);
+  fu->cfu_fp = fp;
+  fu->cfu_err = err;
+  fu->cfu_done = 1;
+  pthread_cond_broadcast (&ctf_async_cond);
+  ctf_future_unref (fu);
+  pthread_mutex_unlock (&ctf_async_lock);
+}
+
+static void *
+ctf_async_thread (void *arg _libctf_unused_)
+{
+  ctf_future_t *fu;
+
+  pthread_mutex_lock (&ctf_async_lock);
+  while ((fu = ctf_list_next (&ctf_async_queue)) != NULL)
+    {
+      ctf_list_delete (&ctf_async_queue, fu);
+      ctf_async_nqueued--;
+      ctf_async_nidle--;
+      fu->cfu_started = 1;
+      pthread_mutex_unlock (&ctf_async_lock);
+
+      ctf_async_run (fu);
+
+      pthread_mutex_lock (&ctf_async_lock);
+      ctf_async_nidle++;
+    }
+  ctf_async_nidle--;
+  ctf_async_nthreads--;
+  pthread_mutex_unlock (&ctf_async_lock);
+
+  return NULL;
+}
+
+/* Queue a job, starting another thread if there are more jobs than idle
+   threads to run them.  If no thread can be started and none are running,
+   run the job in this thread instead.  */
+
+static void
+ctf_async_submit (ctf_future_t *fu)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  int run = 0;
+
+  fu->cfu_refs = 2;
+
+  pthread_mutex_lock (&ctf_async_lock);
+  ctf_list_append (&ctf_async_queue, fu);
+  ctf_async_nqueued++;
+
+  if ((unsigned long) ctf_async_nidle < ctf_async_nqueued
+      && ctf_async_nthreads < CTF_ASYNC_THREADS)
+    {
+      (void) pthread_attr_init (&attr);
+      (void) pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+      if (pthread_create (&thread, &attr, ctf_async_thread, NULL) == 0)
+	{
+	  ctf_async_nthreads++;
+	  ctf_async_nidle++;
+	}
+      (void) pthread_attr_destroy (&attr);
+    }
+
+  if (ctf_async_nthreads == 0)
+    {
+      ctf_list_delete (&ctf_async_queue, fu);
+      ctf_async_nqueued--;
+      fu->cfu_started = 1;
+      run = 1;
+    }
+  pthread_mutex_unlock (&ctf_async_lock);
+
+  if (run)
+    ctf_async_run (fu);
+}
+
+static ctf_future_t *
+ctf_future_alloc (int *errp)
+{
+  ctf_future_t *fu;
+
+  if ((fu = ctf_alloc (sizeof (ctf_future_t))) == NULL)
+    {
+      if (errp != NULL)
+	*errp = ENOMEM;
+      return NULL;
+    }
+
+  memset (fu, 0, sizeof (ctf_future_t));
+  fu->cfu_fd = -1;
+  return fu;
+}
+
+/* Start opening the specified file, as ctf_open() does, in the background.
+   The file itself is opened, and readahead of it started, before returning.
+   Returns a future to pass to ctf_future_get(), or NULL and sets *ERRP on
+   error.  */
+
+ctf_future_t *
+ctf_open_async (const char *filename, int *errp)
+{
+  ctf_future_t *fu;
+  int fd;
+
+  if ((fd = open (filename, O_RDONLY)) == -1)
+    {
+      if (errp != NULL)
+	*errp = errno;
+      return NULL;
+    }
+
+  if ((fu = ctf_future_alloc (errp)) == NULL)
+    {
+      (void) close (fd);
+      return NULL;
+    }
+
+  (void) posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+  fu->cfu_fd = fd;
+  ctf_async_submit (fu);
+  return fu;
+}
+
+/* Start opening the N named members of ARC, as ctf_arc_open_by_name() does, in
+   the background, placing a future for each in FUTURES.  The archive must
+   remain open until they have all been closed.  Returns zero, or an errno
+   value, in which case no futures are returned.  */
+
+int
+ctf_arc_prefetch (const ctf_archive_t *arc, const char **names, size_t n,
+		  ctf_future_t **futures)
+{
+  size_t i, j;
+  int err;
+
+  for (i = 0; i < n; i++)
+    {
+      if ((futures[i] = ctf_future_alloc (&err)) == NULL
+	  || (futures[i]->cfu_name = ctf_strdup (names[i])) == NULL)
+	{
+	  if (futures[i] != NULL)
+	    ctf_free (futures[i], sizeof (ctf_future_t));
+	  for (j = 0; j < i; j++)
+	    {
+	      free (futures[j]->cfu_name);
+	      ctf_free (futures[j], sizeof (ctf_future_t));
+	    }
+	  return ENOMEM;
+	}
+      futures[i]->cfu_arc = arc;
+    }
+
+  for (i = 0; i < n; i++)
+    ctf_async_submit (futures[i]);
+
+  return 0;
+}
+
+/* Open the N files named in PATHS, as ctf_open() does, placing the containers
+   in FPS.  The files are opened in parallel on the background pool, or one by
+   one here if it cannot be used.  If a file cannot be opened, its entry in FPS
+   is NULL and, if ERRS is non-NULL, the corresponding entry of ERRS is set to
+   the error (entries for files that opened are set to zero).  Returns the
+   number of files that could not be opened.  */
+
+int
+ctf_open_many (const char **paths, size_t n, ctf_file_t **fps, int *errs)
+{
+  ctf_future_t **futures;
+  size_t i;
+  int err, nfail = 0;
+
+  if ((futures = calloc (n, sizeof (ctf_future_t *))) != NULL)
+    for (i = 0; i < n; i++)
+      {
+	if ((futures[i] = ctf_future_alloc (NULL)) == NULL)
+	  continue;
+	if ((futures[i]->cfu_name = ctf_strdup (paths[i])) == NULL)
+	  {
+	    ctf_free (futures[i], sizeof (ctf_future_t));
+	    futures[i] = NULL;
+	    continue;
+	  }
+	ctf_async_submit (futures[i]);
+      }
+
+  for (i = 0; i < n; i++)
+    {
+      err = 0;
+      if (futures != NULL && futures[i] != NULL)
+	{
+	  fps[i] = ctf_future_get (futures[i], &err);
+	  ctf_future_close (futures[i]);
+	}
+      else
+	fps[i] = ctf_open (paths[i], &err);
+
+      if (fps[i] == NULL)
+	nfail++;
+      if (errs != NULL)
+	errs[i] = err;
+    }
+
+  free (futures);
+  return nfail;
+}
+
+/* Return nonzero if the future is done, so that ctf_future_get() will not
+   wait.  */
+
+int
+ctf_future_ready (ctf_future_t *fu)
+{
+  int done;
+
+  pthread_mutex_lock (&ctf_async_lock);
+  done = fu->cfu_done;
+  pthread_mutex_unlock (&ctf_async_lock);
+
+  return done;
+}
+
+/* Wait until the future is done, then return its container, or NULL and set
+   *ERRP if it could not be opened.  The future's reference to the container
+   is handed to the first caller, who must ctf_close() it; later calls return
+   NULL and EINVAL.  (ctf_close() does not take our lock, so handing out more
+   references would race with it.)  */
+
+ctf_file_t *
+ctf_future_get (ctf_future_t *fu, int *errp)
+{
+  ctf_file_t *fp;
+  int err;
+
+  pthread_mutex_lock (&ctf_async_lock);
+  while (!fu->cfu_done)
+    pthread_cond_wait (&ctf_async_cond, &ctf_async_lock);
+
+  fp = fu->cfu_fp;
+  err = fu->cfu_taken ? EINVAL : fu->cfu_err;
+  fu->cfu_fp = NULL;
+  fu->cfu_taken = 1;
+  pthread_mutex_unlock (&ctf_async_lock);
+
+  if (fp == NULL && errp != NULL)
+    *errp = err;
+
+  return fp;
+}
+
+/* Release a future.  If its work has not started, it is cancelled; if it is
+   under way, we wait for it to finish and throw its result away.  Either way,
+   nothing is using the file or archive any more when this returns.  */
+
+void
+ctf_future_close (ctf_future_t *fu)
+{
+  if (fu == NULL)
+    return;
+
+  pthread_mutex_lock (&ctf_async_lock);
+  if (!fu->cfu_started)
+    {
+      ctf_list_delete (&ctf_async_queue, fu);
+      ctf_async_nqueued--;
+      if (fu->cfu_fd >= 0)
+	(void) close (fu->cfu_fd);
+      fu->cfu_refs--;
+    }
+  else
+    while (!fu->cfu_done)
+      pthread_cond_wait (&ctf_async_cond, &ctf_async_lock);
+
+  ctf_future_unref (fu);
+  pthread_mutex_unlock (&ctf_async_lock);
+}
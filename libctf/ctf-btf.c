@@ -0,0 +1,1052 @@
+/* Importing BTF.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/* BTF is the compact type format the Linux kernel carries for itself (in
+   /sys/kernel/btf/vmlinux) and for its modules.  It describes much the same
+   things as CTF, so a BTF blob can be turned into a CTF container directly,
+   which is far faster than generating CTF from DWARF.
+
+   BTF type IDs are dense and start at 1, with 0 meaning void, so we keep an
+   array mapping each BTF ID to the CTF ID we gave it.  Types in BTF may refer
+   to types later in the blob, but ctf_add_struct_members() can only lay out
+   members whose types have been committed, so the import is done in three
+   passes over the blob:
+
+    - types that refer to no others (integers, floats, forwards, enums, and
+      structs and unions, without their members yet);
+    - types that do, in dependency order, and the integer types needed for
+      bit-field members;
+    - after ctf_update(), struct and union members and variables.
+
+   Importing into a child of an existing parent container is done by importing
+   into a standalone container first, then importing again into the child with
+   every type that has an equivalent in the parent mapped to that equivalent
+   in advance, so that only the types the parent lacks are created.
+
+   Only native-endian BTF describing a complete set of types is accepted: split
+   BTF, such as that of kernel modules, refers to types in the BTF of vmlinux,
+   which is not available here.  */
+
+#define CTF_BTF_MAXDEPTH 1024	/* Longest chain of references followed.  */
+#define CTF_BTF_BUSY ((ctf_id_t) -2)	/* Type being imported.  */
+
+/* The BTF format, from the kernel's include/uapi/linux/btf.h.  */
+
+#define BTF_MAGIC	0xeB9F
+#define BTF_VERSION	1
+
+#define BTF_KIND_UNKN		0
+#define BTF_KIND_INT		1
+#define BTF_KIND_PTR		2
+#define BTF_KIND_ARRAY		3
+#define BTF_KIND_STRUCT		4
+#define BTF_KIND_UNION		5
+#define BTF_KIND_ENUM		6
+#define BTF_KIND_FWD		7
+#define BTF_KIND_TYPEDEF	8
+#define BTF_KIND_VOLATILE	9
+#define BTF_KIND_CONST		10
+#define BTF_KIND_RESTRICT	11
+#define BTF_KIND_FUNC		12
+#define BTF_KIND_FUNC_PROTO	13
+#define BTF_KIND_VAR		14
+#define BTF_KIND_DATASEC	15
+#define BTF_KIND_FLOAT		16
+#define BTF_KIND_DECL_TAG	17
+#define BTF_KIND_TYPE_TAG	18
+#define BTF_KIND_ENUM64		19
+
+#define BTF_INFO_KIND(info)	(((info) >> 24) & 0x1f)
+#define BTF_INFO_VLEN(info)	((info) & 0xffff)
+#define BTF_INFO_KFLAG(info)	((info) >> 31)
+
+#define BTF_INT_ENCODING(data)	(((data) & 0x0f000000) >> 24)
+#define BTF_INT_OFFSET(data)	(((data) & 0x00ff0000) >> 16)
+#define BTF_INT_BITS(data)	((data) & 0x000000ff)
+
+#define BTF_INT_SIGNED	0x1
+#define BTF_INT_CHAR	0x2
+#define BTF_INT_BOOL	0x4
+
+#define BTF_MEMBER_BITFIELD_SIZE(off)	((off) >> 24)
+#define BTF_MEMBER_BIT_OFFSET(off)	((off) & 0xffffff)
+
+typedef struct btf_header
+{
+  uint16_t bth_magic;
+  uint8_t bth_version;
+  uint8_t bth_flags;
+  uint32_t bth_hdr_len;
+  uint32_t bth_type_off;	/* Offsets are from the end of the header.  */
+  uint32_t bth_type_len;
+  uint32_t bth_str_off;
+  uint32_t bth_str_len;
+} btf_header_t;
+
+typedef struct btf_type
+{
+  uint32_t btt_name_off;
+  uint32_t btt_info;
+  uint32_t btt_size_type;	/* Size, or type referenced, by kind.  */
+} btf_type_t;
+
+typedef struct btf_array
+{
+  uint32_t bta_type;
+  uint32_t bta_index_type;
+  uint32_t bta_nelems;
+} btf_array_t;
+
+typedef struct btf_member
+{
+  uint32_t btm_name_off;
+  uint32_t btm_type;
+  uint32_t btm_offset;
+} btf_member_t;
+
+typedef struct btf_enum
+{
+  uint32_t bte_name_off;
+  int32_t bte_val;
+} btf_enum_t;
+
+typedef struct btf_enum64
+{
+  uint32_t bte_name_off;
+  uint32_t bte_val_lo32;
+  uint32_t bte_val_hi32;
+} btf_enum64_t;
+
+typedef struct btf_param
+{
+  uint32_t btp_name_off;
+  uint32_t btp_type;
+} btf_param_t;
+
+typedef struct btf_var_secinfo
+{
+  uint32_t btv_type;
+  uint32_t btv_offset;
+  uint32_t btv_size;
+} btf_var_secinfo_t;
+
+/* An integer type made for bit-field members of BTF type CBB_BASE.  */
+
+typedef struct ctf_btf_bitfield
+{
+  uint32_t cbb_base;
+  uint32_t cbb_bits;
+  ctf_id_t cbb_type;
+} ctf_btf_bitfield_t;
+
+/* The state of an import.  */
+
+typedef struct ctf_btf
+{
+  const char *cb_strs;		/* BTF string table.  */
+  uint32_t cb_strlen;		/* Its length.  */
+  const btf_type_t **cb_types;	/* BTF types by ID, from 1.  */
+  uint32_t cb_ntypes;		/* Number of BTF types.  */
+  ctf_file_t *cb_fp;		/* Container being imported into.  */
+  ctf_id_t *cb_map;		/* CTF ID for each BTF ID, or CTF_ERR.  */
+  ctf_btf_bitfield_t *cb_bitfields;	/* Integers made for bit-fields.  */
+  size_t cb_nbitfields;		/* Number of them.  */
+  size_t cb_bfalloc;		/* Number allocated.  */
+} ctf_btf_t;
+
+static int
+ctf_btf_name_ok (const ctf_btf_t *cb, uint32_t off)
+{
+  return off < cb->cb_strlen;
+}
+
+static const char *
+ctf_btf_name (const ctf_btf_t *cb, uint32_t off)
+{
+  if (cb->cb_strs[off] == '\0')
+    return NULL;
+  return &cb->cb_strs[off];
+}
+
+/* Return the size of the data following a BTF type, or -1 if it is of no
+   known kind.  */
+
+static ssize_t
+ctf_btf_vlen_size (const btf_type_t *tp)
+{
+  uint32_t vlen = BTF_INFO_VLEN (tp->btt_info);
+
+  switch (BTF_INFO_KIND (tp->btt_info))
+    {
+    case BTF_KIND_INT:
+    case BTF_KIND_VAR:
+    case BTF_KIND_DECL_TAG:
+      return sizeof (uint32_t);
+    case BTF_KIND_ARRAY:
+      return sizeof (btf_array_t);
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION:
+      return vlen * sizeof (btf_member_t);
+    case BTF_KIND_ENUM:
+      return vlen * sizeof (btf_enum_t);
+    case BTF_KIND_ENUM64:
+      return vlen * sizeof (btf_enum64_t);
+    case BTF_KIND_FUNC_PROTO:
+      return vlen * sizeof (btf_param_t);
+    case BTF_KIND_DATASEC:
+      return vlen * sizeof (btf_var_secinfo_t);
+    case BTF_KIND_PTR:
+    case BTF_KIND_FWD:
+    case BTF_KIND_TYPEDEF:
+    case BTF_KIND_VOLATILE:
+    case BTF_KIND_CONST:
+    case BTF_KIND_RESTRICT:
+    case BTF_KIND_FUNC:
+    case BTF_KIND_FLOAT:
+    case BTF_KIND_TYPE_TAG:
+      return 0;
+    default:
+      return -1;
+    }
+}
+
+/* Check that every name and type referred to by a BTF type is in range, so
+   that the import passes need not.  */
+
+static int
+ctf_btf_check_type (const ctf_btf_t *cb, const btf_type_t *tp)
+{
+  uint32_t kind = BTF_INFO_KIND (tp->btt_info);
+  uint32_t vlen = BTF_INFO_VLEN (tp->btt_info);
+  uint32_t ntypes = cb->cb_ntypes;
+  uint32_t i;
+
+  if (!ctf_btf_name_ok (cb, tp->btt_name_off))
+    return ECTF_BADNAME;
+
+  switch (kind)
+    {
+    case BTF_KIND_PTR:
+    case BTF_KIND_TYPEDEF:
+    case BTF_KIND_VOLATILE:
+    case BTF_KIND_CONST:
+    case BTF_KIND_RESTRICT:
+    case BTF_KIND_FUNC:
+    case BTF_KIND_VAR:
+    case BTF_KIND_DECL_TAG:
+    case BTF_KIND_TYPE_TAG:
+    case BTF_KIND_FUNC_PROTO:
+      if (tp->btt_size_type > ntypes)
+	return ECTF_CORRUPT;
+      break;
+    }
+
+  switch (kind)
+    {
+    case BTF_KIND_ARRAY:
+      {
+	const btf_array_t *ap = (const btf_array_t *) (tp + 1);
+
+	if (ap->bta_type > ntypes || ap->bta_index_type > ntypes)
+	  return ECTF_CORRUPT;
+	break;
+      }
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION:
+      {
+	const btf_member_t *mp = (const btf_member_t *) (tp + 1);
+
+	for (i = 0; i < vlen; i++)
+	  if (!ctf_btf_name_ok (cb, mp[i].btm_name_off))
+	    return ECTF_BADNAME;
+	  else if (mp[i].btm_type == 0 || mp[i].btm_type > ntypes)
+	    return ECTF_CORRUPT;
+	break;
+      }
+    case BTF_KIND_ENUM:
+      {
+	const btf_enum_t *ep = (const btf_enum_t *) (tp + 1);
+
+	for (i = 0; i < vlen; i++)
+	  if (!ctf_btf_name_ok (cb, ep[i].bte_name_off))
+	    return ECTF_BADNAME;
+	break;
+      }
+    case BTF_KIND_ENUM64:
+      {
+	const btf_enum64_t *ep = (const btf_enum64_t *) (tp + 1);
+
+	for (i = 0; i < vlen; i++)
+	  if (!ctf_btf_name_ok (cb, ep[i].bte_name_off))
+	    return ECTF_BADNAME;
+	break;
+      }
+    case BTF_KIND_FUNC_PROTO:
+      {
+	const btf_param_t *pp = (const btf_param_t *) (tp + 1);
+
+	for (i = 0; i < vlen; i++)
+	  if (!ctf_btf_name_ok (cb, pp[i].btp_name_off))
+	    return ECTF_BADNAME;
+	  else if (pp[i].btp_type > ntypes
+		   || (pp[i].btp_type == 0 && i != vlen - 1))
+	    return ECTF_CORRUPT;
+	break;
+      }
+    case BTF_KIND_DATASEC:
+      {
+	const btf_var_secinfo_t *vp = (const btf_var_secinfo_t *) (tp + 1);
+
+	for (i = 0; i < vlen; i++)
+	  if (vp[i].btv_type == 0 || vp[i].btv_type > ntypes)
+	    return ECTF_CORRUPT;
+	break;
+      }
+    }
+
+  return 0;
+}
+
+/* Validate the BTF in BUF, and index its types.  */
+
+static int
+ctf_btf_index (ctf_btf_t *cb, const void *buf, size_t size)
+{
+  const btf_header_t *hp = buf;
+  const unsigned char *types, *p, *end;
+  uint32_t ntypes, n;
+  int err;
+
+  memset (cb, 0, sizeof (ctf_btf_t));
+
+  if (size < sizeof (btf_header_t))
+    return ECTF_NOCTFBUF;
+
+  if (hp->bth_magic != BTF_MAGIC)
+    {
+      if (hp->bth_magic == ((BTF_MAGIC & 0xff) << 8 | BTF_MAGIC >> 8))
+	return ECTF_ENDIAN;
+      return ECTF_NOCTFBUF;
+    }
+
+  if (hp->bth_version != BTF_VERSION)
+    return ECTF_CTFVERS;
+
+  if (hp->bth_hdr_len < sizeof (btf_header_t) || hp->bth_hdr_len > size
+      || hp->bth_type_off > size - hp->bth_hdr_len
+      || hp->bth_type_len > size - hp->bth_hdr_len - hp->bth_type_off
+      || hp->bth_str_off > size - hp->bth_hdr_len
+      || hp->bth_str_len > size - hp->bth_hdr_len - hp->bth_str_off
+      || ((hp->bth_hdr_len + hp->bth_type_off) & 3) != 0)
+    return ECTF_CORRUPT;
+
+  cb->cb_strs = (const char *) buf + hp->bth_hdr_len + hp->bth_str_off;
+  cb->cb_strlen = hp->bth_str_len;
+
+  if (cb->cb_strlen == 0 || cb->cb_strs[0] != '\0'
+      || cb->cb_strs[cb->cb_strlen - 1] != '\0')
+    return ECTF_STRBAD;
+
+  /* Count the types first, so the index can be allocated at once.  */
+
+  types = (const unsigned char *) buf + hp->bth_hdr_len + hp->bth_type_off;
+  end = types + hp->bth_type_len;
+
+  for (ntypes = 0, p = types; p < end; ntypes++)
+    {
+      const btf_type_t *tp = (const btf_type_t *) p;
+      ssize_t vsize;
+
+      if ((size_t) (end - p) < sizeof (btf_type_t)
+	  || (vsize = ctf_btf_vlen_size (tp)) < 0
+	  || (size_t) (end - p) - sizeof (btf_type_t) < (size_t) vsize)
+	return ECTF_CORRUPT;
+      p += sizeof (btf_type_t) + vsize;
+    }
+
+  if (ntypes > CTF_MAX_TYPE)
+    return ECTF_FULL;
+
+  cb->cb_types = ctf_alloc ((ntypes + 1) * sizeof (btf_type_t *));
+  if (cb->cb_types == NULL)
+    return ENOMEM;
+
+  cb->cb_ntypes = ntypes;
+  cb->cb_types[0] = NULL;
+
+  for (n = 1, p = types; p < end; n++)
+    {
+      const btf_type_t *tp = (const btf_type_t *) p;
+
+      cb->cb_types[n] = tp;
+      p += sizeof (btf_type_t) + ctf_btf_vlen_size (tp);
+    }
+
+  for (n = 1; n <= ntypes; n++)
+    if ((err = ctf_btf_check_type (cb, cb->cb_types[n])) != 0)
+      {
+	ctf_free (cb->cb_types, (ntypes + 1) * sizeof (btf_type_t *));
+	cb->cb_types = NULL;
+	return err;
+      }
+
+  return 0;
+}
+
+/* Return nonzero if TYPE belongs to the container being imported into, rather
+   than to its parent.  */
+
+static int
+ctf_btf_ours (const ctf_btf_t *cb, ctf_id_t type)
+{
+  return (!(cb->cb_fp->ctf_flags & LCTF_CHILD)
+	  || !LCTF_TYPE_ISPARENT (cb->cb_fp, type));
+}
+
+static void
+ctf_btf_int_encoding (const btf_type_t *tp, ctf_encoding_t *ep)
+{
+  uint32_t data = *(const uint32_t *) (tp + 1);
+
+  ep->cte_format = 0;
+  if (BTF_INT_ENCODING (data) & BTF_INT_SIGNED)
+    ep->cte_format |= CTF_INT_SIGNED;
+  if (BTF_INT_ENCODING (data) & BTF_INT_CHAR)
+    ep->cte_format |= CTF_INT_CHAR;
+  if (BTF_INT_ENCODING (data) & BTF_INT_BOOL)
+    ep->cte_format |= CTF_INT_BOOL;
+  ep->cte_offset = BTF_INT_OFFSET (data);
+  ep->cte_bits = BTF_INT_BITS (data);
+}
+
+/* Return the CTF type for void, creating it if need be.  */
+
+static ctf_id_t
+ctf_btf_void (ctf_btf_t *cb)
+{
+  ctf_encoding_t enc = { 0, 0, 0 };
+
+  if (cb->cb_map[0] == CTF_ERR)
+    cb->cb_map[0] = ctf_add_integer (cb->cb_fp, CTF_ADD_ROOT, "void", &enc);
+
+  return cb->cb_map[0];
+}
+
+/* Import a BTF type that refers to no others.  */
+
+static int
+ctf_btf_add_base (ctf_btf_t *cb, uint32_t id)
+{
+  const btf_type_t *tp = cb->cb_types[id];
+  const char *name = ctf_btf_name (cb, tp->btt_name_off);
+  uint32_t vlen = BTF_INFO_VLEN (tp->btt_info);
+  ctf_file_t *fp = cb->cb_fp;
+  ctf_encoding_t enc;
+  ctf_enum_spec_t *enums;
+  ctf_id_t type;
+  uint32_t i;
+  int err = 0;
+
+  switch (BTF_INFO_KIND (tp->btt_info))
+    {
+    case BTF_KIND_INT:
+      ctf_btf_int_encoding (tp, &enc);
+      type = ctf_add_integer (fp, CTF_ADD_ROOT, name, &enc);
+      break;
+
+    case BTF_KIND_FLOAT:
+      switch (tp->btt_size_type)
+	{
+	case 4:
+	  enc.cte_format = CTF_FP_SINGLE;
+	  break;
+	case 8:
+	  enc.cte_format = CTF_FP_DOUBLE;
+	  break;
+	default:
+	  enc.cte_format = CTF_FP_LDOUBLE;
+	}
+      enc.cte_offset = 0;
+      enc.cte_bits = tp->btt_size_type * NBBY;
+      type = ctf_add_float (fp, CTF_ADD_ROOT, name, &enc);
+      break;
+
+    case BTF_KIND_FWD:
+      type = ctf_add_forward (fp, CTF_ADD_ROOT, name,
+			      BTF_INFO_KFLAG (tp->btt_info)
+			      ? CTF_K_UNION : CTF_K_STRUCT);
+      break;
+
+    case BTF_KIND_STRUCT:
+      type = ctf_add_struct_sized (fp, CTF_ADD_ROOT, name, tp->btt_size_type);
+      break;
+
+    case BTF_KIND_UNION:
+      type = ctf_add_union_sized (fp, CTF_ADD_ROOT, name, tp->btt_size_type);
+      break;
+
+    case BTF_KIND_ENUM:
+    case BTF_KIND_ENUM64:
+      if ((type = ctf_add_enum (fp, CTF_ADD_ROOT, name)) == CTF_ERR
+	  || vlen == 0)
+	break;
+
+      if ((enums = ctf_alloc (vlen * sizeof (ctf_enum_spec_t))) == NULL)
+	return ENOMEM;
+
+      /* CTF enumerators are ints, so 64-bit values are truncated.  */
+
+      for (i = 0; i < vlen; i++)
+	{
+	  if (BTF_INFO_KIND (tp->btt_info) == BTF_KIND_ENUM)
+	    {
+	      const btf_enum_t *ep = (const btf_enum_t *) (tp + 1);
+
+	      enums[i].ctes_name = ctf_btf_name (cb, ep[i].bte_name_off);
+	      enums[i].ctes_value = ep[i].bte_val;
+	    }
+	  else
+	    {
+	      const btf_enum64_t *ep = (const btf_enum64_t *) (tp + 1);
+
+	      enums[i].ctes_name = ctf_btf_name (cb, ep[i].bte_name_off);
+	      enums[i].ctes_value = (int) ep[i].bte_val_lo32;
+	    }
+	  if (enums[i].ctes_name == NULL)
+	    err = ECTF_CORRUPT;
+	}
+
+      if (err == 0 && ctf_add_enumerators (fp, type, enums, vlen) < 0)
+	type = CTF_ERR;
+      ctf_free (enums, vlen * sizeof (ctf_enum_spec_t));
+      if (err != 0)
+	return err;
+      break;
+
+    default:
+      return 0;
+    }
+
+  if (type == CTF_ERR)
+    return ctf_errno (fp);
+
+  cb->cb_map[id] = type;
+  return 0;
+}
+
+/* Return the CTF type for BTF type ID, importing it and the types it refers
+   to first if need be.  */
+
+static ctf_id_t
+ctf_btf_ref (ctf_btf_t *cb, uint32_t id, int depth)
+{
+  const btf_type_t *tp = cb->cb_types[id];
+  ctf_file_t *fp = cb->cb_fp;
+  ctf_id_t type, ref;
+
+  if (id == 0)
+    return ctf_btf_void (cb);
+
+  if (cb->cb_map[id] == CTF_BTF_BUSY || depth > CTF_BTF_MAXDEPTH)
+    return (ctf_set_errno (fp, ECTF_CORRUPT));
+
+  if (cb->cb_map[id] != CTF_ERR)
+    return cb->cb_map[id];
+
+  cb->cb_map[id] = CTF_BTF_BUSY;
+
+  switch (BTF_INFO_KIND (tp->btt_info))
+    {
+    case BTF_KIND_PTR:
+    case BTF_KIND_TYPEDEF:
+    case BTF_KIND_VOLATILE:
+    case BTF_KIND_CONST:
+    case BTF_KIND_RESTRICT:
+      if ((ref = ctf_btf_ref (cb, tp->btt_size_type, depth + 1)) == CTF_ERR)
+	{
+	  type = CTF_ERR;
+	  break;
+	}
+
+      switch (BTF_INFO_KIND (tp->btt_info))
+	{
+	case BTF_KIND_PTR:
+	  type = ctf_add_pointer (fp, CTF_ADD_ROOT, ref);
+	  break;
+	case BTF_KIND_TYPEDEF:
+	  type = ctf_add_typedef (fp, CTF_ADD_ROOT,
+				  ctf_btf_name (cb, tp->btt_name_off), ref);
+	  break;
+	case BTF_KIND_VOLATILE:
+	  type = ctf_add_volatile (fp, CTF_ADD_ROOT, ref);
+	  break;
+	case BTF_KIND_CONST:
+	  type = ctf_add_const (fp, CTF_ADD_ROOT, ref);
+	  break;
+	default:
+	  type = ctf_add_restrict (fp, CTF_ADD_ROOT, ref);
+	}
+      break;
+
+      /* CTF has no type tags, and no function types with names: both are
+	 imported as the type they refer to.  */
+
+    case BTF_KIND_TYPE_TAG:
+    case BTF_KIND_FUNC:
+      type = ctf_btf_ref (cb, tp->btt_size_type, depth + 1);
+      break;
+
+    case BTF_KIND_ARRAY:
+      {
+	const btf_array_t *ap = (const btf_array_t *) (tp + 1);
+	ctf_arinfo_t ar;
+
+	if ((ar.ctr_contents = ctf_btf_ref (cb, ap->bta_type,
+					    depth + 1)) == CTF_ERR
+	    || (ar.ctr_index = ctf_btf_ref (cb, ap->bta_index_type,
+					    depth + 1)) == CTF_ERR)
+	  {
+	    type = CTF_ERR;
+	    break;
+	  }
+	ar.ctr_nelems = ap->bta_nelems;
+	type = ctf_add_array (fp, CTF_ADD_ROOT, &ar);
+	break;
+      }
+
+    case BTF_KIND_FUNC_PROTO:
+      {
+	const btf_param_t *pp = (const btf_param_t *) (tp + 1);
+	uint32_t vlen = BTF_INFO_VLEN (tp->btt_info);
+	ctf_funcinfo_t ctc;
+	ctf_id_t *argv = NULL;
+	uint32_t i;
+
+	type = CTF_ERR;
+	ctc.ctc_argc = vlen;
+	ctc.ctc_flags = 0;
+
+	/* A final argument of type void means varargs.  */
+
+	if (vlen > 0 && pp[vlen - 1].btp_type == 0)
+	  {
+	    ctc.ctc_argc--;
+	    ctc.ctc_flags |= CTF_FUNC_VARARG;
+	  }
+
+	if (ctc.ctc_argc > 0
+	    && (argv = ctf_alloc (ctc.ctc_argc * sizeof (ctf_id_t))) == NULL)
+	  {
+	    ctf_set_errno (fp, ENOMEM);
+	    break;
+	  }
+
+	for (i = 0; i < ctc.ctc_argc; i++)
+	  {
+	    argv[i] = ctf_btf_ref (cb, pp[i].btp_type, depth + 1);
+	    if (argv[i] == CTF_ERR)
+	      break;
+	  }
+
+	if (i == ctc.ctc_argc
+	    && (ctc.ctc_return = ctf_btf_ref (cb, tp->btt_size_type,
+					      depth + 1)) != CTF_ERR)
+	  type = ctf_add_function (fp, CTF_ADD_ROOT, &ctc, argv);
+
+	ctf_free (argv, ctc.ctc_argc * sizeof (ctf_id_t));
+	break;
+      }
+
+      /* Variables, sections and declaration tags are not types, so nothing
+	 can refer to them.  */
+
+    default:
+      type = ctf_set_errno (fp, ECTF_CORRUPT);
+    }
+
+  cb->cb_map[id] = type;
+  return type;
+}
+
+/* Return an integer type for bit-field members of BTF type ID that are BITS
+   wide, creating it if need be.  It is like the integer type ID resolves to,
+   but narrower, and not visible at the root so that lookups by name find the
+   full-width type.  Bit-fields of enum type are given an integer type too,
+   since CTF cannot narrow an enum.  */
+
+static ctf_id_t
+ctf_btf_bitfield (ctf_btf_t *cb, uint32_t id, uint32_t bits)
+{
+  ctf_file_t *fp = cb->cb_fp;
+  const btf_type_t *tp;
+  ctf_btf_bitfield_t *bf;
+  ctf_encoding_t enc;
+  const char *name;
+  ctf_id_t type;
+  size_t i;
+  int depth;
+
+  for (depth = 0; depth < CTF_BTF_MAXDEPTH; depth++)
+    {
+      tp = cb->cb_types[id];
+      switch (BTF_INFO_KIND (tp->btt_info))
+	{
+	case BTF_KIND_TYPEDEF:
+	case BTF_KIND_VOLATILE:
+	case BTF_KIND_CONST:
+	case BTF_KIND_RESTRICT:
+	case BTF_KIND_TYPE_TAG:
+	  if ((id = tp->btt_size_type) == 0)
+	    return (ctf_set_errno (fp, ECTF_CORRUPT));
+	  continue;
+	}
+      break;
+    }
+
+  for (i = 0; i < cb->cb_nbitfields; i++)
+    {
+      bf = &cb->cb_bitfields[i];
+      if (bf->cbb_base == id && bf->cbb_bits == bits)
+	return bf->cbb_type;
+    }
+
+  switch (BTF_INFO_KIND (tp->btt_info))
+    {
+    case BTF_KIND_INT:
+      ctf_btf_int_encoding (tp, &enc);
+      name = ctf_btf_name (cb, tp->btt_name_off);
+      break;
+    case BTF_KIND_ENUM:
+    case BTF_KIND_ENUM64:
+      enc.cte_format = 0;
+      name = "unsigned int";
+      if (BTF_INFO_KFLAG (tp->btt_info))
+	{
+	  enc.cte_format = CTF_INT_SIGNED;
+	  name = "int";
+	}
+      break;
+    default:
+      return (ctf_set_errno (fp, ECTF_CORRUPT));
+    }
+
+  enc.cte_offset = 0;
+  enc.cte_bits = bits;
+
+  if (cb->cb_nbitfields == cb->cb_bfalloc)
+    {
+      size_t alloc = cb->cb_bfalloc ? cb->cb_bfalloc * 2 : 16;
+
+      if ((bf = realloc (cb->cb_bitfields,
+			 alloc * sizeof (ctf_btf_bitfield_t))) == NULL)
+	return (ctf_set_errno (fp, ENOMEM));
+      cb->cb_bitfields = bf;
+      cb->cb_bfalloc = alloc;
+    }
+
+  if ((type = ctf_add_integer (fp, CTF_ADD_NONROOT, name, &enc)) == CTF_ERR)
+    return CTF_ERR;			/* errno is set for us.  */
+
+  bf = &cb->cb_bitfields[cb->cb_nbitfields++];
+  bf->cbb_base = id;
+  bf->cbb_bits = bits;
+  bf->cbb_type = type;
+  return type;
+}
+
+/* Add the members of a struct or union.  MEMBERS has room for them all.  */
+
+static int
+ctf_btf_add_members (ctf_btf_t *cb, uint32_t id, ctf_member_spec_t *members)
+{
+  const btf_type_t *tp = cb->cb_types[id];
+  const btf_member_t *mp = (const btf_member_t *) (tp + 1);
+  uint32_t vlen = BTF_INFO_VLEN (tp->btt_info);
+  int kflag = BTF_INFO_KFLAG (tp->btt_info);
+  uint32_t i;
+
+  for (i = 0; i < vlen; i++)
+    {
+      uint32_t bits = kflag ? BTF_MEMBER_BITFIELD_SIZE (mp[i].btm_offset) : 0;
+
+      members[i].ctms_name = ctf_btf_name (cb, mp[i].btm_name_off);
+      members[i].ctms_offset = kflag ? BTF_MEMBER_BIT_OFFSET (mp[i].btm_offset)
+	: mp[i].btm_offset;
+
+      if (bits != 0)
+	members[i].ctms_type = ctf_btf_bitfield (cb, mp[i].btm_type, bits);
+      else
+	members[i].ctms_type = cb->cb_map[mp[i].btm_type];
+
+      if (members[i].ctms_type == CTF_ERR)
+	return ECTF_CORRUPT;
+    }
+
+  if (ctf_add_struct_members (cb->cb_fp, cb->cb_map[id], members, vlen) < 0)
+    return ctf_errno (cb->cb_fp);
+
+  return 0;
+}
+
+/* Import every BTF type not already mapped in MAP into FP.  */
+
+static int
+ctf_btf_import (ctf_btf_t *cb, ctf_file_t *fp, ctf_id_t *map)
+{
+  ctf_member_spec_t *members = NULL;
+  uint32_t id, i, kind, maxvlen = 0;
+  int err = 0;
+
+  cb->cb_fp = fp;
+  cb->cb_map = map;
+  cb->cb_nbitfields = 0;
+
+  for (id = 1; id <= cb->cb_ntypes; id++)
+    if (map[id] == CTF_ERR && (err = ctf_btf_add_base (cb, id)) != 0)
+      return err;
+
+  for (id = 1; id <= cb->cb_ntypes; id++)
+    {
+      const btf_type_t *tp = cb->cb_types[id];
+
+      kind = BTF_INFO_KIND (tp->btt_info);
+      if (kind == BTF_KIND_VAR || kind == BTF_KIND_DATASEC
+	  || kind == BTF_KIND_DECL_TAG)
+	continue;
+
+      if (ctf_btf_ref (cb, id, 0) == CTF_ERR)
+	return ctf_errno (fp);
+    }
+
+  /* Bit-field members need integer types of their own, which must be
+     committed along with everything else before the members are added.  */
+
+  for (id = 1; id <= cb->cb_ntypes; id++)
+    {
+      const btf_type_t *tp = cb->cb_types[id];
+      const btf_member_t *mp = (const btf_member_t *) (tp + 1);
+
+      kind = BTF_INFO_KIND (tp->btt_info);
+      if ((kind != BTF_KIND_STRUCT && kind != BTF_KIND_UNION)
+	  || !ctf_btf_ours (cb, cb->cb_map[id]))
+	continue;
+
+      maxvlen = MAX (maxvlen, BTF_INFO_VLEN (tp->btt_info));
+      if (!BTF_INFO_KFLAG (tp->btt_info))
+	continue;
+
+      for (i = 0; i < BTF_INFO_VLEN (tp->btt_info); i++)
+	if (BTF_MEMBER_BITFIELD_SIZE (mp[i].btm_offset) != 0
+	    && ctf_btf_bitfield (cb, mp[i].btm_type,
+				 BTF_MEMBER_BITFIELD_SIZE (mp[i].btm_offset))
+	    == CTF_ERR)
+	  return ctf_errno (fp);
+    }
+
+  if (ctf_update (fp) < 0)
+    return ctf_errno (fp);
+
+  if (maxvlen > 0
+      && (members = ctf_alloc (maxvlen * sizeof (ctf_member_spec_t))) == NULL)
+    return ENOMEM;
+
+  for (id = 1; id <= cb->cb_ntypes && err == 0; id++)
+    {
+      const btf_type_t *tp = cb->cb_types[id];
+      const char *name;
+
+      switch (BTF_INFO_KIND (tp->btt_info))
+	{
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+	  /* Types mapped to the parent's are already complete.  */
+	  if (ctf_btf_ours (cb, cb->cb_map[id])
+	      && BTF_INFO_VLEN (tp->btt_info) > 0)
+	    err = ctf_btf_add_members (cb, id, members);
+	  break;
+
+	case BTF_KIND_VAR:
+	  if (cb->cb_map[tp->btt_size_type] == CTF_ERR)
+	    err = ECTF_CORRUPT;
+	  else if ((name = ctf_btf_name (cb, tp->btt_name_off)) != NULL
+		   && ctf_add_variable (fp, name,
+					cb->cb_map[tp->btt_size_type]) < 0
+		   && ctf_errno (fp) != ECTF_DUPLICATE)
+	    err = ctf_errno (fp);
+	  break;
+	}
+    }
+
+  ctf_free (members, maxvlen * sizeof (ctf_member_spec_t));
+
+  if (err == 0 && ctf_update (fp) < 0)
+    err = ctf_errno (fp);
+
+  return err;
+}
+
+/* Create a CTF container with the types described by the BTF in BUF, of SIZE
+   bytes, which must be 4-byte aligned.  If PARENT is non-NULL, the container
+   is made a child of it, and contains only those types that PARENT does not
+   already have an equivalent for.  The container is writable, and can be
+   written out with ctf_write() or added to an archive like any other.
+
+   Returns NULL and sets *ERRP on error.  */
+
+ctf_file_t *
+ctf_btf_bufopen (const void *buf, size_t size, ctf_file_t *parent, int *errp)
+{
+  ctf_btf_t cb;
+  ctf_file_t *fp = NULL, *cfp = NULL;
+  ctf_id_t *map = NULL, *cmap = NULL;
+  uint32_t i;
+  int err;
+
+  if (((uintptr_t) buf & 3) != 0)
+    return (ctf_set_open_errno (errp, EINVAL));
+
+  if ((err = ctf_btf_index (&cb, buf, size)) != 0)
+    return (ctf_set_open_errno (errp, err));
+
+  if ((map = ctf_alloc ((cb.cb_ntypes + 1) * sizeof (ctf_id_t))) == NULL
+      || (parent != NULL
+	  && (cmap = ctf_alloc ((cb.cb_ntypes + 1)
+				* sizeof (ctf_id_t))) == NULL))
+    {
+      err = ENOMEM;
+      goto err;
+    }
+
+  for (i = 0; i <= cb.cb_ntypes; i++)
+    map[i] = CTF_ERR;
+
+  if ((fp = ctf_create (&err)) == NULL)
+    goto err;
+
+  if (parent != NULL && ctf_setmodel (fp, ctf_getmodel (parent)) < 0)
+    {
+      err = ctf_errno (fp);
+      goto err;
+    }
+
+  if ((err = ctf_btf_import (&cb, fp, map)) != 0)
+    goto err;
+
+  if (parent == NULL)
+    goto done;
+
+  /* Import again into a child, with the types the parent already has mapped
+     to the parent's types in advance.  */
+
+  for (i = 0; i <= cb.cb_ntypes; i++)
+    {
+      cmap[i] = CTF_ERR;
+      if (map[i] != CTF_ERR)
+	cmap[i] = ctf_type_find_equiv (parent, fp, map[i]);
+    }
+
+  if ((cfp = ctf_create (&err)) == NULL)
+    goto err;
+
+  if (ctf_setmodel (cfp, ctf_getmodel (parent)) < 0
+      || ctf_import (cfp, parent) < 0)
+    {
+      err = ctf_errno (cfp);
+      goto err;
+    }
+
+  if ((err = ctf_btf_import (&cb, cfp, cmap)) != 0)
+    goto err;
+
+  ctf_close (fp);
+  fp = cfp;
+  cfp = NULL;
+
+done:
+  ctf_free (map, (cb.cb_ntypes + 1) * sizeof (ctf_id_t));
+  ctf_free (cmap, (cb.cb_ntypes + 1) * sizeof (ctf_id_t));
+  ctf_free (cb.cb_types, (cb.cb_ntypes + 1) * sizeof (btf_type_t *));
+  free (cb.cb_bitfields);
+  return fp;
+
+err:
+  ctf_close (cfp);
+  ctf_close (fp);
+  fp = NULL;
+  ctf_set_open_errno (errp, err);
+  goto done;
+}
+
+/* Create a CTF container from the BTF in the named file, such as
+   /sys/kernel/btf/vmlinux, as ctf_btf_bufopen() does.  */
+
+ctf_file_t *
+ctf_btf_open (const char *filename, ctf_file_t *parent, int *errp)
+{
+  ctf_file_t *fp;
+  struct stat st;
+  size_t size = 0, alloc;
+  ssize_t len;
+  char *buf, *nbuf;
+  int fd;
+
+  if ((fd = open (filename, O_RDONLY)) == -1)
+    return (ctf_set_open_errno (errp, errno));
+
+  /* Files in sysfs do not always know their own size, so read to EOF.  */
+
+  if (fstat (fd, &st) < 0)
+    {
+      (void) close (fd);
+      return (ctf_set_open_errno (errp, errno));
+    }
+
+  alloc = st.st_size > 0 ? (size_t) st.st_size + 1 : 65536;
+  if ((buf = malloc (alloc)) == NULL)
+    {
+      (void) close (fd);
+      return (ctf_set_open_errno (errp, ENOMEM));
+    }
+
+  while ((len = read (fd, buf + size, alloc - size)) != 0)
+    {
+      if (len < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  free (buf);
+	  (void) close (fd);
+	  return (ctf_set_open_errno (errp, errno));
+	}
+
+      size += len;
+      if (size == alloc)
+	{
+	  if ((nbuf = realloc (buf, alloc * 2)) == NULL)
+	    {
+	      free (buf);
+	      (void) close (fd);
+	      return (ctf_set_open_errno (errp, ENOMEM));
+	    }
+	  buf = nbuf;
+	  alloc *= 2;
+	}
+    }
+  (void) close (fd);
+
+  fp = ctf_btf_bufopen (buf, size, parent, errp);
+  free (buf);
+  return fp;
+}
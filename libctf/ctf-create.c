@@ -10,6 +10,7 @@
 #include <sys/param.h>
 #include <sys/mman.h>
 #include <assert.h>
+#include <sched.h>
 #include <gelf.h>
 #include <string.h>
 #include <ctf-impl.h>
@@ -71,158 +72,39 @@ ctf_create (int *errp)
   return fp;
 }
 
-static unsigned char *
-ctf_copy_smembers (ctf_dtdef_t *dtd, uint32_t soff, unsigned char *t)
-{
-  ctf_dmdef_t *dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
-  ctf_member_t ctm;
-
-  for (; dmd != NULL; dmd = ctf_list_next (dmd))
-    {
-      if (dmd->dmd_name)
-	{
-	  ctm.ctm_name = soff;
-	  soff += strlen (dmd->dmd_name) + 1;
-	}
-      else
-	ctm.ctm_name = 0;
-
-      ctm.ctm_type = (uint32_t) dmd->dmd_type;
-      ctm.ctm_offset = (uint32_t) dmd->dmd_offset;
-
-      memcpy (t, &ctm, sizeof (ctm));
-      t += sizeof (ctm);
-    }
-
-  return t;
-}
-
-static unsigned char *
-ctf_copy_lmembers (ctf_dtdef_t *dtd, uint32_t soff, unsigned char *t)
-{
-  ctf_dmdef_t *dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
-  ctf_lmember_t ctlm;
-
-  for (; dmd != NULL; dmd = ctf_list_next (dmd))
-    {
-      if (dmd->dmd_name)
-	{
-	  ctlm.ctlm_name = soff;
-	  soff += strlen (dmd->dmd_name) + 1;
-	}
-      else
-	ctlm.ctlm_name = 0;
-
-      ctlm.ctlm_type = (uint32_t) dmd->dmd_type;
-      ctlm.ctlm_offsethi = CTF_OFFSET_TO_LMEMHI (dmd->dmd_offset);
-      ctlm.ctlm_offsetlo = CTF_OFFSET_TO_LMEMLO (dmd->dmd_offset);
-
-      memcpy (t, &ctlm, sizeof (ctlm));
-      t += sizeof (ctlm);
-    }
-
-  return t;
-}
-
-static unsigned char *
-ctf_copy_emembers (ctf_dtdef_t *dtd, uint32_t soff, unsigned char *t)
-{
-  ctf_dmdef_t *dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
-  ctf_enum_t cte;
-
-  for (; dmd != NULL; dmd = ctf_list_next (dmd))
-    {
-      cte.cte_name = soff;
-      cte.cte_value = dmd->dmd_value;
-      soff += strlen (dmd->dmd_name) + 1;
-      memcpy (t, &cte, sizeof (cte));
-      t += sizeof (cte);
-    }
-
-  return t;
-}
-
-static unsigned char *
-ctf_copy_membnames (ctf_dtdef_t *dtd, unsigned char *s)
-{
-  ctf_dmdef_t *dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
-  size_t len;
+/* Serialization of dynamic containers.
 
-  for (; dmd != NULL; dmd = ctf_list_next (dmd))
-    {
-      if (dmd->dmd_name == NULL)
-	continue;			/* Skip anonymous members.  */
-      len = strlen (dmd->dmd_name) + 1;
-      memcpy (s, dmd->dmd_name, len);
-      s += len;
-    }
+   The serialized form of a dynamic container is computed directly from its
+   dynamic type and variable definitions and streamed out through a ctf_sink_t
+   piece by piece: ctf_update() streams it into a memory buffer which it then
+   reopens, while ctf_serialize_to_fd() streams it straight into a file.
 
-  return s;
-}
+   The string table is laid out as follows: the empty string, the parent name
+   (if any), the variable names in definition order, then, for each type in
+   definition order, its name followed by the names of its members.  The type
+   section refers to strings by offset, so we compute those offsets as we go,
+   then lay down the strings themselves in the same order at the end.  */
 
-/* Sort a newly-constructed static variable array.  */
-
-const char *sort_strtab_ = NULL;
-
-static int
-ctf_sort_var (const void *one_, const void *two_)
-{
-  const ctf_varent_t *one = one_;
-  const ctf_varent_t *two = two_;
-  const char *strtab = sort_strtab_;
-  const char *n1 = strtab + CTF_NAME_OFFSET (one->ctv_name);
-  const char *n2 = strtab + CTF_NAME_OFFSET (two->ctv_name);
+/* Compute the header of the serialized form of FP.  */
 
-  return (strcmp (n1, n2));
-}
-
-/* If the specified CTF container is writable and has been modified, reload this
-   container with the updated type definitions.  In order to make this code and
-   the rest of libctf as simple as possible, we perform updates by taking the
-   dynamic type definitions and creating an in-memory CTF file containing the
-   definitions, and then call ctf_bufopen() on it.  This not only leverages
-   ctf_bufopen(), but also avoids having to bifurcate the rest of the library
-   code with different lookup paths for static and dynamic type definitions.  We
-/   are therefore optimizing greatly for lookup over update, which we assume will
-   be an uncommon operation.  We perform one extra trick here for the benefit of
-   callers and to keep our code simple: ctf_bufopen() will return a new
-   ctf_file_t, but we want to keep the fp constant for the caller, so after
-   ctf_bufopen() returns, we use memcpy to swap the interior of the old and new
-   ctf_file_t's, and then free the old.  */
-int
-ctf_update (ctf_file_t *fp)
+static void
+ctf_serialize_header (ctf_file_t *fp, ctf_header_t *hdr)
 {
-  ctf_file_t ofp, *nfp;
-  ctf_header_t hdr;
   ctf_dtdef_t *dtd;
   ctf_dvdef_t *dvd;
-  ctf_varent_t *dvarents;
-  ctf_sect_t cts;
-
-  unsigned char *s, *s0, *t;
-  unsigned long i;
-  size_t buf_size, type_size, nvars;
-  void *buf;
-  int err;
-
-  if (!(fp->ctf_flags & LCTF_RDWR))
-    return (ctf_set_errno (fp, ECTF_RDONLY));
-
-  /* Update required?  */
-  if (!(fp->ctf_flags & LCTF_DIRTY))
-    return 0;
+  size_t type_size, nvars;
 
   /* Fill in an initial CTF header.  We will leave the label, object,
      and function sections empty and only output a header, type section,
      and string table.  The type section begins at a 4-byte aligned
      boundary past the CTF header itself (at relative offset zero).  */
 
-  memset (&hdr, 0, sizeof (hdr));
-  hdr.cth_magic = CTF_MAGIC;
-  hdr.cth_version = CTF_VERSION;
+  memset (hdr, 0, sizeof (ctf_header_t));
+  hdr->cth_magic = CTF_MAGIC;
+  hdr->cth_version = CTF_VERSION;
 
   if (fp->ctf_flags & LCTF_CHILD)
-    hdr.cth_parname = 1;		/* parname added just below.  */
+    hdr->cth_parname = 1;		/* parname added just below.  */
 
   /* Iterate through the dynamic type definition list and compute the
      size of the CTF type section we will need to generate.  */
@@ -269,149 +151,570 @@ ctf_update (ctf_file_t *fp)
   for (nvars = 0, dvd = ctf_list_next (&fp->ctf_dvdefs);
        dvd != NULL; dvd = ctf_list_next (dvd), nvars++);
 
-  /* Fill in the string table and type offset and size, compute the size
-     of the entire CTF buffer we need, and then allocate a new buffer and
-     memcpy the finished header to the start of the buffer.  */
+  /* Fill in the string table and type offset and size.  */
 
-  hdr.cth_typeoff = hdr.cth_varoff + (nvars * sizeof (ctf_varent_t));
-  hdr.cth_stroff = hdr.cth_typeoff + type_size;
-  hdr.cth_strlen = fp->ctf_dtvstrlen;
+  hdr->cth_typeoff = hdr->cth_varoff + (nvars * sizeof (ctf_varent_t));
+  hdr->cth_stroff = hdr->cth_typeoff + type_size;
+  hdr->cth_strlen = fp->ctf_dtvstrlen;
   if (fp->ctf_parname != NULL)
-    hdr.cth_strlen += strlen (fp->ctf_parname) + 1;
+    hdr->cth_strlen += strlen (fp->ctf_parname) + 1;
+}
 
-  buf_size = sizeof (ctf_header_t) + hdr.cth_stroff + hdr.cth_strlen;
+/* A variable, and the offset of its name in the string table.  */
 
-  if ((buf = ctf_data_alloc (buf_size)) == MAP_FAILED)
-    return (ctf_set_errno (fp, EAGAIN));
+typedef struct ctf_sort_var
+{
+  const ctf_dvdef_t *csv_dvd;
+  uint32_t csv_name;
+} ctf_sort_var_t;
 
-  memcpy (buf, &hdr, sizeof (ctf_header_t));
-  t = (unsigned char *) buf + sizeof (ctf_header_t) + hdr.cth_varoff;
-  s = s0 = (unsigned char *) buf + sizeof (ctf_header_t) + hdr.cth_stroff;
+static int
+ctf_sort_var (const void *one_, const void *two_)
+{
+  const ctf_sort_var_t *one = one_;
+  const ctf_sort_var_t *two = two_;
 
-  s[0] = '\0';
-  s++;
+  return (strcmp (one->csv_dvd->dvd_name, two->csv_dvd->dvd_name));
+}
 
-  if (fp->ctf_parname != NULL)
-    {
-      memcpy (s, fp->ctf_parname, strlen (fp->ctf_parname) + 1);
-      s += strlen (fp->ctf_parname) + 1;
-    }
+/* Stream the variable section, sorted by name.  */
 
-  /* Work over the variable list, translating everything into
-     ctf_varent_t's and filling out the string table, then sort the buffer
-     of ctf_varent_t's.  */
+static int
+ctf_serialize_vars (ctf_file_t *fp, const ctf_header_t *hdr, uint32_t soff,
+		    ctf_sink_t *sp)
+{
+  size_t nvars = (hdr->cth_typeoff - hdr->cth_varoff) / sizeof (ctf_varent_t);
+  ctf_sort_var_t *vars;
+  ctf_dvdef_t *dvd;
+  size_t i;
+  int err = 0;
+
+  if (nvars == 0)
+    return 0;
+
+  if ((vars = ctf_alloc (nvars * sizeof (ctf_sort_var_t))) == NULL)
+    return EAGAIN;
 
-  dvarents = (ctf_varent_t *) t;
   for (i = 0, dvd = ctf_list_next (&fp->ctf_dvdefs); dvd != NULL;
        dvd = ctf_list_next (dvd), i++)
     {
-      ctf_varent_t *var = &dvarents[i];
-      size_t len = strlen (dvd->dvd_name) + 1;
-
-      var->ctv_name = (uint32_t) (s - s0);
-      var->ctv_typeidx = dvd->dvd_type;
-      memcpy (s, dvd->dvd_name, len);
-      s += len;
+      vars[i].csv_dvd = dvd;
+      vars[i].csv_name = soff;
+      soff += strlen (dvd->dvd_name) + 1;
     }
   assert (i == nvars);
 
-  sort_strtab_ = s0;
-  qsort (dvarents, nvars, sizeof (ctf_varent_t), ctf_sort_var);
-  t += sizeof (ctf_varent_t) * nvars;
+  qsort (vars, nvars, sizeof (ctf_sort_var_t), ctf_sort_var);
+
+  for (i = 0; i < nvars && err == 0; i++)
+    {
+      ctf_varent_t var;
+
+      var.ctv_name = vars[i].csv_name;
+      var.ctv_typeidx = vars[i].csv_dvd->dvd_type;
+      err = ctf_sink_write (sp, &var, sizeof (var));
+    }
+
+  ctf_free (vars, nvars * sizeof (ctf_sort_var_t));
+  return err;
+}
+
+/* Stream the members of a struct, union or enum, whose names start at string
+   offset SOFF.  Returns the string offset after the last member name in
+   *SOFFP.  */
+
+static int
+ctf_serialize_members (ctf_file_t *fp, ctf_dtdef_t *dtd, uint32_t *soffp,
+		       ctf_sink_t *sp)
+{
+  uint32_t kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
+  ctf_dmdef_t *dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
+  uint32_t soff = *soffp;
+  int err;
+
+  for (; dmd != NULL; dmd = ctf_list_next (dmd))
+    {
+      uint32_t name = 0;
+
+      if (dmd->dmd_name)
+	{
+	  name = soff;
+	  soff += strlen (dmd->dmd_name) + 1;
+	}
+
+      if (kind == CTF_K_ENUM)
+	{
+	  ctf_enum_t cte;
+
+	  cte.cte_name = name;
+	  cte.cte_value = dmd->dmd_value;
+	  err = ctf_sink_write (sp, &cte, sizeof (cte));
+	}
+      else if (dtd->dtd_data.ctt_size < CTF_LSTRUCT_THRESH)
+	{
+	  ctf_member_t ctm;
+
+	  ctm.ctm_name = name;
+	  ctm.ctm_type = (uint32_t) dmd->dmd_type;
+	  ctm.ctm_offset = (uint32_t) dmd->dmd_offset;
+	  err = ctf_sink_write (sp, &ctm, sizeof (ctm));
+	}
+      else
+	{
+	  ctf_lmember_t ctlm;
 
-  assert (t == (unsigned char *) buf + sizeof (ctf_header_t) + hdr.cth_typeoff);
+	  ctlm.ctlm_name = name;
+	  ctlm.ctlm_type = (uint32_t) dmd->dmd_type;
+	  ctlm.ctlm_offsethi = CTF_OFFSET_TO_LMEMHI (dmd->dmd_offset);
+	  ctlm.ctlm_offsetlo = CTF_OFFSET_TO_LMEMLO (dmd->dmd_offset);
+	  err = ctf_sink_write (sp, &ctlm, sizeof (ctlm));
+	}
 
-  /* We now take a final lap through the dynamic type definition list and
-     copy the appropriate type records and strings to the output buffer.  */
+      if (err != 0)
+	return err;
+    }
+
+  *soffp = soff;
+  return 0;
+}
+
+/* Stream the type section.  Type names start at string offset SOFF.  */
+
+static int
+ctf_serialize_types (ctf_file_t *fp, uint32_t soff, ctf_sink_t *sp)
+{
+  ctf_dtdef_t *dtd;
+  int err;
 
   for (dtd = ctf_list_next (&fp->ctf_dtdefs);
        dtd != NULL; dtd = ctf_list_next (dtd))
     {
-
       uint32_t kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
       uint32_t vlen = LCTF_INFO_VLEN (fp, dtd->dtd_data.ctt_info);
 
       ctf_array_t cta;
       uint32_t encoding;
+      uint32_t argc;
       size_t len;
 
-      if (dtd->dtd_name != NULL)
-	{
-	  dtd->dtd_data.ctt_name = (uint32_t) (s - s0);
-	  len = strlen (dtd->dtd_name) + 1;
-	  memcpy (s, dtd->dtd_name, len);
-	  s += len;
-	}
-      else
-	dtd->dtd_data.ctt_name = 0;
+      if (dtd->dtd_name != NULL)
+	{
+	  dtd->dtd_data.ctt_name = soff;
+	  soff += strlen (dtd->dtd_name) + 1;
+	}
+      else
+	dtd->dtd_data.ctt_name = 0;
+
+      if (dtd->dtd_data.ctt_size != CTF_LSIZE_SENT)
+	len = sizeof (ctf_stype_t);
+      else
+	len = sizeof (ctf_type_t);
+
+      if ((err = ctf_sink_write (sp, &dtd->dtd_data, len)) != 0)
+	return err;
+
+      switch (kind)
+	{
+	case CTF_K_INTEGER:
+	case CTF_K_FLOAT:
+	  if (kind == CTF_K_INTEGER)
+	    {
+	      encoding = CTF_INT_DATA (dtd->dtd_u.dtu_enc.cte_format,
+				       dtd->dtd_u.dtu_enc.cte_offset,
+				       dtd->dtd_u.dtu_enc.cte_bits);
+	    }
+	  else
+	    {
+	      encoding = CTF_FP_DATA (dtd->dtd_u.dtu_enc.cte_format,
+				      dtd->dtd_u.dtu_enc.cte_offset,
+				      dtd->dtd_u.dtu_enc.cte_bits);
+	    }
+	  err = ctf_sink_write (sp, &encoding, sizeof (encoding));
+	  break;
+
+	case CTF_K_ARRAY:
+	  cta.cta_contents = (uint32_t) dtd->dtd_u.dtu_arr.ctr_contents;
+	  cta.cta_index = (uint32_t) dtd->dtd_u.dtu_arr.ctr_index;
+	  cta.cta_nelems = dtd->dtd_u.dtu_arr.ctr_nelems;
+	  err = ctf_sink_write (sp, &cta, sizeof (cta));
+	  break;
+
+	case CTF_K_FUNCTION:
+	  for (argc = 0; argc < vlen && err == 0; argc++)
+	    {
+	      uint32_t arg = (uint32_t) dtd->dtd_u.dtu_argv[argc];
+	      err = ctf_sink_write (sp, &arg, sizeof (arg));
+	    }
+
+	  if (vlen & 1 && err == 0)
+	    {
+	      uint32_t pad = 0;	/* Pad to 4-byte boundary.  */
+	      err = ctf_sink_write (sp, &pad, sizeof (pad));
+	    }
+	  break;
+
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+	case CTF_K_ENUM:
+	  err = ctf_serialize_members (fp, dtd, &soff, sp);
+	  break;
+	}
+
+      if (err != 0)
+	return err;
+    }
+
+  return 0;
+}
+
+/* Stream the string table.  */
+
+static int
+ctf_serialize_strs (ctf_file_t *fp, ctf_sink_t *sp)
+{
+  ctf_dtdef_t *dtd;
+  ctf_dvdef_t *dvd;
+  int err;
+
+  if ((err = ctf_sink_write (sp, "", 1)) != 0)
+    return err;
+
+  if (fp->ctf_parname != NULL
+      && (err = ctf_sink_write (sp, fp->ctf_parname,
+				strlen (fp->ctf_parname) + 1)) != 0)
+    return err;
+
+  for (dvd = ctf_list_next (&fp->ctf_dvdefs); dvd != NULL;
+       dvd = ctf_list_next (dvd))
+    if ((err = ctf_sink_write (sp, dvd->dvd_name,
+			       strlen (dvd->dvd_name) + 1)) != 0)
+      return err;
+
+  for (dtd = ctf_list_next (&fp->ctf_dtdefs);
+       dtd != NULL; dtd = ctf_list_next (dtd))
+    {
+      uint32_t kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
+      ctf_dmdef_t *dmd;
+
+      if (dtd->dtd_name != NULL
+	  && (err = ctf_sink_write (sp, dtd->dtd_name,
+				    strlen (dtd->dtd_name) + 1)) != 0)
+	return err;
+
+      if (kind != CTF_K_STRUCT && kind != CTF_K_UNION && kind != CTF_K_ENUM)
+	continue;
+
+      for (dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
+	   dmd != NULL; dmd = ctf_list_next (dmd))
+	{
+	  if (dmd->dmd_name == NULL)
+	    continue;			/* Skip anonymous members.  */
+
+	  if ((err = ctf_sink_write (sp, dmd->dmd_name,
+				     strlen (dmd->dmd_name) + 1)) != 0)
+	    return err;
+	}
+    }
+
+  return 0;
+}
+
+/* Stream everything after the header.  Returns zero or an errno value.  */
+
+static int
+ctf_serialize_body (ctf_file_t *fp, const ctf_header_t *hdr, ctf_sink_t *sp)
+{
+  ctf_dvdef_t *dvd;
+  uint32_t soff = 1;
+  int err;
+
+  if (fp->ctf_parname != NULL)
+    soff += strlen (fp->ctf_parname) + 1;
+
+  if ((err = ctf_serialize_vars (fp, hdr, soff, sp)) != 0)
+    return err;
+
+  for (dvd = ctf_list_next (&fp->ctf_dvdefs); dvd != NULL;
+       dvd = ctf_list_next (dvd))
+    soff += strlen (dvd->dvd_name) + 1;
+
+  if ((err = ctf_serialize_types (fp, soff, sp)) != 0)
+    return err;
+
+  return ctf_serialize_strs (fp, sp);
+}
+
+/* Serialize a container to the specified file descriptor, compressing if
+   requested.  Dynamic containers are streamed straight from their dynamic
+   definitions, including any not yet committed by ctf_update(), without
+   building the serialized form in memory or reopening it.  */
+
+static int
+ctf_serialize_fd (ctf_file_t *fp, int fd, int compress)
+{
+  ctf_header_t hdr;
+  ctf_sink_t sink;
+  int err;
+
+  if (!(fp->ctf_flags & LCTF_RDWR))
+    return compress ? ctf_compress_write (fp, fd) : ctf_write (fp, fd);
+
+  ctf_serialize_header (fp, &hdr);
+
+  if (compress)
+    {
+      /* The header is never compressed.  */
+
+      hdr.cth_flags |= CTF_F_COMPRESS;
+      if ((err = ctf_write_fd (fd, &hdr, sizeof (hdr))) != 0)
+	return (ctf_set_errno (fp, err));
+    }
+
+  if ((err = ctf_sink_init_fd (&sink, fd, compress, fp->ctf_zlevel,
+				 fp->ctf_zstrategy)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  if (!compress)
+    err = ctf_sink_write (&sink, &hdr, sizeof (hdr));
+
+  if (err == 0)
+    err = ctf_serialize_body (fp, &hdr, &sink);
+
+  if ((err = ctf_sink_fini (&sink, err)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  return 0;
+}
+
+int
+ctf_serialize_to_fd (ctf_file_t *fp, int fd)
+{
+  return ctf_serialize_fd (fp, fd, 0);
+}
+
+int
+ctf_compress_serialize_to_fd (ctf_file_t *fp, int fd)
+{
+  return ctf_serialize_fd (fp, fd, 1);
+}
+
+/* Snapshot publication.
+
+   ctf_update() swaps the new state of a container into place with memcpy(),
+   so readers in other threads cannot safely use a writable container while it
+   is updated.  Instead, once the writer has called ctf_publish(), every
+   ctf_update() also opens an immutable read-only copy of the newly committed
+   state (a snapshot) and publishes it.  Readers call ctf_pin() on the handle
+   returned by ctf_publish() to get the current snapshot, use it freely, and
+   ctf_unpin() it when done: a snapshot is freed when the last pin on it is
+   dropped, which is never before it has been replaced by a newer snapshot (the
+   publisher holds a pin on the current one).
+
+   Between loading the snapshot pointer and incrementing its pin count, a
+   reader is counted in cp_pinning: after replacing the snapshot, the publisher
+   waits for that count to drop to zero (a grace period only as long as the
+   pinning operation itself) before dropping its own pin on the old one.
+
+   Snapshots do not hold references on their parent: the parent (and the
+   writable container) must stay open until all snapshots are unpinned.  */
+
+/* Open a snapshot of the committed state of FP.  */
+
+static ctf_file_t *
+ctf_pub_snapshot (ctf_file_t *fp, ctf_file_t *parent)
+{
+  ctf_file_t *snap;
+  ctf_sect_t cts;
+  void *buf;
+  int err;
+
+  if ((buf = ctf_data_alloc (fp->ctf_size)) == MAP_FAILED)
+    {
+      (void) ctf_set_errno (fp, EAGAIN);
+      return NULL;
+    }
+
+  memcpy (buf, fp->ctf_base, fp->ctf_size);
+  ctf_data_protect (buf, fp->ctf_size);
+
+  cts.cts_name = _CTF_SECTION;
+  cts.cts_type = SHT_PROGBITS;
+  cts.cts_flags = 0;
+  cts.cts_data = buf;
+  cts.cts_size = fp->ctf_size;
+  cts.cts_entsize = 1;
+  cts.cts_offset = 0;
+
+  if ((snap = ctf_bufopen (&cts, NULL, NULL, &err)) == NULL)
+    {
+      ctf_data_free (buf, fp->ctf_size);
+      (void) ctf_set_errno (fp, err);
+      return NULL;
+    }
+
+  (void) ctf_setmodel (snap, ctf_getmodel (fp));
+  snap->ctf_data.cts_data = NULL;	/* Force ctf_data_free() on close.  */
+  snap->ctf_parent = parent;
+  snap->ctf_specific = fp->ctf_specific;
+  snap->ctf_zlevel = fp->ctf_zlevel;
+  snap->ctf_zstrategy = fp->ctf_zstrategy;
+  snap->ctf_flags |= LCTF_SNAPSHOT;
+  snap->ctf_pins = 1;			/* The publisher's pin.  */
+
+  return snap;
+}
+
+/* Replace the published snapshot with SNAP (which may be NULL, when the
+   container is being closed).  */
+
+static void
+ctf_pub_replace (ctf_pub_t *pub, ctf_file_t *snap)
+{
+  ctf_file_t *old;
+
+  old = __atomic_exchange_n (&pub->cp_snap, snap, __ATOMIC_SEQ_CST);
+
+  while (__atomic_load_n (&pub->cp_pinning, __ATOMIC_SEQ_CST) != 0)
+    sched_yield ();
+
+  if (old != NULL)
+    ctf_unpin (old);
+}
+
+/* Start publishing snapshots of this container's committed state for
+   concurrent readers, beginning with the state as of now, and return the
+   publication handle from which readers can ctf_pin() snapshots.  Calling this
+   again returns the same handle.  The handle remains valid until the container
+   is closed.  Read-only containers never change, so readers can share them
+   directly: they cannot be published.  */
+
+ctf_pub_t *
+ctf_publish (ctf_file_t *fp)
+{
+  ctf_file_t *snap;
+
+  if (!(fp->ctf_flags & LCTF_RDWR))
+    {
+      (void) ctf_set_errno (fp, ECTF_RDONLY);
+      return NULL;
+    }
+
+  if (fp->ctf_pub != NULL)
+    return fp->ctf_pub;
+
+  if ((fp->ctf_pub = ctf_alloc (sizeof (ctf_pub_t))) == NULL)
+    {
+      (void) ctf_set_errno (fp, EAGAIN);
+      return NULL;
+    }
+
+  memset (fp->ctf_pub, 0, sizeof (ctf_pub_t));
+
+  if ((snap = ctf_pub_snapshot (fp, fp->ctf_parent)) == NULL)
+    {
+      ctf_free (fp->ctf_pub, sizeof (ctf_pub_t));
+      fp->ctf_pub = NULL;
+      return NULL;			/* errno is set for us.  */
+    }
+
+  ctf_pub_replace (fp->ctf_pub, snap);
+  return fp->ctf_pub;
+}
+
+/* Stop publishing snapshots, dropping the publisher's pin on the current one.
+   Called when the writable container is closed.  */
+
+void
+ctf_pub_destroy (ctf_file_t *fp)
+{
+  if (fp->ctf_pub == NULL)
+    return;
+
+  ctf_pub_replace (fp->ctf_pub, NULL);
+  ctf_free (fp->ctf_pub, sizeof (ctf_pub_t));
+  fp->ctf_pub = NULL;
+}
+
+/* Return a pinned, immutable snapshot of the most recently committed state of
+   the published container, which remains valid until passed to ctf_unpin(), no
+   matter what the writer does meanwhile.  May be called concurrently with
+   ctf_update() on the container.  */
+
+ctf_file_t *
+ctf_pin (ctf_pub_t *pub)
+{
+  ctf_file_t *snap;
+
+  __atomic_add_fetch (&pub->cp_pinning, 1, __ATOMIC_SEQ_CST);
+  snap = __atomic_load_n (&pub->cp_snap, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&snap->ctf_pins, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&pub->cp_pinning, 1, __ATOMIC_SEQ_CST);
+
+  return snap;
+}
+
+/* Release a snapshot returned by ctf_pin().  */
+
+void
+ctf_unpin (ctf_file_t *snap)
+{
+  if (snap == NULL || !(snap->ctf_flags & LCTF_SNAPSHOT))
+    return;
 
-      if (dtd->dtd_data.ctt_size != CTF_LSIZE_SENT)
-	len = sizeof (ctf_stype_t);
-      else
-	len = sizeof (ctf_type_t);
+  if (__atomic_sub_fetch (&snap->ctf_pins, 1, __ATOMIC_SEQ_CST) == 0)
+    ctf_close (snap);
+}
 
-      memcpy (t, &dtd->dtd_data, len);
-      t += len;
+/* If the specified CTF container is writable and has been modified, reload this
+   container with the updated type definitions.  In order to make this code and
+   the rest of libctf as simple as possible, we perform updates by taking the
+   dynamic type definitions and creating an in-memory CTF file containing the
+   definitions, and then call ctf_bufopen() on it.  This not only leverages
+   ctf_bufopen(), but also avoids having to bifurcate the rest of the library
+   code with different lookup paths for static and dynamic type definitions.  We
+/   are therefore optimizing greatly for lookup over update, which we assume will
+   be an uncommon operation.  We perform one extra trick here for the benefit of
+   callers and to keep our code simple: ctf_bufopen() will return a new
+   ctf_file_t, but we want to keep the fp constant for the caller, so after
+   ctf_bufopen() returns, we use memcpy to swap the interior of the old and new
+   ctf_file_t's, and then free the old.  */
+int
+ctf_update (ctf_file_t *fp)
+{
+  ctf_file_t ofp, *nfp, *snap = NULL;
+  ctf_header_t hdr;
+  ctf_sink_t sink;
+  ctf_sect_t cts;
 
-      switch (kind)
-	{
-	case CTF_K_INTEGER:
-	case CTF_K_FLOAT:
-	  if (kind == CTF_K_INTEGER)
-	    {
-	      encoding = CTF_INT_DATA (dtd->dtd_u.dtu_enc.cte_format,
-				       dtd->dtd_u.dtu_enc.cte_offset,
-				       dtd->dtd_u.dtu_enc.cte_bits);
-	    }
-	  else
-	    {
-	      encoding = CTF_FP_DATA (dtd->dtd_u.dtu_enc.cte_format,
-				      dtd->dtd_u.dtu_enc.cte_offset,
-				      dtd->dtd_u.dtu_enc.cte_bits);
-	    }
-	  memcpy (t, &encoding, sizeof (encoding));
-	  t += sizeof (encoding);
-	  break;
+  size_t buf_size;
+  void *buf;
+  int err;
 
-	case CTF_K_ARRAY:
-	  cta.cta_contents = (uint32_t) dtd->dtd_u.dtu_arr.ctr_contents;
-	  cta.cta_index = (uint32_t) dtd->dtd_u.dtu_arr.ctr_index;
-	  cta.cta_nelems = dtd->dtd_u.dtu_arr.ctr_nelems;
-	  memcpy (t, &cta, sizeof (cta));
-	  t += sizeof (cta);
-	  break;
+  if (!(fp->ctf_flags & LCTF_RDWR))
+    return (ctf_set_errno (fp, ECTF_RDONLY));
 
-	case CTF_K_FUNCTION:
-	  {
-	    uint32_t *argv = (uint32_t *) (uintptr_t) t;
-	    uint32_t argc;
+  /* Update required?  */
+  if (!(fp->ctf_flags & LCTF_DIRTY))
+    return 0;
 
-	    for (argc = 0; argc < vlen; argc++)
-	      *argv++ = (uint32_t) dtd->dtd_u.dtu_argv[argc];
+  /* Compute the size of the entire CTF buffer we need, allocate it, and
+     serialize the dynamic definitions into it.  */
 
-	    if (vlen & 1)
-	      *argv++ = 0;	/* Pad to 4-byte boundary.  */
+  ctf_serialize_header (fp, &hdr);
+  buf_size = sizeof (ctf_header_t) + hdr.cth_stroff + hdr.cth_strlen;
 
-	    t = (unsigned char *) argv;
-	    break;
-	  }
+  if ((buf = ctf_data_alloc (buf_size)) == MAP_FAILED)
+    return (ctf_set_errno (fp, EAGAIN));
 
-	case CTF_K_STRUCT:
-	case CTF_K_UNION:
-	  if (dtd->dtd_data.ctt_size < CTF_LSTRUCT_THRESH)
-	    t = ctf_copy_smembers (dtd, (uint32_t) (s - s0), t);
-	  else
-	    t = ctf_copy_lmembers (dtd, (uint32_t) (s - s0), t);
-	  s = ctf_copy_membnames (dtd, s);
-	  break;
+  ctf_sink_init_mem (&sink, buf, buf_size);
 
-	case CTF_K_ENUM:
-	  t = ctf_copy_emembers (dtd, (uint32_t) (s - s0), t);
-	  s = ctf_copy_membnames (dtd, s);
-	  break;
-	}
+  if ((err = ctf_sink_write (&sink, &hdr, sizeof (ctf_header_t))) != 0
+      || (err = ctf_serialize_body (fp, &hdr, &sink)) != 0)
+    {
+      ctf_data_free (buf, buf_size);
+      return (ctf_set_errno (fp, err));
     }
-  assert (t == (unsigned char *) buf + sizeof (ctf_header_t) + hdr.cth_stroff);
+  assert (sink.cs_pos == buf_size);
 
   /* Finally, we are ready to ctf_bufopen() the new container.  If this
      is successful, we then switch nfp and fp and free the old container.  */
@@ -434,6 +737,18 @@ ctf_update (ctf_file_t *fp)
   (void) ctf_setmodel (nfp, ctf_getmodel (fp));
   (void) ctf_import (nfp, fp->ctf_parent);
 
+  /* If publishing, open the new snapshot now, so that failure leaves
+     everything unchanged.  */
+
+  if (fp->ctf_pub != NULL
+      && (snap = ctf_pub_snapshot (nfp, fp->ctf_parent)) == NULL)
+    {
+      err = ctf_errno (nfp);
+      ctf_close (nfp);
+      ctf_data_free (buf, buf_size);
+      return (ctf_set_errno (fp, err));
+    }
+
   nfp->ctf_refcnt = fp->ctf_refcnt;
   nfp->ctf_flags |= fp->ctf_flags & ~LCTF_DIRTY;
   nfp->ctf_data.cts_data = NULL;	/* Force ctf_data_free() on close.  */
@@ -448,6 +763,9 @@ ctf_update (ctf_file_t *fp)
   nfp->ctf_dtoldid = fp->ctf_dtnextid - 1;
   nfp->ctf_snapshots = fp->ctf_snapshots + 1;
   nfp->ctf_specific = fp->ctf_specific;
+  nfp->ctf_zlevel = fp->ctf_zlevel;
+  nfp->ctf_zstrategy = fp->ctf_zstrategy;
+  nfp->ctf_pub = fp->ctf_pub;
 
   nfp->ctf_snapshot_lu = fp->ctf_snapshots;
 
@@ -459,6 +777,12 @@ ctf_update (ctf_file_t *fp)
   fp->ctf_dvhashlen = 0;
   memset (&fp->ctf_dvdefs, 0, sizeof (ctf_list_t));
 
+  /* The rebuildable state is about to move into nfp and be freed: stop
+     accounting for it, but keep any holds, which belong to the caller.  */
+
+  ctf_resid_forget (fp);
+  nfp->ctf_resid.cr_holds = fp->ctf_resid.cr_holds;
+
   memcpy (&ofp, fp, sizeof (ctf_file_t));
   memcpy (fp, nfp, sizeof (ctf_file_t));
   memcpy (nfp, &ofp, sizeof (ctf_file_t));
@@ -473,8 +797,12 @@ ctf_update (ctf_file_t *fp)
   fp->ctf_lookups[3].ctl_hash = &fp->ctf_names;
 
   nfp->ctf_refcnt = 1;		/* Force nfp to be freed.  */
+  nfp->ctf_pub = NULL;
   ctf_close (nfp);
 
+  if (snap != NULL)
+    ctf_pub_replace (fp->ctf_pub, snap);
+
   return 0;
 }
 
@@ -494,6 +822,7 @@ ctf_dtd_delete (ctf_file_t *fp, ctf_dtdef_t *dtd)
   unsigned long h = dtd->dtd_type % (fp->ctf_dthashlen - 1);
   ctf_dtdef_t *p, **q = &fp->ctf_dthash[h];
   ctf_dmdef_t *dmd, *nmd;
+  ctf_dmblock_t *dmb, *nmb;
   size_t len;
 
   for (p = *q; p != NULL; p = p->dtd_hash)
@@ -518,11 +847,18 @@ ctf_dtd_delete (ctf_file_t *fp, ctf_dtdef_t *dtd)
 	  if (dmd->dmd_name != NULL)
 	    {
 	      len = strlen (dmd->dmd_name) + 1;
-	      ctf_free (dmd->dmd_name, len);
+	      if (!dmd->dmd_bulk)
+		ctf_free (dmd->dmd_name, len);
 	      fp->ctf_dtvstrlen -= len;
 	    }
 	  nmd = ctf_list_next (dmd);
-	  ctf_free (dmd, sizeof (ctf_dmdef_t));
+	  if (!dmd->dmd_bulk)
+	    ctf_free (dmd, sizeof (ctf_dmdef_t));
+	}
+      for (dmb = dtd->dtd_blocks; dmb != NULL; dmb = nmb)
+	{
+	  nmb = dmb->dmb_next;
+	  ctf_free (dmb, dmb->dmb_size);
 	}
       break;
     case CTF_K_FUNCTION:
@@ -1113,6 +1449,7 @@ ctf_add_enumerator (ctf_file_t *fp, ctf_id_t enid, const char *name,
   dmd->dmd_type = CTF_ERR;
   dmd->dmd_offset = 0;
   dmd->dmd_value = value;
+  dmd->dmd_bulk = 0;
 
   dtd->dtd_data.ctt_info = CTF_TYPE_INFO (kind, root, vlen + 1);
   ctf_list_append (&dtd->dtd_u.dtu_members, dmd);
@@ -1123,6 +1460,36 @@ ctf_add_enumerator (ctf_file_t *fp, ctf_id_t enid, const char *name,
   return 0;
 }
 
+/* Return the bit offset at which a member with alignment MALIGN would
+   naturally be placed after a member of type LTYPE at bit offset LOFF.  */
+
+static unsigned long
+ctf_member_natural_offset (ctf_file_t *fp, ctf_id_t ltype, unsigned long loff,
+			   ssize_t malign)
+{
+  size_t off = loff;
+  ctf_encoding_t linfo;
+  ssize_t lsize;
+
+  ltype = ctf_type_resolve (fp, ltype);
+
+  if (ctf_type_encoding (fp, ltype, &linfo) != CTF_ERR)
+    off += linfo.cte_bits;
+  else if ((lsize = ctf_type_size (fp, ltype)) != CTF_ERR)
+    off += lsize * NBBY;
+
+  /* Round up the offset of the end of the last member to the next byte
+     boundary, convert 'off' to bytes, and then round it up again to the next
+     multiple of the alignment required by the new member.  Finally, convert
+     back to bits.  Technically we could do more efficient packing if the new
+     member is a bit-field, but we're the "compiler" and ANSI says we can do as
+     we choose.  */
+
+  off = roundup (off, NBBY) / NBBY;
+  off = roundup (off, MAX (malign, 1));
+  return off * NBBY;
+}
+
 int
 ctf_add_member_offset (ctf_file_t *fp, ctf_id_t souid, const char *name,
 		       ctf_id_t type, unsigned long bit_offset)
@@ -1176,6 +1543,7 @@ ctf_add_member_offset (ctf_file_t *fp, ctf_id_t souid, const char *name,
   dmd->dmd_name = s;
   dmd->dmd_type = type;
   dmd->dmd_value = -1;
+  dmd->dmd_bulk = 0;
 
   if (kind == CTF_K_STRUCT && vlen != 0)
     {
@@ -1184,30 +1552,10 @@ ctf_add_member_offset (ctf_file_t *fp, ctf_id_t souid, const char *name,
 	  /* Natural alignment.  */
 
 	  ctf_dmdef_t *lmd = ctf_list_prev (&dtd->dtd_u.dtu_members);
-	  ctf_id_t ltype = ctf_type_resolve (fp, lmd->dmd_type);
-	  size_t off = lmd->dmd_offset;
-
-	  ctf_encoding_t linfo;
-	  ssize_t lsize;
-
-	  if (ctf_type_encoding (fp, ltype, &linfo) != CTF_ERR)
-	    off += linfo.cte_bits;
-	  else if ((lsize = ctf_type_size (fp, ltype)) != CTF_ERR)
-	    off += lsize * NBBY;
-
-	  /* Round up the offset of the end of the last member to
-	     the next byte boundary, convert 'off' to bytes, and
-	     then round it up again to the next multiple of the
-	     alignment required by the new member.  Finally,
-	     convert back to bits and store the result in
-	     dmd_offset.  Technically we could do more efficient
-	     packing if the new member is a bit-field, but we're
-	     the "compiler" and ANSI says we can do as we choose.  */
-
-	  off = roundup (off, NBBY) / NBBY;
-	  off = roundup (off, MAX (malign, 1));
-	  dmd->dmd_offset = off * NBBY;
-	  ssize = off + msize;
+
+	  dmd->dmd_offset = ctf_member_natural_offset (fp, lmd->dmd_type,
+						       lmd->dmd_offset, malign);
+	  ssize = dmd->dmd_offset / NBBY + msize;
 	}
       else
 	{
@@ -1251,6 +1599,281 @@ ctf_add_member (ctf_file_t *fp, ctf_id_t souid, const char *name,
   return ctf_add_member_offset (fp, souid, name, type, (unsigned long) - 1);
 }
 
+static int
+ctf_sort_names (const void *one_, const void *two_)
+{
+  const char *const *one = one_;
+  const char *const *two = two_;
+
+  return (strcmp (*one, *two));
+}
+
+/* Check that none of the NNAMES names in NAMES, which must have room for the
+   names of all the existing members of DTD as well, is duplicated either
+   among themselves or among those existing members.  We sort them rather than
+   scanning the member list once per name, so that adding many members at once
+   does not take quadratic time.  Returns zero or an errno value.  */
+
+static int
+ctf_check_member_names (ctf_dtdef_t *dtd, const char **names, size_t nnames)
+{
+  ctf_dmdef_t *dmd;
+  size_t i;
+
+  for (dmd = ctf_list_next (&dtd->dtd_u.dtu_members);
+       dmd != NULL; dmd = ctf_list_next (dmd))
+    {
+      if (dmd->dmd_name != NULL)
+	names[nnames++] = dmd->dmd_name;
+    }
+
+  qsort (names, nnames, sizeof (const char *), ctf_sort_names);
+
+  for (i = 1; i < nnames; i++)
+    {
+      if (strcmp (names[i - 1], names[i]) == 0)
+	return ECTF_DUPLICATE;
+    }
+
+  return 0;
+}
+
+/* Allocate a block of N member definitions followed by NAMELEN bytes of names,
+   returning pointers to both.  */
+
+static ctf_dmblock_t *
+ctf_dmblock_alloc (size_t n, size_t namelen, ctf_dmdef_t **dmdsp,
+		   char **namesp)
+{
+  ctf_dmblock_t *dmb;
+  size_t size = sizeof (ctf_dmblock_t) + n * sizeof (ctf_dmdef_t) + namelen;
+
+  if ((dmb = ctf_alloc (size)) == NULL)
+    return NULL;
+
+  dmb->dmb_next = NULL;
+  dmb->dmb_size = size;
+  *dmdsp = (ctf_dmdef_t *) (dmb + 1);
+  *namesp = (char *) (*dmdsp + n);
+  return dmb;
+}
+
+/* Append the N member definitions in DMB to DTD, which takes ownership of the
+   block.  */
+
+static void
+ctf_dmblock_append (ctf_file_t *fp, ctf_dtdef_t *dtd, ctf_dmblock_t *dmb,
+		    size_t n, size_t namelen)
+{
+  ctf_dmdef_t *dmds = (ctf_dmdef_t *) (dmb + 1);
+  uint32_t kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
+  uint32_t root = LCTF_INFO_ISROOT (fp, dtd->dtd_data.ctt_info);
+  uint32_t vlen = LCTF_INFO_VLEN (fp, dtd->dtd_data.ctt_info);
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    ctf_list_append (&dtd->dtd_u.dtu_members, &dmds[i]);
+
+  dmb->dmb_next = dtd->dtd_blocks;
+  dtd->dtd_blocks = dmb;
+
+  dtd->dtd_data.ctt_info = CTF_TYPE_INFO (kind, root, vlen + n);
+  fp->ctf_dtvstrlen += namelen;
+  fp->ctf_flags |= LCTF_DIRTY;
+}
+
+/* Add N members to a struct or union, exactly as if by N calls to
+   ctf_add_member_offset(), but validating, laying out and allocating them all
+   in one pass.  If any member cannot be added, none are.  */
+
+int
+ctf_add_struct_members (ctf_file_t *fp, ctf_id_t souid,
+			const ctf_member_spec_t *members, size_t n)
+{
+  ctf_dtdef_t *dtd = ctf_dtd_lookup (fp, souid);
+  ctf_dmdef_t *dmds, *lmd;
+  ctf_dmblock_t *dmb;
+  const char **names;
+  char *s;
+
+  ssize_t msize, malign, ssize;
+  uint32_t kind, vlen;
+  size_t i, nnames = 0, namelen = 0;
+  int err;
+
+  if (!(fp->ctf_flags & LCTF_RDWR))
+    return (ctf_set_errno (fp, ECTF_RDONLY));
+
+  if (dtd == NULL)
+    return (ctf_set_errno (fp, ECTF_BADID));
+
+  kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
+  vlen = LCTF_INFO_VLEN (fp, dtd->dtd_data.ctt_info);
+
+  if (kind != CTF_K_STRUCT && kind != CTF_K_UNION)
+    return (ctf_set_errno (fp, ECTF_NOTSOU));
+
+  if (n > CTF_MAX_VLEN - vlen)
+    return (ctf_set_errno (fp, ECTF_DTFULL));
+
+  if (n == 0)
+    return 0;
+
+  if ((names = ctf_alloc ((vlen + n) * sizeof (const char *))) == NULL)
+    return (ctf_set_errno (fp, EAGAIN));
+
+  for (i = 0; i < n; i++)
+    {
+      if (members[i].ctms_name != NULL)
+	{
+	  names[nnames++] = members[i].ctms_name;
+	  namelen += strlen (members[i].ctms_name) + 1;
+	}
+    }
+
+  err = ctf_check_member_names (dtd, names, nnames);
+  ctf_free (names, (vlen + n) * sizeof (const char *));
+
+  if (err != 0)
+    return (ctf_set_errno (fp, err));
+
+  if ((dmb = ctf_dmblock_alloc (n, namelen, &dmds, &s)) == NULL)
+    return (ctf_set_errno (fp, EAGAIN));
+
+  ssize = ctf_get_ctt_size (fp, &dtd->dtd_data, NULL, NULL);
+  lmd = ctf_list_prev (&dtd->dtd_u.dtu_members);
+
+  for (i = 0; i < n; i++)
+    {
+      const ctf_member_spec_t *spec = &members[i];
+      ctf_dmdef_t *dmd = &dmds[i];
+
+      if ((msize = ctf_type_size (fp, spec->ctms_type)) == CTF_ERR ||
+	  (malign = ctf_type_align (fp, spec->ctms_type)) == CTF_ERR)
+	{
+	  ctf_free (dmb, dmb->dmb_size);
+	  return CTF_ERR;		/* errno is set for us.  */
+	}
+
+      dmd->dmd_name = NULL;
+      if (spec->ctms_name != NULL)
+	{
+	  dmd->dmd_name = strcpy (s, spec->ctms_name);
+	  s += strlen (s) + 1;
+	}
+      dmd->dmd_type = spec->ctms_type;
+      dmd->dmd_value = -1;
+      dmd->dmd_bulk = 1;
+
+      if (kind == CTF_K_STRUCT && lmd != NULL)
+	{
+	  if (spec->ctms_offset == (unsigned long) - 1)
+	    {
+	      dmd->dmd_offset = ctf_member_natural_offset (fp, lmd->dmd_type,
+							   lmd->dmd_offset,
+							   malign);
+	      ssize = dmd->dmd_offset / NBBY + msize;
+	    }
+	  else
+	    {
+	      dmd->dmd_offset = spec->ctms_offset;
+	      ssize = MAX (ssize, (spec->ctms_offset / NBBY) + msize);
+	    }
+	}
+      else
+	{
+	  dmd->dmd_offset = 0;
+	  ssize = MAX (ssize, msize);
+	}
+
+      lmd = dmd;
+    }
+
+  if (ssize > CTF_MAX_SIZE)
+    {
+      dtd->dtd_data.ctt_size = CTF_LSIZE_SENT;
+      dtd->dtd_data.ctt_lsizehi = CTF_SIZE_TO_LSIZE_HI (ssize);
+      dtd->dtd_data.ctt_lsizelo = CTF_SIZE_TO_LSIZE_LO (ssize);
+    }
+  else
+    dtd->dtd_data.ctt_size = (uint32_t) ssize;
+
+  ctf_dmblock_append (fp, dtd, dmb, n, namelen);
+  return 0;
+}
+
+/* Add N enumerators to an enum, exactly as if by N calls to
+   ctf_add_enumerator(), but allocating them all at once.  If any enumerator
+   cannot be added, none are.  */
+
+int
+ctf_add_enumerators (ctf_file_t *fp, ctf_id_t enid,
+		     const ctf_enum_spec_t *enums, size_t n)
+{
+  ctf_dtdef_t *dtd = ctf_dtd_lookup (fp, enid);
+  ctf_dmdef_t *dmds;
+  ctf_dmblock_t *dmb;
+  const char **names;
+  char *s;
+
+  uint32_t kind, vlen;
+  size_t i, namelen = 0;
+  int err;
+
+  if (!(fp->ctf_flags & LCTF_RDWR))
+    return (ctf_set_errno (fp, ECTF_RDONLY));
+
+  if (dtd == NULL)
+    return (ctf_set_errno (fp, ECTF_BADID));
+
+  kind = LCTF_INFO_KIND (fp, dtd->dtd_data.ctt_info);
+  vlen = LCTF_INFO_VLEN (fp, dtd->dtd_data.ctt_info);
+
+  if (kind != CTF_K_ENUM)
+    return (ctf_set_errno (fp, ECTF_NOTENUM));
+
+  if (n > CTF_MAX_VLEN - vlen)
+    return (ctf_set_errno (fp, ECTF_DTFULL));
+
+  if (n == 0)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    {
+      if (enums[i].ctes_name == NULL)
+	return (ctf_set_errno (fp, EINVAL));
+      namelen += strlen (enums[i].ctes_name) + 1;
+    }
+
+  if ((names = ctf_alloc ((vlen + n) * sizeof (const char *))) == NULL)
+    return (ctf_set_errno (fp, EAGAIN));
+
+  for (i = 0; i < n; i++)
+    names[i] = enums[i].ctes_name;
+
+  err = ctf_check_member_names (dtd, names, n);
+  ctf_free (names, (vlen + n) * sizeof (const char *));
+
+  if (err != 0)
+    return (ctf_set_errno (fp, err));
+
+  if ((dmb = ctf_dmblock_alloc (n, namelen, &dmds, &s)) == NULL)
+    return (ctf_set_errno (fp, EAGAIN));
+
+  for (i = 0; i < n; i++)
+    {
+      dmds[i].dmd_name = strcpy (s, enums[i].ctes_name);
+      s += strlen (s) + 1;
+      dmds[i].dmd_type = CTF_ERR;
+      dmds[i].dmd_offset = 0;
+      dmds[i].dmd_value = enums[i].ctes_value;
+      dmds[i].dmd_bulk = 1;
+    }
+
+  ctf_dmblock_append (fp, dtd, dmb, n, namelen);
+  return 0;
+}
+
 int
 ctf_add_variable (ctf_file_t *fp, const char *name, ctf_id_t ref)
 {
@@ -1352,6 +1975,7 @@ membadd (const char *name, ctf_id_t type, unsigned long offset, void *arg)
   dmd->dmd_type = type;
   dmd->dmd_offset = offset;
   dmd->dmd_value = -1;
+  dmd->dmd_bulk = 0;
 
   ctf_list_append (&ctb->ctb_dtd->dtd_u.dtu_members, dmd);
 
@@ -1366,9 +1990,11 @@ membadd (const char *name, ctf_id_t type, unsigned long offset, void *arg)
    to a dynamic destination container.  This routine operates recursively by
    following the source type's links and embedded member types.  If the
    destination container already contains a named type which has the same
-   attributes, then we succeed and return this type but no changes occur.  */
-ctf_id_t
-ctf_add_type (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type)
+   attributes, then we succeed and return this type but no changes occur.
+   Likewise, if the destination container has a parent which already contains
+   an equivalent type, we return the parent's type.  */
+static ctf_id_t
+ctf_add_type_held (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type)
 {
   ctf_id_t dst_type = CTF_ERR;
   uint32_t dst_kind = CTF_K_UNKNOWN;
@@ -1394,6 +2020,20 @@ ctf_add_type (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type)
   if ((src_tp = ctf_lookup_by_id (&src_fp, src_type)) == NULL)
     return (ctf_set_errno (dst_fp, ctf_errno (src_fp)));
 
+  /* Types in the parent of the destination can be used as they are.  (If
+     SRC_TYPE was a parent type of a child sharing our parent, src_fp is now
+     the parent.)  */
+
+  if (dst_fp->ctf_parent != NULL)
+    {
+      if (src_fp == dst_fp->ctf_parent)
+	return src_type;
+
+      if ((dst_type = ctf_type_find_equiv (dst_fp->ctf_parent, src_fp,
+					   src_type)) != CTF_ERR)
+	return dst_type;
+    }
+
   name = ctf_strptr (src_fp, src_tp->ctt_name);
   kind = LCTF_INFO_KIND (src_fp, src_tp->ctt_info);
   flag = LCTF_INFO_ISROOT (src_fp, src_tp->ctt_info);
@@ -1766,3 +2406,16 @@ ctf_add_type (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type)
 
   return dst_type;
 }
+
+ctf_id_t
+ctf_add_type (ctf_file_t *dst_fp, ctf_file_t *src_fp, ctf_id_t src_type)
+{
+  ctf_id_t type;
+
+  ctf_resid_hold (dst_fp);
+  ctf_resid_hold (src_fp);
+  type = ctf_add_type_held (dst_fp, src_fp, src_type);
+  ctf_resid_release (src_fp);
+  ctf_resid_release (dst_fp);
+  return type;
+}
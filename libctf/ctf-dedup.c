@@ -0,0 +1,724 @@
+/* Structural fingerprints and equivalence of types across containers.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <string.h>
+
+/* Two types in different containers are equivalent if they have the same
+   kind, name and root visibility, the same encoding, size, elements,
+   enumerators or member names and offsets as appropriate, and equivalent
+   referenced, element, argument or member types.  Structs, unions and enums
+   with names are compared by name and size alone when reached through another
+   type, as ctf_add_type() has always done: this keeps comparisons shallow, and
+   means that the only cycles left to catch are those through anonymous types,
+   which we detect by keeping a stack of the comparisons in progress.
+
+   A fingerprint is a hash of the same properties, except that it never looks
+   at the types of members, so it can be computed for any type without
+   recursing indefinitely.  Equivalent types always have the same fingerprint.
+   An index of all the types in a container by fingerprint is built lazily,
+   used to find types equivalent to a given type from another container, and
+   accounted for and evicted like the other rebuildable state (see
+   ctf-residency.c).
+
+   The same machinery maps the type IDs of one version of a container onto
+   those of another, such as a rebuilt kernel module, so that consumers can
+   carry state keyed by type ID across the change: see ctf_idmap_create().  */
+
+#define CTF_EQUIV_MAXDEPTH 64	/* Deepest chain of references compared.  */
+
+typedef struct ctf_equiv_pair
+{
+  const struct ctf_equiv_pair *cep_up;
+  const ctf_type_t *cep_atp;
+  const ctf_type_t *cep_btp;
+} ctf_equiv_pair_t;
+
+typedef struct ctf_equiv_memb
+{
+  const char *cem_name;
+  ctf_id_t cem_type;
+  unsigned long cem_offset;
+} ctf_equiv_memb_t;
+
+typedef struct ctf_equiv_arg
+{
+  ctf_file_t *cea_fp;
+  ctf_equiv_memb_t *cea_membs;
+  unsigned long cea_n;
+  unsigned long cea_i;
+  ctf_file_t *cea_bfp;
+  ctf_id_t cea_btype;
+  const ctf_equiv_pair_t *cea_up;
+  int cea_depth;
+} ctf_equiv_arg_t;
+
+static int ctf_type_equiv_1 (ctf_file_t *, ctf_id_t, ctf_file_t *, ctf_id_t,
+			     const ctf_equiv_pair_t *, int);
+
+static uint32_t
+ctf_fp_mix (uint32_t h, uint64_t v)
+{
+  h = (h ^ (uint32_t) v) * 0x01000193;
+  return (h ^ (uint32_t) (v >> 32)) * 0x01000193;
+}
+
+static uint32_t
+ctf_fp_mix_str (uint32_t h, const char *s)
+{
+  return ctf_fp_mix (h, ctf_hash_compute (s, strlen (s)));
+}
+
+static int
+ctf_fp_memb (const char *name, ctf_id_t type _libctf_unused_,
+	     unsigned long offset, void *arg)
+{
+  uint32_t *hp = arg;
+
+  *hp = ctf_fp_mix (ctf_fp_mix_str (*hp, name), offset);
+  return 0;
+}
+
+/* Enumerators are matched by name, not position, so their hashes are summed
+   rather than chained, and the order they are declared in does not matter.  */
+
+static int
+ctf_fp_enum (const char *name, int value, void *arg)
+{
+  uint32_t *hp = arg;
+
+  *hp += ctf_fp_mix (ctf_fp_mix_str (0x811c9dc5, name), (uint32_t) value);
+  return 0;
+}
+
+static uint32_t
+ctf_type_fingerprint_1 (ctf_file_t *fp, ctf_id_t type, int depth)
+{
+  const ctf_type_t *tp;
+  const char *name;
+  ctf_encoding_t en;
+  ctf_arinfo_t ar;
+  uint32_t kind, vlen, h;
+  ssize_t size, increment;
+
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+    return 0;
+
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
+  name = ctf_strptr (fp, tp->ctt_name);
+
+  h = ctf_fp_mix (0x811c9dc5, kind);
+  h = ctf_fp_mix (h, LCTF_INFO_ISROOT (fp, tp->ctt_info) != 0);
+  h = ctf_fp_mix_str (h, name);
+
+  if (depth > CTF_EQUIV_MAXDEPTH)
+    return h;
+
+  (void) ctf_get_ctt_size (fp, tp, &size, &increment);
+
+  switch (kind)
+    {
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+      if (ctf_type_encoding (fp, type, &en) == 0)
+	{
+	  h = ctf_fp_mix (h, en.cte_format);
+	  h = ctf_fp_mix (h, en.cte_offset);
+	  h = ctf_fp_mix (h, en.cte_bits);
+	}
+      break;
+    case CTF_K_POINTER:
+    case CTF_K_TYPEDEF:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+      h = ctf_fp_mix (h, ctf_type_fingerprint_1 (fp, tp->ctt_type, depth + 1));
+      break;
+    case CTF_K_ARRAY:
+      if (ctf_array_info (fp, type, &ar) == 0)
+	{
+	  h = ctf_fp_mix (h, ar.ctr_nelems);
+	  h = ctf_fp_mix (h, ctf_type_fingerprint_1 (fp, ar.ctr_contents,
+						     depth + 1));
+	  h = ctf_fp_mix (h, ctf_type_fingerprint_1 (fp, ar.ctr_index,
+						     depth + 1));
+	}
+      break;
+    case CTF_K_FUNCTION:
+      {
+	const uint32_t *args = (const uint32_t *) ((uintptr_t) tp + increment);
+	uint32_t i;
+
+	h = ctf_fp_mix (h, vlen);
+	h = ctf_fp_mix (h, ctf_type_fingerprint_1 (fp, tp->ctt_type,
+						   depth + 1));
+	for (i = 0; i < vlen; i++)
+	  h = ctf_fp_mix (h, ctf_type_fingerprint_1 (fp, args[i], depth + 1));
+	break;
+      }
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      h = ctf_fp_mix (h, size);
+      if (depth > 0 && name[0] != '\0')
+	break;
+      h = ctf_fp_mix (h, vlen);
+      (void) ctf_member_iter (fp, type, ctf_fp_memb, &h);
+      break;
+    case CTF_K_ENUM:
+      if (depth > 0 && name[0] != '\0')
+	break;
+      {
+	uint32_t sum = 0;
+
+	h = ctf_fp_mix (h, vlen);
+	(void) ctf_enum_iter (fp, type, ctf_fp_enum, &sum);
+	h = ctf_fp_mix (h, sum);
+	break;
+      }
+    }
+
+  return h;
+}
+
+/* Return the structural fingerprint of TYPE.  */
+
+uint32_t
+ctf_type_fingerprint (ctf_file_t *fp, ctf_id_t type)
+{
+  return ctf_type_fingerprint_1 (fp, type, 0);
+}
+
+static int
+ctf_equiv_collect (const char *name, ctf_id_t type, unsigned long offset,
+		   void *arg)
+{
+  ctf_equiv_arg_t *ea = arg;
+
+  ea->cea_membs[ea->cea_i].cem_name = name;
+  ea->cea_membs[ea->cea_i].cem_type = type;
+  ea->cea_membs[ea->cea_i].cem_offset = offset;
+  ea->cea_i++;
+  return 0;
+}
+
+static int
+ctf_equiv_compare (const char *name, ctf_id_t type, unsigned long offset,
+		   void *arg)
+{
+  ctf_equiv_arg_t *ea = arg;
+  const ctf_equiv_memb_t *m = &ea->cea_membs[ea->cea_i++];
+
+  return (m->cem_offset != offset || strcmp (m->cem_name, name) != 0
+	  || !ctf_type_equiv_1 (ea->cea_fp, m->cem_type, ea->cea_bfp, type,
+				ea->cea_up, ea->cea_depth));
+}
+
+/* Compare the VLEN members of A and B positionally.  */
+
+static int
+ctf_equiv_members (ctf_file_t *afp, ctf_id_t a, ctf_file_t *bfp, ctf_id_t b,
+		   uint32_t vlen, const ctf_equiv_pair_t *up, int depth)
+{
+  ctf_equiv_arg_t ea;
+  int rc;
+
+  if (vlen == 0)
+    return 1;
+
+  if ((ea.cea_membs = malloc (vlen * sizeof (ctf_equiv_memb_t))) == NULL)
+    return 0;
+
+  ea.cea_fp = afp;
+  ea.cea_n = vlen;
+  ea.cea_i = 0;
+  ea.cea_bfp = bfp;
+  ea.cea_up = up;
+  ea.cea_depth = depth;
+
+  rc = (ctf_member_iter (afp, a, ctf_equiv_collect, &ea) == 0
+	&& ea.cea_i == vlen);
+  if (rc)
+    {
+      ea.cea_i = 0;
+      rc = ctf_member_iter (bfp, b, ctf_equiv_compare, &ea) == 0;
+    }
+
+  free (ea.cea_membs);
+  return rc;
+}
+
+static int
+ctf_equiv_enumerator (const char *name, int value, void *arg)
+{
+  ctf_equiv_arg_t *ea = arg;
+  int bvalue;
+
+  return (ctf_enum_value (ea->cea_bfp, ea->cea_btype, name, &bvalue) == CTF_ERR
+	  || bvalue != value);
+}
+
+static int
+ctf_type_equiv_1 (ctf_file_t *afp, ctf_id_t a, ctf_file_t *bfp, ctf_id_t b,
+		  const ctf_equiv_pair_t *up, int depth)
+{
+  const ctf_type_t *atp, *btp;
+  const ctf_equiv_pair_t *p;
+  ctf_equiv_pair_t pair;
+  ctf_encoding_t aen, ben;
+  ctf_arinfo_t aar, bar;
+  ssize_t asize, bsize, aincr, bincr;
+  uint32_t kind, vlen;
+  const char *name;
+
+  if ((atp = ctf_lookup_by_id (&afp, a)) == NULL
+      || (btp = ctf_lookup_by_id (&bfp, b)) == NULL)
+    return 0;
+
+  if (atp == btp)
+    return 1;
+
+  kind = LCTF_INFO_KIND (afp, atp->ctt_info);
+  vlen = LCTF_INFO_VLEN (afp, atp->ctt_info);
+  name = ctf_strptr (afp, atp->ctt_name);
+
+  if (kind != LCTF_INFO_KIND (bfp, btp->ctt_info)
+      || vlen != LCTF_INFO_VLEN (bfp, btp->ctt_info)
+      || ((LCTF_INFO_ISROOT (afp, atp->ctt_info) != 0)
+	  != (LCTF_INFO_ISROOT (bfp, btp->ctt_info) != 0))
+      || strcmp (name, ctf_strptr (bfp, btp->ctt_name)) != 0)
+    return 0;
+
+  /* A comparison already in progress further up is assumed to succeed: if it
+     does not, that will be detected there.  */
+
+  for (p = up; p != NULL; p = p->cep_up)
+    if (p->cep_atp == atp && p->cep_btp == btp)
+      return 1;
+
+  if (depth > CTF_EQUIV_MAXDEPTH)
+    return 0;
+
+  pair.cep_up = up;
+  pair.cep_atp = atp;
+  pair.cep_btp = btp;
+
+  (void) ctf_get_ctt_size (afp, atp, &asize, &aincr);
+  (void) ctf_get_ctt_size (bfp, btp, &bsize, &bincr);
+
+  switch (kind)
+    {
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+      return (ctf_type_encoding (afp, a, &aen) == 0
+	      && ctf_type_encoding (bfp, b, &ben) == 0
+	      && memcmp (&aen, &ben, sizeof (ctf_encoding_t)) == 0);
+    case CTF_K_POINTER:
+    case CTF_K_TYPEDEF:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+      return ctf_type_equiv_1 (afp, atp->ctt_type, bfp, btp->ctt_type, &pair,
+			       depth + 1);
+    case CTF_K_ARRAY:
+      return (ctf_array_info (afp, a, &aar) == 0
+	      && ctf_array_info (bfp, b, &bar) == 0
+	      && aar.ctr_nelems == bar.ctr_nelems
+	      && ctf_type_equiv_1 (afp, aar.ctr_contents, bfp,
+				   bar.ctr_contents, &pair, depth + 1)
+	      && ctf_type_equiv_1 (afp, aar.ctr_index, bfp, bar.ctr_index,
+				   &pair, depth + 1));
+    case CTF_K_FUNCTION:
+      {
+	const uint32_t *aargs = (const uint32_t *) ((uintptr_t) atp + aincr);
+	const uint32_t *bargs = (const uint32_t *) ((uintptr_t) btp + bincr);
+	uint32_t i;
+
+	if (!ctf_type_equiv_1 (afp, atp->ctt_type, bfp, btp->ctt_type, &pair,
+			       depth + 1))
+	  return 0;
+
+	/* A trailing zero argument means varargs, and is not a type.  */
+	for (i = 0; i < vlen; i++)
+	  if ((aargs[i] != 0 || bargs[i] != 0)
+	      && !ctf_type_equiv_1 (afp, aargs[i], bfp, bargs[i], &pair,
+				    depth + 1))
+	    return 0;
+	return 1;
+      }
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+      if (asize != bsize)
+	return 0;
+      if (depth > 0 && name[0] != '\0')
+	return 1;
+      return ctf_equiv_members (afp, a, bfp, b, vlen, &pair, depth + 1);
+    case CTF_K_ENUM:
+      {
+	ctf_equiv_arg_t ea;
+
+	if (depth > 0 && name[0] != '\0')
+	  return 1;
+
+	/* The enumerator counts are equal, so checking one way suffices.  */
+	ea.cea_bfp = bfp;
+	ea.cea_btype = b;
+	return ctf_enum_iter (afp, a, ctf_equiv_enumerator, &ea) == 0;
+      }
+    case CTF_K_FORWARD:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+/* Return nonzero if type A in AFP and type B in BFP are equivalent.  */
+
+int
+ctf_type_equiv (ctf_file_t *afp, ctf_id_t a, ctf_file_t *bfp, ctf_id_t b)
+{
+  return ctf_type_equiv_1 (afp, a, bfp, b, NULL, 0);
+}
+
+static ctf_fpidx_t *
+ctf_fpidx_build (ctf_file_t *fp)
+{
+  ctf_fpidx_t *idx;
+  unsigned long n = fp->ctf_typemax;
+  unsigned long nslots, i;
+  int child = (fp->ctf_flags & LCTF_CHILD);
+
+  for (nslots = 1; nslots < n * 2; nslots <<= 1);
+
+  if ((idx = ctf_alloc (sizeof (ctf_fpidx_t)
+			+ nslots * sizeof (ctf_fpent_t))) == NULL)
+    return NULL;
+
+  memset (idx->cfi_ents, 0, nslots * sizeof (ctf_fpent_t));
+  idx->cfi_mask = nslots - 1;
+
+  for (i = 1; i <= n; i++)
+    {
+      uint32_t h;
+      unsigned long slot;
+
+      h = ctf_type_fingerprint (fp, LCTF_INDEX_TO_TYPE (fp, i, child));
+
+      for (slot = h & idx->cfi_mask; idx->cfi_ents[slot].cfe_index != 0;
+	   slot = (slot + 1) & idx->cfi_mask);
+
+      idx->cfi_ents[slot].cfe_hash = h;
+      idx->cfi_ents[slot].cfe_index = i;
+    }
+
+  return idx;
+}
+
+static size_t
+ctf_fpidx_size (const ctf_fpidx_t *idx)
+{
+  return sizeof (ctf_fpidx_t) + (idx->cfi_mask + 1) * sizeof (ctf_fpent_t);
+}
+
+/* Return the fingerprint index of this container, building it if need be.
+
+   Concurrent readers may race to build it: the loser frees its copy.  */
+
+static const ctf_fpidx_t *
+ctf_fpidx (ctf_file_t *fp)
+{
+  ctf_fpidx_t *idx, *old = NULL;
+
+  if ((idx = __atomic_load_n (&fp->ctf_fpidx, __ATOMIC_ACQUIRE)) != NULL)
+    {
+      ctf_resid_touch (fp);
+      return idx;
+    }
+
+  if ((idx = ctf_fpidx_build (fp)) == NULL)
+    return NULL;
+
+  if (!__atomic_compare_exchange_n (&fp->ctf_fpidx, &old, idx, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      ctf_free (idx, ctf_fpidx_size (idx));
+      idx = old;
+    }
+  else
+    ctf_resid_add (fp, ctf_fpidx_size (idx));
+
+  return idx;
+}
+
+/* Free the fingerprint index, if any.  */
+
+void
+ctf_fpidx_destroy (ctf_file_t *fp)
+{
+  if (fp->ctf_fpidx != NULL)
+    ctf_free (fp->ctf_fpidx, ctf_fpidx_size (fp->ctf_fpidx));
+  fp->ctf_fpidx = NULL;
+}
+
+/* Return the ID of a committed type in FP equivalent to SRC_TYPE in SRC_FP, or
+   CTF_ERR if there is none.  Does not set the errno on FP.  */
+
+static ctf_id_t
+ctf_type_find_equiv_held (ctf_file_t *fp, ctf_file_t *src_fp,
+			  ctf_id_t src_type)
+{
+  const ctf_type_t *tp;
+  const ctf_fpidx_t *idx;
+  ctf_file_t *tfp = src_fp;
+  const char *name;
+  uint32_t kind, h;
+  unsigned long slot;
+  int child = (fp->ctf_flags & LCTF_CHILD);
+
+  if ((tp = ctf_lookup_by_id (&tfp, src_type)) == NULL
+      || ctf_lazy_names (fp) != 0)
+    return CTF_ERR;
+
+  kind = LCTF_INFO_KIND (tfp, tp->ctt_info);
+  name = ctf_strptr (tfp, tp->ctt_name);
+
+  /* Named root types are found by name.  A forward is satisfied by any
+     type of the same name in the same namespace.  */
+
+  if (LCTF_INFO_ISROOT (tfp, tp->ctt_info) && name[0] != '\0')
+    {
+      ctf_hash_t *hp = NULL;
+      ctf_helem_t *hep;
+
+      switch (kind == CTF_K_FORWARD ? tp->ctt_type : kind)
+	{
+	case CTF_K_STRUCT:
+	  hp = &fp->ctf_structs;
+	  break;
+	case CTF_K_UNION:
+	  hp = &fp->ctf_unions;
+	  break;
+	case CTF_K_ENUM:
+	  hp = &fp->ctf_enums;
+	  break;
+	default:
+	  if (kind != CTF_K_FORWARD)
+	    hp = &fp->ctf_names;
+	}
+
+      if (hp != NULL
+	  && (hep = ctf_hash_lookup (hp, fp, name, strlen (name))) != NULL
+	  && (kind == CTF_K_FORWARD
+	      || ctf_type_equiv (src_fp, src_type, fp, hep->h_type)))
+	return hep->h_type;
+    }
+
+  /* Everything else is found by fingerprint.  */
+
+  if ((idx = ctf_fpidx (fp)) == NULL)
+    return CTF_ERR;
+
+  h = ctf_type_fingerprint (src_fp, src_type);
+  for (slot = h & idx->cfi_mask; idx->cfi_ents[slot].cfe_index != 0;
+       slot = (slot + 1) & idx->cfi_mask)
+    {
+      ctf_id_t type;
+
+      if (idx->cfi_ents[slot].cfe_hash != h)
+	continue;
+
+      type = LCTF_INDEX_TO_TYPE (fp, idx->cfi_ents[slot].cfe_index, child);
+      if (ctf_type_equiv (src_fp, src_type, fp, type))
+	return type;
+    }
+
+  return CTF_ERR;
+}
+
+ctf_id_t
+ctf_type_find_equiv (ctf_file_t *fp, ctf_file_t *src_fp, ctf_id_t src_type)
+{
+  ctf_id_t type;
+
+  ctf_resid_hold (fp);
+  ctf_resid_hold (src_fp);
+  type = ctf_type_find_equiv_held (fp, src_fp, src_type);
+  ctf_resid_release (src_fp);
+  ctf_resid_release (fp);
+  return type;
+}
+
+/* A map from the type IDs of an old container to those of a new one.  */
+
+struct ctf_idmap
+{
+  ctf_id_t *cim_map;		/* New IDs by old index, or 0 if none.  */
+  unsigned long cim_ntypes;	/* Number of old types.  */
+  uint32_t cim_parmax;		/* ctf_parmax of the old container.  */
+  int cim_child;		/* Nonzero if the old container is a child.  */
+};
+
+/* Return the ID of the named root type in FP in the same namespace and of the
+   same kind as TP in SRC_FP, or CTF_ERR if none.  */
+
+static ctf_id_t
+ctf_idmap_byname (ctf_file_t *fp, ctf_file_t *src_fp, const ctf_type_t *tp)
+{
+  const char *name = ctf_strptr (src_fp, tp->ctt_name);
+  uint32_t kind = LCTF_INFO_KIND (src_fp, tp->ctt_info);
+  ctf_hash_t *hp;
+  ctf_helem_t *hep;
+
+  if (!LCTF_INFO_ISROOT (src_fp, tp->ctt_info) || name[0] == '\0'
+      || kind == CTF_K_FORWARD)
+    return CTF_ERR;
+
+  switch (kind)
+    {
+    case CTF_K_STRUCT:
+      hp = &fp->ctf_structs;
+      break;
+    case CTF_K_UNION:
+      hp = &fp->ctf_unions;
+      break;
+    case CTF_K_ENUM:
+      hp = &fp->ctf_enums;
+      break;
+    default:
+      hp = &fp->ctf_names;
+    }
+
+  if ((hep = ctf_hash_lookup (hp, fp, name, strlen (name))) == NULL
+      || ctf_type_kind (fp, hep->h_type) != (int) kind)
+    return CTF_ERR;
+
+  return hep->h_type;
+}
+
+/* Compute a map from the types in OFP to equivalent types in NFP, typically a
+   later version of the same container.  Types are matched by name where they
+   have one and by structural fingerprint otherwise, and must be equivalent
+   as ctf_add_type() understands it.  If FLAGS includes CTF_IDMAP_BYNAME,
+   named root types with no equivalent are also matched to the type of the same
+   name and kind in NFP, if any, even though it has changed.
+
+   Only the types in OFP itself are mapped, not those in its parent: map the
+   parents separately.  Returns NULL and sets *ERRP on error.  */
+
+static ctf_idmap_t *
+ctf_idmap_create_held (ctf_file_t *ofp, ctf_file_t *nfp, int flags, int *errp)
+{
+  ctf_idmap_t *map;
+  int child = (ofp->ctf_flags & LCTF_CHILD);
+  unsigned long i;
+  int err;
+
+  if ((err = ctf_lazy_load_all (ofp)) != 0
+      || (err = ctf_lazy_names (nfp)) != 0)
+    {
+      if (errp != NULL)
+	*errp = err;
+      return NULL;
+    }
+
+  if ((map = ctf_alloc (sizeof (ctf_idmap_t))) == NULL)
+    goto oom;
+
+  map->cim_ntypes = ofp->ctf_typemax;
+  map->cim_parmax = ofp->ctf_parmax;
+  map->cim_child = child;
+  if ((map->cim_map = calloc (map->cim_ntypes + 1, sizeof (ctf_id_t))) == NULL)
+    {
+      ctf_free (map, sizeof (ctf_idmap_t));
+      goto oom;
+    }
+
+  for (i = 1; i <= map->cim_ntypes; i++)
+    {
+      ctf_id_t type = LCTF_INDEX_TO_TYPE (ofp, i, child);
+
+      type = ctf_type_find_equiv (nfp, ofp, type);
+
+      if (type == CTF_ERR && (flags & CTF_IDMAP_BYNAME))
+	type = ctf_idmap_byname (nfp, ofp, LCTF_INDEX_TO_TYPEPTR (ofp, i));
+
+      if (type != CTF_ERR)
+	map->cim_map[i] = type;
+    }
+
+  return map;
+
+oom:
+  if (errp != NULL)
+    *errp = ENOMEM;
+  return NULL;
+}
+
+ctf_idmap_t *
+ctf_idmap_create (ctf_file_t *ofp, ctf_file_t *nfp, int flags, int *errp)
+{
+  ctf_idmap_t *map;
+
+  ctf_resid_hold (ofp);
+  ctf_resid_hold (nfp);
+  map = ctf_idmap_create_held (ofp, nfp, flags, errp);
+  ctf_resid_release (nfp);
+  ctf_resid_release (ofp);
+  return map;
+}
+
+/* Return the new type ID corresponding to OLD, or CTF_ERR if it has none.  */
+
+ctf_id_t
+ctf_idmap_lookup (const ctf_idmap_t *map, ctf_id_t old)
+{
+  long idx = old;
+
+  if (map->cim_child)
+    idx -= (long) map->cim_parmax + 1;
+
+  if (idx < 1 || (unsigned long) idx > map->cim_ntypes
+      || map->cim_map[idx] == 0)
+    return CTF_ERR;
+
+  return map->cim_map[idx];
+}
+
+/* Iterate over the old type IDs that have no corresponding new type, passing
+   each to FUNC.  Returns the first non-zero value FUNC returns, or zero.  */
+
+int
+ctf_idmap_unmatched (const ctf_idmap_t *map, ctf_type_f *func, void *arg)
+{
+  unsigned long i;
+  int rc;
+
+  for (i = 1; i <= map->cim_ntypes; i++)
+    {
+      ctf_id_t old = map->cim_child ? (ctf_id_t) (i | (map->cim_parmax + 1))
+	: (ctf_id_t) i;
+
+      if (map->cim_map[i] == 0 && (rc = func (old, arg)) != 0)
+	return rc;
+    }
+
+  return 0;
+}
+
+/* Free a type ID map.  */
+
+void
+ctf_idmap_free (ctf_idmap_t *map)
+{
+  if (map == NULL)
+    return;
+
+  free (map->cim_map);
+  ctf_free (map, sizeof (ctf_idmap_t));
+}
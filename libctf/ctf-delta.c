@@ -0,0 +1,280 @@
+/* Delta encoding of CTF files against base CTF files.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <assert.h>
+#include <endian.h>
+#include <string.h>
+
+/* A delta describes one CTF file (the target) in terms of another (the base)
+   as a sequence of operations, each of which appends to the target either a
+   run of bytes copied from the base or a run of literal bytes:
+
+     COPY:   uint32_t kind, uint32_t length, uint64_t base offset
+     INSERT: uint32_t kind, uint32_t length, LENGTH literal bytes
+
+   All integers are little-endian and unaligned.
+
+   Successive builds of the same module mostly contain the same types, but
+   their type IDs and string offsets shift whenever anything is added or
+   removed, so a type-by-type comparison finds little in common.  Instead, we
+   find runs of identical bytes wherever they occur: the base is indexed in
+   fixed-size blocks by a rolling hash, and the target is scanned with the same
+   hash, extending every verified block match as far as it goes in both
+   directions.  Each COPY covers at least CTF_DELTA_BLOCK bytes and costs less
+   than that to encode, so a delta is never more than CTF_DELTA_SLOP bytes
+   larger than the target itself.  */
+
+#define CTF_DELTA_BLOCK 32		/* Size of indexed base blocks.  */
+#define CTF_DELTA_MULT 0x01000193	/* Rolling hash multiplier.  */
+#define CTF_DELTA_SLOP 64		/* Most a delta exceeds its target by.  */
+
+enum
+{
+  CTF_DELTA_COPY = 1,
+  CTF_DELTA_INSERT = 2
+};
+
+/* Index entry: the hash of a block of the base, and its offset plus one (so
+   that zero marks an empty slot).  */
+
+typedef struct ctf_delta_ent
+{
+  uint32_t cde_hash;
+  size_t cde_off;
+} ctf_delta_ent_t;
+
+static uint32_t
+ctf_delta_hash (const unsigned char *p)
+{
+  uint32_t h = 0;
+  size_t i;
+
+  for (i = 0; i < CTF_DELTA_BLOCK; i++)
+    h = h * CTF_DELTA_MULT + p[i];
+
+  return h;
+}
+
+static unsigned char *
+ctf_delta_put_op (unsigned char *op, uint32_t kind, uint32_t len)
+{
+  kind = htole32 (kind);
+  len = htole32 (len);
+  memcpy (op, &kind, sizeof (uint32_t));
+  memcpy (op + sizeof (uint32_t), &len, sizeof (uint32_t));
+  return op + 2 * sizeof (uint32_t);
+}
+
+/* Append INSERTs of the LEN bytes at DATA, and return the new end.  */
+
+static unsigned char *
+ctf_delta_insert (unsigned char *op, const unsigned char *data, size_t len)
+{
+  while (len > 0)
+    {
+      uint32_t n = len > UINT32_MAX ? UINT32_MAX : len;
+
+      op = ctf_delta_put_op (op, CTF_DELTA_INSERT, n);
+      memcpy (op, data, n);
+      op += n;
+      data += n;
+      len -= n;
+    }
+  return op;
+}
+
+/* Append COPYs of the LEN bytes at base offset OFF, and return the new
+   end.  */
+
+static unsigned char *
+ctf_delta_copy (unsigned char *op, uint64_t off, size_t len)
+{
+  while (len > 0)
+    {
+      uint32_t n = len > UINT32_MAX ? UINT32_MAX : len;
+      uint64_t leoff = htole64 (off);
+
+      op = ctf_delta_put_op (op, CTF_DELTA_COPY, n);
+      memcpy (op, &leoff, sizeof (uint64_t));
+      op += sizeof (uint64_t);
+      off += n;
+      len -= n;
+    }
+  return op;
+}
+
+/* Compute a delta turning the BSZ bytes at BASE into the TSZ bytes at TGT,
+   returning a newly-allocated buffer of operations in *OPSP and its length in
+   *OPSLENP.  BASE may be NULL if there is no base.  Returns zero or an errno
+   value.  */
+
+int
+ctf_delta_encode (const unsigned char *base, size_t bsz,
+		  const unsigned char *tgt, size_t tsz,
+		  unsigned char **opsp, size_t *opslenp)
+{
+  ctf_delta_ent_t *idx = NULL;
+  unsigned char *ops, *op;
+  size_t nblocks = base != NULL ? bsz / CTF_DELTA_BLOCK : 0;
+  size_t idxsz, i, p, lit = 0;
+  uint32_t pow, h;
+
+  if ((ops = malloc (tsz + CTF_DELTA_SLOP)) == NULL)
+    return ENOMEM;
+  op = ops;
+
+  if (nblocks == 0 || tsz < CTF_DELTA_BLOCK)
+    goto tail;
+
+  for (idxsz = 1; idxsz < nblocks * 2; idxsz <<= 1);
+  if ((idx = calloc (idxsz, sizeof (ctf_delta_ent_t))) == NULL)
+    {
+      free (ops);
+      return ENOMEM;
+    }
+
+  /* Index the base.  On collision, the first block wins.  */
+
+  for (i = 0; i < nblocks; i++)
+    {
+      size_t slot;
+
+      h = ctf_delta_hash (base + i * CTF_DELTA_BLOCK);
+      for (slot = h & (idxsz - 1); idx[slot].cde_off != 0;
+	   slot = (slot + 1) & (idxsz - 1))
+	{
+	  if (idx[slot].cde_hash == h)
+	    break;
+	}
+
+      if (idx[slot].cde_off == 0)
+	{
+	  idx[slot].cde_hash = h;
+	  idx[slot].cde_off = i * CTF_DELTA_BLOCK + 1;
+	}
+    }
+
+  for (pow = 1, i = 1; i < CTF_DELTA_BLOCK; i++)
+    pow *= CTF_DELTA_MULT;
+
+  /* Scan the target, rolling the hash along one byte at a time and emitting
+     literal runs and copies as matches are found.  */
+
+  h = ctf_delta_hash (tgt);
+  for (p = 0; p + CTF_DELTA_BLOCK <= tsz;)
+    {
+      size_t slot, off = 0, len;
+
+      for (slot = h & (idxsz - 1); idx[slot].cde_off != 0;
+	   slot = (slot + 1) & (idxsz - 1))
+	{
+	  if (idx[slot].cde_hash == h)
+	    {
+	      off = idx[slot].cde_off;
+	      break;
+	    }
+	}
+
+      if (off == 0 || memcmp (base + off - 1, tgt + p, CTF_DELTA_BLOCK) != 0)
+	{
+	  if (p + CTF_DELTA_BLOCK < tsz)
+	    h = (h - tgt[p] * pow) * CTF_DELTA_MULT + tgt[p + CTF_DELTA_BLOCK];
+	  p++;
+	  continue;
+	}
+      off--;
+
+      while (p > lit && off > 0 && base[off - 1] == tgt[p - 1])
+	{
+	  p--;
+	  off--;
+	}
+
+      for (len = CTF_DELTA_BLOCK; off + len < bsz && p + len < tsz
+	     && base[off + len] == tgt[p + len]; len++);
+
+      op = ctf_delta_insert (op, tgt + lit, p - lit);
+      op = ctf_delta_copy (op, off, len);
+      p += len;
+      lit = p;
+
+      if (p + CTF_DELTA_BLOCK <= tsz)
+	h = ctf_delta_hash (tgt + p);
+    }
+
+  free (idx);
+
+tail:
+  op = ctf_delta_insert (op, tgt + lit, tsz - lit);
+
+  assert ((size_t) (op - ops) <= tsz + CTF_DELTA_SLOP);
+  *opsp = ops;
+  *opslenp = op - ops;
+  return 0;
+}
+
+/* Apply the OPSLEN bytes of delta operations at OPS to the BSZ bytes at BASE,
+   reconstructing exactly TSZ bytes at TGT.  Returns zero, or ECTF_CORRUPT if
+   the delta is invalid.  */
+
+int
+ctf_delta_apply (const unsigned char *base, size_t bsz,
+		 const unsigned char *ops, size_t opslen,
+		 unsigned char *tgt, size_t tsz)
+{
+  size_t pos = 0, out = 0;
+
+  while (pos < opslen)
+    {
+      uint32_t kind, len;
+
+      if (opslen - pos < 2 * sizeof (uint32_t))
+	return ECTF_CORRUPT;
+
+      memcpy (&kind, ops + pos, sizeof (uint32_t));
+      memcpy (&len, ops + pos + sizeof (uint32_t), sizeof (uint32_t));
+      kind = le32toh (kind);
+      len = le32toh (len);
+      pos += 2 * sizeof (uint32_t);
+
+      if (tsz - out < len)
+	return ECTF_CORRUPT;
+
+      switch (kind)
+	{
+	case CTF_DELTA_COPY:
+	  {
+	    uint64_t off;
+
+	    if (opslen - pos < sizeof (uint64_t))
+	      return ECTF_CORRUPT;
+	    memcpy (&off, ops + pos, sizeof (uint64_t));
+	    off = le64toh (off);
+	    pos += sizeof (uint64_t);
+
+	    if (base == NULL || off > bsz || bsz - off < len)
+	      return ECTF_CORRUPT;
+	    memcpy (tgt + out, base + off, len);
+	    break;
+	  }
+	case CTF_DELTA_INSERT:
+	  if (opslen - pos < len)
+	    return ECTF_CORRUPT;
+	  memcpy (tgt + out, ops + pos, len);
+	  pos += len;
+	  break;
+	default:
+	  return ECTF_CORRUPT;
+	}
+      out += len;
+    }
+
+  return out == tsz ? 0 : ECTF_CORRUPT;
+}
@@ -55,7 +55,8 @@ static const char *const _ctf_errlist[] = {
   "Attempt to roll back past a ctf_update",	     /* ECTF_OVERROLLBACK */
   "Failed to compress CTF data",		     /* ECTF_COMPRESS */
   "Failed to create CTF archive",		     /* ECTF_ARCREATE */
-  "Name not found in CTF archive"		     /* ECTF_ARNNAME */
+  "Name not found in CTF archive",		     /* ECTF_ARNNAME */
+  "No more elements to iterate over"		     /* ECTF_NEXT_END */
 };
 
 static const int _ctf_nerr = sizeof (_ctf_errlist) / sizeof (_ctf_errlist[0]);
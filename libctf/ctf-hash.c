@@ -50,6 +50,12 @@ ctf_hash_create (ctf_hash_t *hp, unsigned long nelems)
   memset (hp->h_buckets, 0, sizeof (unsigned short) * hp->h_nbuckets);
   memset (hp->h_chains, 0, sizeof (ctf_helem_t) * hp->h_nelems);
 
+  if (ctf_bloom_create (&hp->h_bloom, nelems) != 0)
+    {
+      ctf_hash_destroy (hp);
+      return EAGAIN;
+    }
+
   return 0;
 }
 
@@ -59,91 +65,111 @@ ctf_hash_size (const ctf_hash_t *hp)
   return (hp->h_nelems ? hp->h_nelems - 1 : 0);
 }
 
+/* Hash LEN bytes of KEY (which need not be NUL-terminated) a machine word at a
+   time.  The hash is only ever used in memory, so it need not be stable across
+   hosts of differing endianness.  */
+
 unsigned long
 ctf_hash_compute (const char *key, size_t len)
 {
-  unsigned long g, h = 0;
-  const char *p, *q = key + len;
-  size_t n = 0;
+  const uint64_t k1 = 0x87c37b91114253d5ULL;
+  const uint64_t k2 = 0x4cf5ad432745937fULL;
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * k2);
+  uint64_t w;
 
-  for (p = key; p < q; p++, n++)
+  for (; len >= sizeof (w); key += sizeof (w), len -= sizeof (w))
     {
-      h = (h << 4) + *p;
+      memcpy (&w, key, sizeof (w));
+      h ^= w * k1;
+      h = ((h << 31) | (h >> 33)) * k2;
+    }
 
-      if ((g = (h & 0xf0000000)) != 0)
-	{
-	  h ^= (g >> 24);
-	  h ^= g;
-	}
+  if (len > 0)
+    {
+      w = 0;
+      memcpy (&w, key, len);
+      h ^= w * k1;
+      h = ((h << 31) | (h >> 33)) * k2;
     }
 
-  return h;
+  /* Final avalanche, so that the low bits used for bucket selection and the
+     bits cached in the hash elements depend on every input byte.  */
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (unsigned long) h;
 }
 
-int
-ctf_hash_insert (ctf_hash_t * hp, ctf_file_t * fp, uint32_t type,
-		 uint32_t name)
+/* Validate an element about to be added to the hash, and return its name.  */
+
+static int
+ctf_hash_check (ctf_file_t *fp, uint32_t type, uint32_t name,
+		const char **strp)
 {
   ctf_strs_t *ctsp = &fp->ctf_str[CTF_NAME_STID (name)];
-  const char *str = ctsp->cts_strs + CTF_NAME_OFFSET (name);
-  ctf_helem_t *hep = &hp->h_chains[hp->h_free];
-  unsigned long h;
 
   if (type == 0)
     return EINVAL;
 
-  if (hp->h_free >= hp->h_nelems)
-    return EOVERFLOW;
-
   if (ctsp->cts_strs == NULL)
     return ECTF_STRTAB;
 
   if (ctsp->cts_len <= CTF_NAME_OFFSET (name))
     return ECTF_BADNAME;
 
-  if (str[0] == '\0')
-    return 0;		   /* Just ignore empty strings on behalf of caller.  */
-
-  hep->h_name = name;
-  hep->h_type = type;
-  h = ctf_hash_compute (str, strlen (str)) % hp->h_nbuckets;
-  hep->h_next = hp->h_buckets[h];
-  hp->h_buckets[h] = hp->h_free++;
-
+  *strp = ctsp->cts_strs + CTF_NAME_OFFSET (name);
   return 0;
 }
 
-/* Wrapper for ctf_hash_lookup/ctf_hash_insert: if the key is already in the
-   hash, override the previous definition with this new official definition.
-   If the key is not present, then call ctf_hash_insert() and hash it in.  */
-int
-ctf_hash_define (ctf_hash_t *hp, ctf_file_t *fp, uint32_t type,
-		 uint32_t name)
+/* Link a new element with the precomputed hash H into the table.  */
+
+static int
+ctf_hash_link (ctf_hash_t *hp, uint32_t type, uint32_t name, unsigned long h)
 {
-  const char *str = ctf_strptr (fp, name);
-  ctf_helem_t *hep = ctf_hash_lookup (hp, fp, str, strlen (str));
+  ctf_helem_t *hep = &hp->h_chains[hp->h_free];
+  unsigned long bucket;
 
-  if (hep == NULL)
-    return (ctf_hash_insert (hp, fp, type, name));
+  if (hp->h_free >= hp->h_nelems)
+    return EOVERFLOW;
 
+  hep->h_name = name;
   hep->h_type = type;
+  hep->h_hash = (uint32_t) h;
+  ctf_bloom_add (&hp->h_bloom, h);
+  bucket = h % hp->h_nbuckets;
+  hep->h_next = hp->h_buckets[bucket];
+  hp->h_buckets[bucket] = hp->h_free++;
+
   return 0;
 }
 
-ctf_helem_t *
-ctf_hash_lookup (ctf_hash_t *hp, ctf_file_t *fp, const char *key,
-		 size_t len)
+/* Look up a key with the precomputed hash H.  The cached hash in each element
+   lets us skip the string comparison (and the string table access) for nearly
+   all elements that do not match.  */
+
+static ctf_helem_t *
+ctf_hash_lookup_internal (ctf_hash_t *hp, ctf_file_t *fp, const char *key,
+			  size_t len, unsigned long h)
 {
   ctf_helem_t *hep;
   ctf_strs_t *ctsp;
   const char *str;
   unsigned short i;
 
-  unsigned long h = ctf_hash_compute (key, len) % hp->h_nbuckets;
+  /* Most lookups of names not present stop here.  */
+
+  if (!ctf_bloom_test (&hp->h_bloom, h))
+    return NULL;
 
-  for (i = hp->h_buckets[h]; i != 0; i = hep->h_next)
+  for (i = hp->h_buckets[h % hp->h_nbuckets]; i != 0; i = hep->h_next)
     {
       hep = &hp->h_chains[i];
+
+      if (hep->h_hash != (uint32_t) h)
+	continue;
+
       ctsp = &fp->ctf_str[CTF_NAME_STID (hep->h_name)];
       str = ctsp->cts_strs + CTF_NAME_OFFSET (hep->h_name);
 
@@ -154,6 +180,60 @@ ctf_hash_lookup (ctf_hash_t *hp, ctf_file_t *fp, const char *key,
   return NULL;
 }
 
+int
+ctf_hash_insert (ctf_hash_t * hp, ctf_file_t * fp, uint32_t type,
+		 uint32_t name)
+{
+  const char *str;
+  int err;
+
+  if ((err = ctf_hash_check (fp, type, name, &str)) != 0)
+    return err;
+
+  if (str[0] == '\0')
+    return 0;		   /* Just ignore empty strings on behalf of caller.  */
+
+  return ctf_hash_link (hp, type, name, ctf_hash_compute (str, strlen (str)));
+}
+
+/* Wrapper for ctf_hash_lookup/ctf_hash_insert: if the key is already in the
+   hash, override the previous definition with this new official definition.
+   If the key is not present, then hash it in.  The hash is computed only
+   once.  */
+int
+ctf_hash_define (ctf_hash_t *hp, ctf_file_t *fp, uint32_t type,
+		 uint32_t name)
+{
+  ctf_helem_t *hep;
+  const char *str;
+  unsigned long h;
+  size_t len;
+  int err;
+
+  if ((err = ctf_hash_check (fp, type, name, &str)) != 0)
+    return err;
+
+  if (str[0] == '\0')
+    return 0;
+
+  len = strlen (str);
+  h = ctf_hash_compute (str, len);
+
+  if ((hep = ctf_hash_lookup_internal (hp, fp, str, len, h)) == NULL)
+    return (ctf_hash_link (hp, type, name, h));
+
+  hep->h_type = type;
+  return 0;
+}
+
+ctf_helem_t *
+ctf_hash_lookup (ctf_hash_t *hp, ctf_file_t *fp, const char *key,
+		 size_t len)
+{
+  return ctf_hash_lookup_internal (hp, fp, key, len,
+				   ctf_hash_compute (key, len));
+}
+
 void
 ctf_hash_destroy (ctf_hash_t *hp)
 {
@@ -168,4 +248,80 @@ ctf_hash_destroy (ctf_hash_t *hp)
       ctf_free (hp->h_chains, sizeof (ctf_helem_t) * hp->h_nelems);
       hp->h_chains = NULL;
     }
+
+  ctf_bloom_destroy (&hp->h_bloom);
+}
+
+/* Bloom filters.  These let lookups of names that are not present (which are
+   common, since lookups fall back from child to parent containers, and
+   callers often probe for types that may not exist) fail without touching the
+   hash chains or the string table.
+
+   Each name sets three bits in one word: the bits are selected by three
+   six-bit fields of the low bits of the name's hash, the word by the bits
+   above those.
+   We allot about sixteen bits per name, giving a false-positive rate under
+   one percent.  */
+
+int
+ctf_bloom_create (ctf_bloom_t *bp, unsigned long nelems)
+{
+  uint32_t nwords = 1;
+
+  memset (bp, 0, sizeof (ctf_bloom_t));
+
+  if (nelems == 0)
+    return 0;
+
+  while (nwords < nelems / 4 && nwords < (1U << 31))
+    nwords <<= 1;
+
+  if ((bp->cb_words = ctf_alloc (nwords * sizeof (uint64_t))) == NULL)
+    return EAGAIN;
+
+  memset (bp->cb_words, 0, nwords * sizeof (uint64_t));
+  bp->cb_nwords = nwords;
+  return 0;
+}
+
+static inline uint64_t
+ctf_bloom_mask (unsigned long h)
+{
+  return ((1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63))
+	  | (1ULL << ((h >> 12) & 63)));
+}
+
+static inline uint32_t
+ctf_bloom_word (const ctf_bloom_t *bp, unsigned long h)
+{
+  return (uint32_t) (h >> 18) & (bp->cb_nwords - 1);
+}
+
+void
+ctf_bloom_add (ctf_bloom_t *bp, unsigned long h)
+{
+  if (bp->cb_nwords != 0)
+    bp->cb_words[ctf_bloom_word (bp, h)] |= ctf_bloom_mask (h);
+}
+
+/* Return nonzero if a name with hash H may be present.  */
+
+int
+ctf_bloom_test (const ctf_bloom_t *bp, unsigned long h)
+{
+  uint64_t mask = ctf_bloom_mask (h);
+
+  if (bp->cb_nwords == 0)
+    return 0;
+
+  return (bp->cb_words[ctf_bloom_word (bp, h)] & mask) == mask;
+}
+
+void
+ctf_bloom_destroy (ctf_bloom_t *bp)
+{
+  if (bp->cb_words != NULL)
+    ctf_free (bp->cb_words, bp->cb_nwords * sizeof (uint64_t));
+  bp->cb_words = NULL;
+  bp->cb_nwords = 0;
 }
@@ -54,8 +54,19 @@ typedef struct ctf_helem
   uint32_t h_name;		/* Reference to name in string table.  */
   uint32_t h_type;		/* Corresponding type ID number.  */
   uint32_t h_next;		/* Index of next element in hash chain.  */
+  uint32_t h_hash;		/* Low 32 bits of the hash of h_name.  */
 } ctf_helem_t;
 
+/* A blocked Bloom filter over name hashes: each name sets (and each probe
+   tests) a few bits of a single 64-bit word, so a probe costs at most one
+   cache miss.  A filter with no words is empty: every probe misses.  */
+
+typedef struct ctf_bloom
+{
+  uint64_t *cb_words;		/* Filter bits.  */
+  uint32_t cb_nwords;		/* Number of words (a power of two).  */
+} ctf_bloom_t;
+
 typedef struct ctf_hash
 {
   unsigned short *h_buckets;	/* Hash bucket array (chain indices).  */
@@ -63,6 +74,7 @@ typedef struct ctf_hash
   unsigned short h_nbuckets;	/* Number of elements in bucket array.  */
   uint32_t h_nelems;		/* Number of elements in hash table.  */
   uint32_t h_free;		/* Index of next free hash element.  */
+  ctf_bloom_t h_bloom;		/* Filter over the names in the table.  */
 } ctf_hash_t;
 
 typedef struct ctf_strs
@@ -142,8 +154,18 @@ typedef struct ctf_dmdef
   ctf_id_t dmd_type;		/* Type of this member (for sou).  */
   unsigned long dmd_offset;	/* Offset of this member in bits (for sou).  */
   int dmd_value;		/* Value of this member (for enum).  */
+  int dmd_bulk;			/* Allocated in a ctf_dmblock_t.  */
 } ctf_dmdef_t;
 
+/* A block of member definitions added in one go by ctf_add_struct_members()
+   or ctf_add_enumerators(), followed by their names.  */
+
+typedef struct ctf_dmblock
+{
+  struct ctf_dmblock *dmb_next;	/* Next block for this type.  */
+  size_t dmb_size;		/* Size of this block, including header.  */
+} ctf_dmblock_t;
+
 typedef struct ctf_dtdef
 {
   ctf_list_t dtd_list;		/* List forward/back pointers.  */
@@ -151,6 +173,7 @@ typedef struct ctf_dtdef
   char *dtd_name;		/* Name associated with definition (if any).  */
   ctf_id_t dtd_type;		/* Type identifier for this definition.  */
   ctf_type_t dtd_data;		/* Type node (see <sys/ctf.h>).  */
+  ctf_dmblock_t *dtd_blocks;	/* Bulk-allocated member blocks.  */
   union
   {
     ctf_list_t dtu_members;	/* struct, union, or enum */
@@ -169,6 +192,114 @@ typedef struct ctf_dvdef
   unsigned long dvd_snapshots;	/* Snapshot count when inserted.  */
 } ctf_dvdef_t;
 
+/* Dense summary of the committed types in a container, built on demand by
+   ctf_type_select() and friends.  Each array is indexed by type index and has
+   cts_ntypes entries: slot 0 is unused.  */
+
+typedef struct ctf_typesum
+{
+  uint64_t *cts_size;		/* Size in bytes (0 for reference kinds).  */
+  uint32_t *cts_vlen;		/* Variable-length data count.  */
+  uint32_t *cts_name;		/* Reference to name in string table.  */
+  uint32_t *cts_ref;		/* Referenced type (reference kinds only).  */
+  unsigned char *cts_kind;	/* Type kind.  */
+  unsigned char *cts_root;	/* Nonzero if the type is root-visible.  */
+  unsigned long cts_ntypes;	/* Number of entries in each array.  */
+  size_t cts_alloc;		/* Size of this allocation.  */
+} ctf_typesum_t;
+
+/* A permutation of the root types of one kind, sorted by name.  */
+
+typedef struct ctf_nameidx
+{
+  unsigned long cni_n;		/* Number of types in the index.  */
+  uint32_t cni_types[];		/* Type indexes.  */
+} ctf_nameidx_t;
+
+/* Progress of the lazy fill of the symtab translation table: see
+   ctf_symtab_fill().  */
+
+typedef struct ctf_sxfill
+{
+  unsigned long csx_next;	/* Symbols translated so far.  */
+  uint32_t csx_objtoff;		/* Offset of the next data object.  */
+  uint32_t csx_funcoff;		/* Offset of the next function.  */
+  uint32_t csx_objtend;		/* End of the data object section.  */
+  uint32_t csx_funcend;		/* End of the function section.  */
+} ctf_sxfill_t;
+
+/* An open-addressed hash of every type in a container by structural
+   fingerprint: see ctf-dedup.c.  */
+
+typedef struct ctf_fpent
+{
+  uint32_t cfe_hash;		/* Fingerprint.  */
+  uint32_t cfe_index;		/* Type index, or 0 if the slot is empty.  */
+} ctf_fpent_t;
+
+typedef struct ctf_fpidx
+{
+  unsigned long cfi_mask;	/* Number of slots, minus one.  */
+  ctf_fpent_t cfi_ents[];	/* Slots.  */
+} ctf_fpidx_t;
+
+/* An open-addressed hash of the members of one struct or union by name,
+   including the members of its anonymous struct and union members, with their
+   offsets from the start of the outermost one: see ctf_member_info().  */
+
+typedef struct ctf_membent
+{
+  const char *cme_name;		/* Name, or NULL if the slot is empty.  */
+  ctf_id_t cme_type;		/* Member type.  */
+  unsigned long cme_offset;	/* Offset in bits.  */
+} ctf_membent_t;
+
+typedef struct ctf_membidx
+{
+  unsigned long cmi_mask;	/* Number of slots, minus one.  */
+  ctf_membent_t cmi_ents[];	/* Slots.  */
+} ctf_membidx_t;
+
+/* Residency accounting for the rebuildable state of a container: see
+   ctf-residency.c.  */
+
+typedef struct ctf_resid
+{
+  ctf_list_t cr_list;		/* Residency LRU list forward/back pointers.  */
+  struct ctf_file *cr_fp;	/* Container this state belongs to.  */
+  size_t cr_bytes;		/* Bytes of rebuildable state.  */
+  unsigned long cr_holds;	/* Users preventing eviction.  */
+  int cr_evicting;		/* Nonzero while being evicted.  */
+  int cr_linked;		/* Nonzero if on the LRU list.  */
+} ctf_resid_t;
+
+/* Lazy-loading state of a container: see ctf-lazy.c.  */
+
+typedef struct ctf_lazy ctf_lazy_t;
+
+/* Publication state of a writable container: see ctf_publish().  This lives
+   outside the ctf_file, so that readers need never look at the ctf_file while
+   ctf_update() is overwriting it.  */
+
+struct ctf_pub
+{
+  struct ctf_file *cp_snap;	/* Currently-published snapshot.  */
+  uint32_t cp_pinning;		/* Readers partway through ctf_pin().  */
+};
+
+/* An output sink for serialized CTF: see ctf-lib.c.  */
+
+typedef struct ctf_sink
+{
+  unsigned char *cs_buf;	/* Staging buffer (or destination, for memory).  */
+  size_t cs_size;		/* Size of staging buffer.  */
+  size_t cs_pos;		/* Bytes currently staged.  */
+  int cs_fd;			/* File descriptor, or -1 for memory.  */
+  int cs_zinit;			/* Nonzero if cs_zs is initialized.  */
+  z_stream *cs_zs;		/* Deflate stream, if compressing.  */
+  unsigned char *cs_zbuf;	/* Deflate output buffer.  */
+} ctf_sink_t;
+
 typedef struct ctf_bundle
 {
   ctf_file_t *ctb_file;		/* CTF container handle.  */
@@ -204,6 +335,7 @@ struct ctf_file
   size_t ctf_size;		  /* Size of CTF header + uncompressed data.  */
   uint32_t *ctf_sxlate;		  /* Translation table for symtab entries.  */
   unsigned long ctf_nsyms;	  /* Number of entries in symtab xlate table.  */
+  ctf_sxfill_t ctf_sxfill;	  /* Progress filling in ctf_sxlate.  */
   uint32_t *ctf_txlate;		  /* Translation table for type IDs.  */
   uint32_t *ctf_ptrtab;		  /* Translation table for pointer-to lookups.  */
   struct ctf_varent *ctf_vars;	  /* Sorted variable->type mapping.  */
@@ -231,6 +363,17 @@ struct ctf_file
   unsigned long ctf_snapshots;	  /* ctf_snapshot() plus ctf_update() count.  */
   unsigned long ctf_snapshot_lu;  /* ctf_snapshot() call count at last update.  */
   void *ctf_specific;		  /* Data for ctf_get/setspecific().  */
+  ctf_typesum_t *ctf_typesum;	  /* Type summary table (if built yet).  */
+  ctf_bloom_t ctf_varbloom;	  /* Filter over the names in ctf_vars.  */
+  ctf_nameidx_t *ctf_nameidx[CTF_K_TYPEDEF + 1]; /* Sorted name indexes.  */
+  ctf_fpidx_t *ctf_fpidx;	  /* Fingerprint index (if built yet).  */
+  ctf_membidx_t **ctf_membidx;	  /* Member indexes by type index.  */
+  ctf_pub_t *ctf_pub;		  /* Snapshot publication state, if any.  */
+  uint32_t ctf_pins;		  /* Pins held on this snapshot.  */
+  int ctf_zlevel;		  /* Compression level for writing.  */
+  int ctf_zstrategy;		  /* Compression strategy for writing.  */
+  ctf_resid_t ctf_resid;	  /* Residency accounting.  */
+  ctf_lazy_t *ctf_lazy;		  /* Lazy-loading state (if any).  */
 };
 
 /* The ctf_archive is a collection of ctf_file_t's stored together. The format
@@ -277,6 +420,27 @@ typedef struct ctf_archive_modent
   uint64_t ctf_offset;
 } ctf_archive_modent_t;
 
+/* A delta archive has the same layout, but a different magic number.  The
+   name at offset zero in the name table is that of a base archive, relative
+   to the directory containing the delta archive if not absolute, and each
+   element of the CTF table is a ctf_archive_delta_t followed by delta
+   operations (see ctf-delta.c) against the uncompressed contents of the
+   member of the same name in the base archive, if any.  If
+   CTFA_DELTA_F_COMPRESS is set, the operations are deflated.
+
+   ctf_arc_open() materializes delta archives into ordinary archives in
+   memory, so nothing else in the library ever sees one.  */
+
+#define CTFA_DELTA_MAGIC 0x8b47f2a4d7623eec
+#define CTFA_DELTA_F_COMPRESS 0x1
+
+typedef struct ctf_archive_delta
+{
+  uint64_t ctad_size;		/* Size of the reconstructed CTF file.  */
+  uint64_t ctad_opslen;		/* Uncompressed size of the operations.  */
+  uint64_t ctad_flags;		/* CTFA_DELTA_F_* flags.  */
+} ctf_archive_delta_t;
+
 /* Return x rounded up to an alignment boundary.
    eg, P2ROUNDUP(0x1234, 0x100) == 0x1300 (0x13*align)
    eg, P2ROUNDUP(0x5600, 0x100) == 0x5600 (0x56*align)  */
@@ -312,8 +476,10 @@ static inline ssize_t ctf_get_ctt_size (const ctf_file_t* fp,
 #define LCTF_CHILD	0x0002	/* CTF container is a child */
 #define LCTF_RDWR	0x0004	/* CTF container is writable */
 #define LCTF_DIRTY	0x0008	/* CTF container has been modified */
+#define LCTF_SNAPSHOT	0x0010	/* CTF container is a published snapshot */
 
 extern const ctf_type_t *ctf_lookup_by_id (ctf_file_t **, ctf_id_t);
+extern int ctf_symtab_fill (ctf_file_t *, unsigned long);
 
 extern int ctf_hash_create (ctf_hash_t *, unsigned long);
 extern int ctf_hash_insert (ctf_hash_t *, ctf_file_t *, uint32_t, uint32_t);
@@ -324,6 +490,11 @@ extern uint32_t ctf_hash_size (const ctf_hash_t *);
 extern unsigned long ctf_hash_compute (const char *key, size_t len);
 extern void ctf_hash_destroy (ctf_hash_t *);
 
+extern int ctf_bloom_create (ctf_bloom_t *, unsigned long);
+extern void ctf_bloom_add (ctf_bloom_t *, unsigned long);
+extern int ctf_bloom_test (const ctf_bloom_t *, unsigned long);
+extern void ctf_bloom_destroy (ctf_bloom_t *);
+
 #define	ctf_list_prev(elem)	((void *)(((ctf_list_t *)(elem))->l_prev))
 #define	ctf_list_next(elem)	((void *)(((ctf_list_t *)(elem))->l_next))
 
@@ -339,6 +510,45 @@ extern void ctf_dvd_insert (ctf_file_t *, ctf_dvdef_t *);
 extern void ctf_dvd_delete (ctf_file_t *, ctf_dvdef_t *);
 extern ctf_dvdef_t *ctf_dvd_lookup (ctf_file_t *, const char *);
 
+extern void ctf_typesum_destroy (ctf_file_t *);
+extern void ctf_nameidx_destroy (ctf_file_t *);
+extern void ctf_fpidx_destroy (ctf_file_t *);
+extern void ctf_membidx_destroy (ctf_file_t *);
+extern void ctf_pub_destroy (ctf_file_t *);
+
+extern uint32_t ctf_type_fingerprint (ctf_file_t *, ctf_id_t);
+extern int ctf_type_equiv (ctf_file_t *, ctf_id_t, ctf_file_t *, ctf_id_t);
+extern ctf_id_t ctf_type_find_equiv (ctf_file_t *, ctf_file_t *, ctf_id_t);
+
+extern int ctf_delta_encode (const unsigned char *, size_t,
+			     const unsigned char *, size_t,
+			     unsigned char **, size_t *);
+extern int ctf_delta_apply (const unsigned char *, size_t,
+			    const unsigned char *, size_t,
+			    unsigned char *, size_t);
+
+extern ctf_file_t *ctf_bufopen_lazy (const ctf_sect_t *, const ctf_sect_t *,
+				     const ctf_sect_t *, int *);
+extern int ctf_init_names (ctf_file_t *);
+extern void ctf_fini_names (ctf_file_t *);
+
+extern int ctf_lazy_create (const ctf_header_t *, const void *, size_t,
+			    ctf_lazy_t **);
+extern int ctf_lazy_inflate (ctf_lazy_t *, unsigned char *, int);
+extern uint32_t ctf_lazy_ntypes (const ctf_lazy_t *);
+extern void ctf_lazy_destroy (ctf_lazy_t *);
+extern int ctf_lazy_load (ctf_file_t *, unsigned long);
+extern int ctf_lazy_load_all (ctf_file_t *);
+extern int ctf_lazy_names (ctf_file_t *);
+extern size_t ctf_lazy_resident (ctf_file_t *);
+extern int ctf_lazy_evict (ctf_file_t *);
+
+extern void ctf_resid_add (ctf_file_t *, size_t);
+extern void ctf_resid_touch (ctf_file_t *);
+extern void ctf_resid_hold (ctf_file_t *);
+extern void ctf_resid_release (ctf_file_t *);
+extern void ctf_resid_forget (ctf_file_t *);
+
 extern void ctf_decl_init (ctf_decl_t *, char *, size_t);
 extern void ctf_decl_fini (ctf_decl_t *);
 extern void ctf_decl_push (ctf_decl_t *, ctf_file_t *, ctf_id_t);
@@ -358,6 +568,13 @@ extern void ctf_sect_munmap (const ctf_sect_t *);
 extern void *ctf_data_alloc (size_t);
 extern void ctf_data_free (void *, size_t);
 extern void ctf_data_protect (void *, size_t);
+extern void ctf_data_discard (void *, size_t);
+
+extern int ctf_write_fd (int, const void *, size_t);
+extern void ctf_sink_init_mem (ctf_sink_t *, void *, size_t);
+extern int ctf_sink_init_fd (ctf_sink_t *, int, int, int, int);
+extern int ctf_sink_write (ctf_sink_t *, const void *, size_t);
+extern int ctf_sink_fini (ctf_sink_t *, int);
 
 extern void *ctf_alloc (size_t);
 extern void ctf_free (void *, size_t);
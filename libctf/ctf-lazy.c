@@ -0,0 +1,636 @@
+/* Chunked containers, and loading their types lazily.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* The data of a chunked container (see CTF_F_CHUNKED in <sys/ctf.h>) is
+   compressed as a series of independent chunks.  A full open inflates them all
+   on as many threads as there are CPUs.
+
+   A lazy open inflates only the chunks outside the type section, leaving the
+   rest of the buffer untouched (and so, since it is mapped anonymously, not
+   taking up any memory).  The type translation table is allocated but not
+   filled in: the first lookup of a type inflates the chunk holding it into
+   place and fills in the table for every type in that chunk.  The name hashes
+   and pointer table need every type, so they are only built on the first
+   lookup by name.  A consumer that only follows a few type IDs therefore
+   never inflates most of the container.
+
+   Lazy opening is only possible if the compressed data lives as long as the
+   container: ctf_fdopen() and ctf_arc_open_by_name() open lazily, since the
+   file or archive stays mapped; ctf_bufopen() does a full open.  Chunks are
+   loaded under a per-container lock, and flagged as loaded only once they are
+   complete, so any number of threads can look up types at once.
+
+   Lazily-opened containers that are not chunked are inflated and indexed in
+   full at open time, but the same machinery lets the residency budget (see
+   ctf-residency.c) throw away their name hashes and, if they are compressed,
+   the pages holding their types: the type section of a compressed container
+   is treated as a single type chunk, inflated again by inflating the
+   compressed stream from the start and discarding everything before the type
+   section.  The type translation table is kept when chunks are thrown away,
+   so reloading them need not fill it in again.  */
+
+#define CTF_INFLATE_THREADS 16	/* Most threads to inflate chunks with.  */
+
+typedef struct ctf_lzchunk
+{
+  const unsigned char *clc_src;	/* Compressed data.  */
+  uint32_t clc_len;		/* Compressed length.  */
+  uint32_t clc_size;		/* Uncompressed length.  */
+  size_t clc_off;		/* Offset of uncompressed data in ctf_buf.  */
+  size_t clc_skip;		/* Bytes inflated before it and discarded.  */
+  int clc_partial;		/* Nonzero if its stream runs on after it.  */
+  uint32_t clc_type;		/* Index of first type, or 0.  */
+  uint32_t clc_loaded;		/* Nonzero while inflated.  */
+  uint32_t clc_xlated;		/* Nonzero once its types are translated.  */
+} ctf_lzchunk_t;
+
+struct ctf_lazy
+{
+  pthread_mutex_t cl_lock;	/* Serializes loading and eviction.  */
+  ctf_lzchunk_t *cl_chunks;	/* All the chunks, in order.  */
+  uint32_t cl_nchunks;		/* Number of chunks.  */
+  uint32_t cl_tchunk;		/* First type chunk.  */
+  uint32_t cl_ntchunks;		/* Number of type chunks.  */
+  uint32_t cl_ntypes;		/* Number of types.  */
+  uint32_t cl_all;		/* Nonzero while every chunk is loaded.  */
+  uint32_t cl_names;		/* Nonzero while the name hashes are built.  */
+};
+
+/* State shared between the threads inflating a chunked container.  */
+
+typedef struct ctf_inflate
+{
+  ctf_lazy_t *ci_lz;		/* Chunks to inflate.  */
+  unsigned char *ci_buf;	/* Uncompressed buffer.  */
+  int ci_types;			/* Nonzero if inflating type chunks too.  */
+  uint32_t ci_next;		/* Next chunk to inflate.  */
+  int ci_err;			/* First error seen.  */
+} ctf_inflate_t;
+
+/* Inflate the part of the compressed stream of partial chunk C that it
+   describes into BUF, discarding the CLC_SKIP bytes that precede it.  */
+
+static int
+ctf_chunk_inflate_skip (const ctf_lzchunk_t *c, unsigned char *buf)
+{
+  unsigned char discard[16384];
+  size_t want = c->clc_skip + c->clc_size;
+  z_stream zs;
+  int rc;
+
+  memset (&zs, 0, sizeof (z_stream));
+  zs.next_in = (unsigned char *) c->clc_src;
+  zs.avail_in = c->clc_len;
+
+  if ((rc = inflateInit (&zs)) != Z_OK)
+    {
+      ctf_dprintf ("zlib inflate init err: %s\n", zError (rc));
+      return ECTF_ZALLOC;
+    }
+
+  while (zs.total_out < want)
+    {
+      if (zs.total_out < c->clc_skip)
+	{
+	  zs.next_out = discard;
+	  zs.avail_out = sizeof (discard);
+	  if (zs.avail_out > c->clc_skip - zs.total_out)
+	    zs.avail_out = c->clc_skip - zs.total_out;
+	}
+      else
+	{
+	  zs.next_out = buf + c->clc_off + (zs.total_out - c->clc_skip);
+	  zs.avail_out = want - zs.total_out;
+	}
+
+      if ((rc = inflate (&zs, Z_NO_FLUSH)) != Z_OK)
+	break;
+    }
+
+  (void) inflateEnd (&zs);
+
+  if (zs.total_out < want)
+    {
+      ctf_dprintf ("zlib inflate err in chunk at %lu: %s\n",
+		   (unsigned long) c->clc_off,
+		   rc == Z_STREAM_END ? "short" : zError (rc));
+      return rc == Z_STREAM_END ? ECTF_CORRUPT : ECTF_DECOMPRESS;
+    }
+
+  return 0;
+}
+
+/* Inflate chunk C into BUF.  Returns zero or an errno value.  */
+
+static int
+ctf_chunk_inflate (const ctf_lzchunk_t *c, unsigned char *buf)
+{
+  uLongf got = c->clc_size;
+  int rc;
+
+  if (c->clc_partial)
+    return ctf_chunk_inflate_skip (c, buf);
+
+  if ((rc = uncompress (buf + c->clc_off, &got, c->clc_src,
+			c->clc_len)) != Z_OK)
+    {
+      ctf_dprintf ("zlib inflate err in chunk at %lu: %s\n",
+		   (unsigned long) c->clc_off, zError (rc));
+      return ECTF_DECOMPRESS;
+    }
+
+  if (got != c->clc_size)
+    {
+      ctf_dprintf ("zlib inflate short in chunk at %lu -- got %lu of %lu "
+		   "bytes\n", (unsigned long) c->clc_off, (unsigned long) got,
+		   (unsigned long) c->clc_size);
+      return ECTF_CORRUPT;
+    }
+
+  return 0;
+}
+
+/* Inflate chunks until there are none left or something goes wrong.  Run
+   concurrently by as many threads as are inflating this container.  */
+
+static void *
+ctf_inflate_chunks (void *arg)
+{
+  ctf_inflate_t *ci = arg;
+  ctf_lazy_t *lz = ci->ci_lz;
+  uint32_t i;
+
+  while ((i = __atomic_fetch_add (&ci->ci_next, 1, __ATOMIC_RELAXED))
+	 < lz->cl_nchunks)
+    {
+      ctf_lzchunk_t *c = &lz->cl_chunks[i];
+      int err, noerr = 0;
+
+      if (__atomic_load_n (&ci->ci_err, __ATOMIC_RELAXED) != 0)
+	break;
+
+      if (c->clc_type != 0 && !ci->ci_types)
+	continue;
+
+      if ((err = ctf_chunk_inflate (c, ci->ci_buf)) != 0)
+	__atomic_compare_exchange_n (&ci->ci_err, &noerr, err, 0,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+      else
+	c->clc_loaded = 1;
+    }
+
+  return NULL;
+}
+
+/* Allocate lazy-loading state with room for NCHUNKS chunks.  */
+
+static ctf_lazy_t *
+ctf_lazy_alloc (uint32_t nchunks)
+{
+  ctf_lazy_t *lz;
+
+  if ((lz = ctf_alloc (sizeof (ctf_lazy_t))) == NULL)
+    return NULL;
+
+  memset (lz, 0, sizeof (ctf_lazy_t));
+  if ((lz->cl_chunks = calloc (nchunks + 1, sizeof (ctf_lzchunk_t))) == NULL)
+    {
+      ctf_free (lz, sizeof (ctf_lazy_t));
+      return NULL;
+    }
+  pthread_mutex_init (&lz->cl_lock, NULL);
+  return lz;
+}
+
+/* Describe the data of the container with header HP, whose SRCLEN bytes of
+   data following the header are at SRC, in *LZP.  The chunk index of a
+   chunked container is read and checked; any other container is left to the
+   caller to inflate and index in full, and its type section, if compressed,
+   becomes a single partial chunk that can be inflated again after eviction.
+   Returns zero or an errno value.  */
+
+int
+ctf_lazy_create (const ctf_header_t *hp, const void *src, size_t srclen,
+		 ctf_lazy_t **lzp)
+{
+  const unsigned char *s = src;
+  size_t size = hp->cth_stroff + hp->cth_strlen;
+  size_t hdrlen, off = 0, coff = 0;
+  ctf_chunkidx_t idx;
+  ctf_lazy_t *lz;
+  uint32_t i, ntype = 1;
+
+  if (!(hp->cth_flags & CTF_F_CHUNKED))
+    {
+      if ((lz = ctf_lazy_alloc (1)) == NULL)
+	return ENOMEM;
+
+      if ((hp->cth_flags & CTF_F_COMPRESS)
+	  && hp->cth_typeoff < hp->cth_stroff)
+	{
+	  ctf_lzchunk_t *c = &lz->cl_chunks[0];
+
+	  c->clc_src = s;
+	  c->clc_len = srclen;
+	  c->clc_size = hp->cth_stroff - hp->cth_typeoff;
+	  c->clc_off = hp->cth_typeoff;
+	  c->clc_skip = hp->cth_typeoff;
+	  c->clc_partial = 1;
+	  c->clc_type = 1;
+	  c->clc_loaded = 1;
+	  c->clc_xlated = 1;
+	  lz->cl_nchunks = 1;
+	  lz->cl_ntchunks = 1;
+	}
+      lz->cl_all = 1;
+      lz->cl_names = 1;
+
+      *lzp = lz;
+      return 0;
+    }
+
+  if (srclen < sizeof (ctf_chunkidx_t))
+    return ECTF_CORRUPT;
+
+  memcpy (&idx, s, sizeof (ctf_chunkidx_t));
+
+  if (idx.ctc_nchunks > (srclen - sizeof (ctf_chunkidx_t))
+      / sizeof (ctf_chunk_t))
+    return ECTF_CORRUPT;
+  hdrlen = sizeof (ctf_chunkidx_t) + idx.ctc_nchunks * sizeof (ctf_chunk_t);
+
+  if ((lz = ctf_lazy_alloc (idx.ctc_nchunks)) == NULL)
+    return ENOMEM;
+
+  lz->cl_nchunks = idx.ctc_nchunks;
+  lz->cl_ntypes = idx.ctc_ntypes;
+
+  /* The chunks must tile the data exactly, and must not span the start or
+     end of the type section.  Type chunks must start with consecutive types,
+     ending with the last one; all other chunks must say they have none.  */
+
+  for (i = 0; i < idx.ctc_nchunks; i++)
+    {
+      ctf_lzchunk_t *c = &lz->cl_chunks[i];
+      ctf_chunk_t ck;
+      int intypes = off >= hp->cth_typeoff && off < hp->cth_stroff;
+
+      memcpy (&ck, s + sizeof (ctf_chunkidx_t) + i * sizeof (ctf_chunk_t),
+	      sizeof (ctf_chunk_t));
+
+      c->clc_src = s + hdrlen + coff;
+      c->clc_len = ck.ctk_len;
+      c->clc_size = ck.ctk_size;
+      c->clc_off = off;
+      c->clc_type = ck.ctk_type;
+
+      if (ck.ctk_size == 0 || ck.ctk_len > srclen - hdrlen - coff
+	  || ck.ctk_size > size - off
+	  || (off < hp->cth_typeoff && off + ck.ctk_size > hp->cth_typeoff)
+	  || (intypes && off + ck.ctk_size > hp->cth_stroff)
+	  || (intypes ? ck.ctk_type < ntype || ck.ctk_type > idx.ctc_ntypes
+	      : ck.ctk_type != 0))
+	goto corrupt;
+
+      if (intypes)
+	{
+	  if (lz->cl_ntchunks++ == 0)
+	    {
+	      if (ck.ctk_type != 1)
+		goto corrupt;
+	      lz->cl_tchunk = i;
+	    }
+	  ntype = ck.ctk_type + 1;
+	}
+
+      off += ck.ctk_size;
+      coff += ck.ctk_len;
+    }
+
+  if (off != size || (lz->cl_ntchunks == 0) != (idx.ctc_ntypes == 0))
+    goto corrupt;
+
+  *lzp = lz;
+  return 0;
+
+corrupt:
+  ctf_lazy_destroy (lz);
+  return ECTF_CORRUPT;
+}
+
+/* Inflate the chunks described by LZ into BUF, using multiple threads if there
+   are multiple chunks.  The type chunks are only inflated if TYPES is set.
+   Returns zero or an errno value.  */
+
+int
+ctf_lazy_inflate (ctf_lazy_t *lz, unsigned char *buf, int types)
+{
+  pthread_t threads[CTF_INFLATE_THREADS];
+  ctf_inflate_t ci;
+  uint32_t n = types ? lz->cl_nchunks : lz->cl_nchunks - lz->cl_ntchunks;
+  long ncpus;
+  int nthreads = 0;
+  int j;
+
+  ci.ci_lz = lz;
+  ci.ci_buf = buf;
+  ci.ci_types = types;
+  ci.ci_next = 0;
+  ci.ci_err = 0;
+
+  /* This thread inflates chunks too, so it needs at most one helper per
+     additional chunk or CPU.  If we cannot create a helper, we just make do
+     with fewer.  */
+
+  ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+  while (nthreads < CTF_INFLATE_THREADS && nthreads + 1 < ncpus
+	 && nthreads + 1 < (long) n)
+    {
+      if (pthread_create (&threads[nthreads], NULL, ctf_inflate_chunks,
+			  &ci) != 0)
+	break;
+      nthreads++;
+    }
+
+  (void) ctf_inflate_chunks (&ci);
+
+  for (j = 0; j < nthreads; j++)
+    (void) pthread_join (threads[j], NULL);
+
+  if (types || lz->cl_ntchunks == 0)
+    lz->cl_all = 1;
+  return ci.ci_err;
+}
+
+/* Return the number of types in the container described by LZ.  */
+
+uint32_t
+ctf_lazy_ntypes (const ctf_lazy_t *lz)
+{
+  return lz->cl_ntypes;
+}
+
+void
+ctf_lazy_destroy (ctf_lazy_t *lz)
+{
+  if (lz == NULL)
+    return;
+
+  pthread_mutex_destroy (&lz->cl_lock);
+  free (lz->cl_chunks);
+  ctf_free (lz, sizeof (ctf_lazy_t));
+}
+
+/* Fill in the type translation table for the types in the newly-inflated type
+   chunk C of FP, which runs up to but not including type NEXT.  */
+
+static int
+ctf_lazy_xlate (ctf_file_t *fp, const ctf_lzchunk_t *c, uint32_t next)
+{
+  const unsigned char *p = fp->ctf_buf + c->clc_off;
+  const unsigned char *end = p + c->clc_size;
+  uint32_t id;
+
+  for (id = c->clc_type; p < end; id++)
+    {
+      const ctf_type_t *tp = (const ctf_type_t *) p;
+      ssize_t size, increment, vbytes;
+
+      if (id >= next || (size_t) (end - p) < sizeof (ctf_stype_t))
+	return ECTF_CORRUPT;
+
+      (void) ctf_get_ctt_size (fp, tp, &size, &increment);
+      vbytes = LCTF_VBYTES (fp, LCTF_INFO_KIND (fp, tp->ctt_info), size,
+			    LCTF_INFO_VLEN (fp, tp->ctt_info));
+
+      if (vbytes < 0 || (size_t) (end - p) < (size_t) (increment + vbytes))
+	return ECTF_CORRUPT;
+
+      fp->ctf_txlate[id] = (uint32_t) (p - fp->ctf_buf);
+      p += increment + vbytes;
+    }
+
+  if (id != next)
+    return ECTF_CORRUPT;
+
+  return 0;
+}
+
+/* Inflate type chunk I of FP, if no other thread has got there first.  */
+
+static int
+ctf_lazy_load_chunk (ctf_file_t *fp, uint32_t i)
+{
+  ctf_lazy_t *lz = fp->ctf_lazy;
+  ctf_lzchunk_t *c = &lz->cl_chunks[i];
+  size_t loaded = 0;
+  uint32_t next;
+  int err = 0;
+
+  pthread_mutex_lock (&lz->cl_lock);
+  if (!c->clc_loaded)
+    {
+      if (i + 1 < lz->cl_tchunk + lz->cl_ntchunks)
+	next = c[1].clc_type;
+      else
+	next = lz->cl_ntypes + 1;
+
+      ctf_dprintf ("Loading types %u-%u of %p\n", c->clc_type, next - 1,
+		   (void *) fp);
+
+      if ((err = ctf_chunk_inflate (c, (unsigned char *) fp->ctf_buf)) == 0
+	  && (c->clc_xlated || (err = ctf_lazy_xlate (fp, c, next)) == 0))
+	{
+	  c->clc_xlated = 1;
+	  __atomic_store_n (&c->clc_loaded, 1, __ATOMIC_RELEASE);
+	  loaded = c->clc_size;
+	}
+    }
+  pthread_mutex_unlock (&lz->cl_lock);
+
+  if (loaded != 0)
+    ctf_resid_add (fp, loaded);
+
+  return err;
+}
+
+/* Make sure that the type with index IDX in FP is loaded, so that its type
+   translation table entry and type data can be used.  Returns zero or an
+   errno value.  */
+
+int
+ctf_lazy_load (ctf_file_t *fp, unsigned long idx)
+{
+  ctf_lazy_t *lz = fp->ctf_lazy;
+  uint32_t lo, hi;
+
+  if (lz == NULL || __atomic_load_n (&lz->cl_all, __ATOMIC_ACQUIRE))
+    return 0;
+
+  /* Find the last type chunk starting at or before IDX.  */
+
+  lo = lz->cl_tchunk;
+  hi = lo + lz->cl_ntchunks;
+  while (hi - lo > 1)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+
+      if (lz->cl_chunks[mid].clc_type <= idx)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  if (__atomic_load_n (&lz->cl_chunks[lo].clc_loaded, __ATOMIC_ACQUIRE))
+    return 0;
+
+  return ctf_lazy_load_chunk (fp, lo);
+}
+
+/* Make sure that every type in FP is loaded.  Returns zero or an errno
+   value.  */
+
+int
+ctf_lazy_load_all (ctf_file_t *fp)
+{
+  ctf_lazy_t *lz = fp->ctf_lazy;
+  uint32_t i;
+  int err;
+
+  if (lz == NULL || __atomic_load_n (&lz->cl_all, __ATOMIC_ACQUIRE))
+    return 0;
+
+  for (i = lz->cl_tchunk; i < lz->cl_tchunk + lz->cl_ntchunks; i++)
+    if (!__atomic_load_n (&lz->cl_chunks[i].clc_loaded, __ATOMIC_ACQUIRE)
+	&& (err = ctf_lazy_load_chunk (fp, i)) != 0)
+      return err;
+
+  __atomic_store_n (&lz->cl_all, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Return the number of bytes taken up by the name hashes and pointer table
+   of FP.  */
+
+static size_t
+ctf_names_size (const ctf_file_t *fp)
+{
+  const ctf_hash_t *hashes[] = { &fp->ctf_structs, &fp->ctf_unions,
+				 &fp->ctf_enums, &fp->ctf_names };
+  size_t size = sizeof (uint32_t) * (fp->ctf_typemax + 1);
+  size_t i;
+
+  for (i = 0; i < sizeof (hashes) / sizeof (hashes[0]); i++)
+    size += sizeof (unsigned short) * hashes[i]->h_nbuckets
+      + sizeof (ctf_helem_t) * hashes[i]->h_nelems
+      + sizeof (uint64_t) * hashes[i]->h_bloom.cb_nwords;
+
+  return size;
+}
+
+/* Make sure that the name hashes and pointer table of FP are built.  Returns
+   zero or an errno value.  */
+
+int
+ctf_lazy_names (ctf_file_t *fp)
+{
+  ctf_lazy_t *lz = fp->ctf_lazy;
+  size_t built = 0;
+  int err;
+
+  if (lz == NULL || __atomic_load_n (&lz->cl_names, __ATOMIC_ACQUIRE))
+    return 0;
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    return err;
+
+  pthread_mutex_lock (&lz->cl_lock);
+  if (!lz->cl_names)
+    {
+      if ((err = ctf_init_names (fp)) == 0)
+	{
+	  __atomic_store_n (&lz->cl_names, 1, __ATOMIC_RELEASE);
+	  built = ctf_names_size (fp);
+	}
+      else
+	ctf_fini_names (fp);
+    }
+  pthread_mutex_unlock (&lz->cl_lock);
+
+  if (built != 0)
+    ctf_resid_add (fp, built);
+
+  return err;
+}
+
+/* Return the number of bytes of the state of FP that ctf_lazy_evict() can
+   free and that is currently in memory.  */
+
+size_t
+ctf_lazy_resident (ctf_file_t *fp)
+{
+  ctf_lazy_t *lz = fp->ctf_lazy;
+  size_t size = 0;
+  uint32_t i;
+
+  pthread_mutex_lock (&lz->cl_lock);
+  if (lz->cl_names)
+    size += ctf_names_size (fp);
+
+  for (i = lz->cl_tchunk; i < lz->cl_tchunk + lz->cl_ntchunks; i++)
+    if (lz->cl_chunks[i].clc_loaded)
+      size += lz->cl_chunks[i].clc_size;
+  pthread_mutex_unlock (&lz->cl_lock);
+
+  return size;
+}
+
+/* Free the name hashes and pointer table of FP, and the memory holding its
+   inflated type chunks, all of which will be rebuilt or inflated again when
+   next needed.  Called by ctf_resid_evict() only when nothing holds FP, so
+   nothing should be loading: returns EBUSY, freeing nothing, if something
+   is regardless.  */
+
+int
+ctf_lazy_evict (ctf_file_t *fp)
+{
+  ctf_lazy_t *lz = fp->ctf_lazy;
+  uint32_t i;
+
+  if (pthread_mutex_trylock (&lz->cl_lock) != 0)
+    return EBUSY;
+
+  if (lz->cl_names)
+    {
+      ctf_fini_names (fp);
+      __atomic_store_n (&lz->cl_names, 0, __ATOMIC_RELAXED);
+    }
+
+  for (i = lz->cl_tchunk; i < lz->cl_tchunk + lz->cl_ntchunks; i++)
+    {
+      ctf_lzchunk_t *c = &lz->cl_chunks[i];
+
+      if (c->clc_loaded)
+	{
+	  ctf_data_discard ((unsigned char *) fp->ctf_buf + c->clc_off,
+			    c->clc_size);
+	  __atomic_store_n (&c->clc_loaded, 0, __ATOMIC_RELAXED);
+	  __atomic_store_n (&lz->cl_all, 0, __ATOMIC_RELAXED);
+	}
+    }
+
+  pthread_mutex_unlock (&lz->cl_lock);
+  return 0;
+}
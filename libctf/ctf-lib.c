@@ -154,7 +154,7 @@ ctf_fdopen (int fd, int *errp)
       ctfsect.cts_entsize = 1;
       ctfsect.cts_offset = 0;
 
-      if ((fp = ctf_bufopen (&ctfsect, NULL, NULL, errp)) == NULL)
+      if ((fp = ctf_bufopen_lazy (&ctfsect, NULL, NULL, errp)) == NULL)
 	ctf_sect_munmap (&ctfsect);
 
       return fp;
@@ -323,10 +323,10 @@ ctf_fdopen (int fd, int *errp)
 	      (void) ctf_set_open_errno (errp, ECTF_MMAP);
 	      goto bad;
 	    }
-	  fp = ctf_bufopen (&ctfsect, &symsect, &strsect, errp);
+	  fp = ctf_bufopen_lazy (&ctfsect, &symsect, &strsect, errp);
 	}
       else
-	fp = ctf_bufopen (&ctfsect, NULL, NULL, errp);
+	fp = ctf_bufopen_lazy (&ctfsect, NULL, NULL, errp);
 
     bad:
       /* Unmap all and abort.  */
@@ -367,14 +367,201 @@ ctf_open (const char *filename, int *errp)
   return fp;
 }
 
+/* Write all of BUF to FD, returning zero or an errno value.  */
+
+int
+ctf_write_fd (int fd, const void *buf, size_t len)
+{
+  const unsigned char *bp = buf;
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = write (fd, bp, len)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno;
+	}
+      len -= n;
+      bp += n;
+    }
+
+  return 0;
+}
+
+/* Output sinks.  A sink accepts serialized CTF data in pieces of arbitrary size
+   and stages it in a buffer.  A memory sink's buffer is the final destination;
+   a file sink writes its buffer to a file descriptor (through deflate, if
+   compressing) whenever it fills, so the serialized data never needs to be
+   held in memory all at once.  */
+
+#define CTF_SINK_BUFSIZ (64 * 1024)
+
+void
+ctf_sink_init_mem (ctf_sink_t *sp, void *buf, size_t size)
+{
+  memset (sp, 0, sizeof (ctf_sink_t));
+  sp->cs_buf = buf;
+  sp->cs_size = size;
+  sp->cs_fd = -1;
+}
+
+/* Initialize a sink writing to FD, compressing with the given zlib LEVEL and
+   STRATEGY if COMPRESS is set.  Returns zero or an errno value.  */
+
+int
+ctf_sink_init_fd (ctf_sink_t *sp, int fd, int compress, int level,
+		  int strategy)
+{
+  int rc;
+
+  memset (sp, 0, sizeof (ctf_sink_t));
+  sp->cs_fd = fd;
+  sp->cs_size = CTF_SINK_BUFSIZ;
+
+  if ((sp->cs_buf = ctf_alloc (sp->cs_size)) == NULL)
+    return EAGAIN;
+
+  if (!compress)
+    return 0;
+
+  if ((sp->cs_zs = ctf_alloc (sizeof (z_stream))) == NULL
+      || (sp->cs_zbuf = ctf_alloc (CTF_SINK_BUFSIZ)) == NULL)
+    goto zerr;
+
+  memset (sp->cs_zs, 0, sizeof (z_stream));
+  /* The window and memory levels are zlib's defaults.  */
+  if ((rc = deflateInit2 (sp->cs_zs, level, Z_DEFLATED, MAX_WBITS, 8,
+			  strategy)) != Z_OK)
+    {
+      ctf_dprintf ("zlib deflate init err: %s\n", zError (rc));
+      goto zerr;
+    }
+  sp->cs_zinit = 1;
+
+  return 0;
+
+zerr:
+  (void) ctf_sink_fini (sp, ECTF_ZALLOC);
+  return ECTF_ZALLOC;
+}
+
+/* Drain the staging buffer, finishing the deflate stream if FINAL.  */
+
+static int
+ctf_sink_flush (ctf_sink_t *sp, int final)
+{
+  z_stream *zs = sp->cs_zs;
+  int rc, err;
+
+  if (sp->cs_fd < 0)
+    return 0;
+
+  if (zs == NULL)
+    {
+      err = ctf_write_fd (sp->cs_fd, sp->cs_buf, sp->cs_pos);
+      sp->cs_pos = 0;
+      return err;
+    }
+
+  zs->next_in = sp->cs_buf;
+  zs->avail_in = sp->cs_pos;
+
+  do
+    {
+      zs->next_out = sp->cs_zbuf;
+      zs->avail_out = CTF_SINK_BUFSIZ;
+
+      rc = deflate (zs, final ? Z_FINISH : Z_NO_FLUSH);
+      if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+	{
+	  ctf_dprintf ("zlib deflate err: %s\n", zError (rc));
+	  return ECTF_COMPRESS;
+	}
+
+      if ((err = ctf_write_fd (sp->cs_fd, sp->cs_zbuf,
+			       CTF_SINK_BUFSIZ - zs->avail_out)) != 0)
+	return err;
+    }
+  while (final ? rc != Z_STREAM_END : zs->avail_out == 0);
+
+  sp->cs_pos = 0;
+  return 0;
+}
+
+/* Append LEN bytes of DATA to the sink.  Returns zero or an errno value.  */
+
+int
+ctf_sink_write (ctf_sink_t *sp, const void *data, size_t len)
+{
+  const unsigned char *dp = data;
+
+  while (len > 0)
+    {
+      size_t n = sp->cs_size - sp->cs_pos;
+      int err;
+
+      if (n == 0)
+	{
+	  if (sp->cs_fd < 0)
+	    return EOVERFLOW;		/* Memory sinks cannot grow.  */
+
+	  if ((err = ctf_sink_flush (sp, 0)) != 0)
+	    return err;
+	  continue;
+	}
+
+      if (n > len)
+	n = len;
+
+      memcpy (sp->cs_buf + sp->cs_pos, dp, n);
+      sp->cs_pos += n;
+      dp += n;
+      len -= n;
+    }
+
+  return 0;
+}
+
+/* Finish with a sink, writing out everything still staged unless ERR is
+   already set, and free its resources.  Returns ERR, or any error flushing the
+   sink.  */
+
+int
+ctf_sink_fini (ctf_sink_t *sp, int err)
+{
+  if (err == 0)
+    err = ctf_sink_flush (sp, 1);
+
+  if (sp->cs_fd < 0)
+    return err;
+
+  if (sp->cs_zinit)
+    (void) deflateEnd (sp->cs_zs);
+  if (sp->cs_zs != NULL)
+    ctf_free (sp->cs_zs, sizeof (z_stream));
+  if (sp->cs_zbuf != NULL)
+    ctf_free (sp->cs_zbuf, CTF_SINK_BUFSIZ);
+  if (sp->cs_buf != NULL)
+    ctf_free (sp->cs_buf, sp->cs_size);
+
+  memset (sp, 0, sizeof (ctf_sink_t));
+  return err;
+}
+
 /* Write the compressed CTF data stream to the specified gzFile descriptor.
    This is useful for saving the results of dynamic CTF containers.  */
-int
-ctf_gzwrite (ctf_file_t *fp, gzFile fd)
+static int
+ctf_gzwrite_held (ctf_file_t *fp, gzFile fd)
 {
   const unsigned char *buf = fp->ctf_base;
   ssize_t resid = fp->ctf_size;
   ssize_t len;
+  int err;
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    return (ctf_set_errno (fp, err));
 
   while (resid != 0)
     {
@@ -387,74 +574,298 @@ ctf_gzwrite (ctf_file_t *fp, gzFile fd)
   return 0;
 }
 
+int
+ctf_gzwrite (ctf_file_t *fp, gzFile fd)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_gzwrite_held (fp, fd);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Compress the specified CTF data stream and write it to the specified file
    descriptor.  */
+static int
+ctf_compress_write_held (ctf_file_t *fp, int fd)
+{
+  ctf_header_t h;
+  ctf_sink_t sink;
+  size_t header_len = sizeof (ctf_header_t);
+  int err;
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  memcpy (&h, fp->ctf_base, header_len);
+  h.cth_flags |= CTF_F_COMPRESS;
+
+  /* The header is written uncompressed, then the rest is deflated and written
+     out a chunk at a time, so we never hold more than a chunk of compressed
+     data in memory.  */
+
+  if ((err = ctf_write_fd (fd, &h, header_len)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  if ((err = ctf_sink_init_fd (&sink, fd, 1, fp->ctf_zlevel,
+			       fp->ctf_zstrategy)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  err = ctf_sink_write (&sink, fp->ctf_base + header_len,
+			fp->ctf_size - header_len);
+
+  if ((err = ctf_sink_fini (&sink, err)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  return 0;
+}
+
 int
 ctf_compress_write (ctf_file_t *fp, int fd)
 {
-  unsigned char *buf;
-  unsigned char *bp;
-  ctf_header_t h;
-  ctf_header_t *hp = &h;
-  ssize_t header_len = sizeof (ctf_header_t);
-  ssize_t compress_len;
-  size_t max_compress_len = compressBound (fp->ctf_size - header_len);
-  ssize_t len;
   int rc;
-  int err = 0;
 
-  memcpy (hp, fp->ctf_base, header_len);
-  hp->cth_flags |= CTF_F_COMPRESS;
+  ctf_resid_hold (fp);
+  rc = ctf_compress_write_held (fp, fd);
+  ctf_resid_release (fp);
+  return rc;
+}
 
-  if ((buf = ctf_data_alloc (max_compress_len)) == MAP_FAILED)
-    return (ctf_set_errno (fp, ECTF_ZALLOC));
+/* Append a chunk of SIZE uncompressed bytes starting with type TYPE (or zero,
+   outside the type section) to the N chunks in CHUNKS, if non-NULL.  */
 
-  compress_len = max_compress_len;
-  if ((rc = compress (buf, (uLongf *) & compress_len,
-		      fp->ctf_base + header_len,
-		      fp->ctf_size - header_len)) != Z_OK)
+static size_t
+ctf_chunk_add (ctf_chunk_t *chunks, size_t n, size_t size, uint32_t type)
+{
+  if (chunks != NULL)
     {
-      ctf_dprintf ("zlib deflate err: %s\n", zError (rc));
-      err = ctf_set_errno (fp, ECTF_COMPRESS);
-      goto ret;
+      chunks[n].ctk_len = 0;
+      chunks[n].ctk_size = size;
+      chunks[n].ctk_type = type;
     }
+  return n + 1;
+}
+
+/* Append chunks of at most CHUNKSZ bytes covering LEN bytes outside the type
+   section to the N chunks in CHUNKS, if non-NULL.  */
 
-  while (header_len > 0)
+static size_t
+ctf_chunk_split (ctf_chunk_t *chunks, size_t n, size_t len, size_t chunksz)
+{
+  while (len > 0)
     {
-      if ((len = write (fd, hp, header_len)) < 0)
+      size_t size = MIN (len, chunksz);
+
+      n = ctf_chunk_add (chunks, n, size, 0);
+      len -= size;
+    }
+  return n;
+}
+
+/* Divide the data of FP into chunks of about CHUNKSZ uncompressed bytes, with
+   the type section in chunks of its own, split only between types.  Fill in
+   CHUNKS, if non-NULL, and return the number of chunks.  */
+
+static size_t
+ctf_chunk_plan (ctf_file_t *fp, size_t chunksz, ctf_chunk_t *chunks)
+{
+  const ctf_header_t *hp = (const ctf_header_t *) fp->ctf_base;
+  size_t n, start = hp->cth_typeoff;
+  uint32_t first = 1;
+  unsigned long id;
+
+  n = ctf_chunk_split (chunks, 0, hp->cth_typeoff, chunksz);
+
+  for (id = 2; id <= fp->ctf_typemax; id++)
+    {
+      if (fp->ctf_txlate[id] - start >= chunksz)
 	{
-	  err = ctf_set_errno (fp, errno);
-	  goto ret;
+	  n = ctf_chunk_add (chunks, n, fp->ctf_txlate[id] - start, first);
+	  start = fp->ctf_txlate[id];
+	  first = id;
 	}
-      header_len -= len;
-      hp += len;
     }
 
-  bp = buf;
-  while (compress_len > 0)
+  if (fp->ctf_typemax > 0)
+    n = ctf_chunk_add (chunks, n, hp->cth_stroff - start, first);
+
+  return ctf_chunk_split (chunks, n, hp->cth_strlen, chunksz);
+}
+
+/* Write the compressed CTF data stream to the specified file descriptor in
+   independently-compressed chunks of about CHUNKSZ uncompressed bytes each (or
+   a default size if zero), so that ctf_bufopen() can inflate them in parallel
+   and ctf_open() can inflate the types in them as they are needed.  Chunks are
+   streamed out one at a time: only their lengths are kept, and written into
+   the chunk index when they are all done, so FD must be seekable.  */
+
+#define CTF_CHUNKSZ_DEFAULT (1024 * 1024)
+
+static int
+ctf_compress_write_chunked_held (ctf_file_t *fp, int fd, size_t chunksz)
+{
+  ctf_header_t h;
+  ctf_chunkidx_t idx;
+  ctf_chunk_t *chunks = NULL;
+  ctf_sink_t sink;
+  size_t header_len = sizeof (ctf_header_t);
+  const unsigned char *src = fp->ctf_base + header_len;
+  size_t nchunks = 0, i;
+  off_t idxoff, pos, end;
+  int err;
+
+  if (chunksz == 0)
+    chunksz = CTF_CHUNKSZ_DEFAULT;
+
+  if (chunksz > UINT32_MAX)
+    return (ctf_set_errno (fp, EINVAL));
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    return (ctf_set_errno (fp, err));
+
+  if ((nchunks = ctf_chunk_plan (fp, chunksz, NULL)) > UINT32_MAX)
+    return (ctf_set_errno (fp, EINVAL));
+
+  /* An empty container has no chunks: avoid zero-sized allocations.  */
+
+  if ((chunks = ctf_alloc (nchunks * sizeof (ctf_chunk_t) + 1)) == NULL)
+    return (ctf_set_errno (fp, ENOMEM));
+
+  (void) ctf_chunk_plan (fp, chunksz, chunks);
+
+  memcpy (&h, fp->ctf_base, header_len);
+  h.cth_flags |= CTF_F_COMPRESS | CTF_F_CHUNKED;
+  idx.ctc_nchunks = nchunks;
+  idx.ctc_ntypes = fp->ctf_typemax;
+
+  /* Write the header and a placeholder chunk index, then each chunk as a
+     complete zlib stream, measuring how long each one turned out to be.  */
+
+  if ((err = ctf_write_fd (fd, &h, header_len)) != 0
+      || (err = ctf_write_fd (fd, &idx, sizeof (idx))) != 0)
+    goto err;
+
+  if ((idxoff = lseek (fd, 0, SEEK_CUR)) < 0)
     {
-      if ((len = write (fd, bp, compress_len)) < 0)
+      err = errno;
+      goto err;
+    }
+
+  if ((err = ctf_write_fd (fd, chunks, nchunks * sizeof (ctf_chunk_t))) != 0)
+    goto err;
+  end = idxoff + nchunks * sizeof (ctf_chunk_t);
+
+  for (i = 0; i < nchunks; i++)
+    {
+      if ((err = ctf_sink_init_fd (&sink, fd, 1, fp->ctf_zlevel,
+				   fp->ctf_zstrategy)) != 0)
+	goto err;
+
+      err = ctf_sink_write (&sink, src, chunks[i].ctk_size);
+
+      if ((err = ctf_sink_fini (&sink, err)) != 0)
+	goto err;
+
+      if ((pos = lseek (fd, 0, SEEK_CUR)) < 0)
 	{
-	  err = ctf_set_errno (fp, errno);
-	  goto ret;
+	  err = errno;
+	  goto err;
 	}
-      compress_len -= len;
-      bp += len;
+
+      if (pos - end > UINT32_MAX)
+	{
+	  err = EOVERFLOW;
+	  goto err;
+	}
+
+      chunks[i].ctk_len = pos - end;
+      src += chunks[i].ctk_size;
+      end = pos;
     }
 
-ret:
-  ctf_data_free (buf, max_compress_len);
-  return err;
+  /* Now go back and fill in the chunk lengths.  */
+
+  if (lseek (fd, idxoff, SEEK_SET) < 0
+      || (err = ctf_write_fd (fd, chunks,
+			      nchunks * sizeof (ctf_chunk_t))) != 0
+      || lseek (fd, end, SEEK_SET) < 0)
+    {
+      if (err == 0)
+	err = errno;
+      goto err;
+    }
+
+  ctf_free (chunks, nchunks * sizeof (ctf_chunk_t) + 1);
+  return 0;
+
+err:
+  ctf_free (chunks, nchunks * sizeof (ctf_chunk_t) + 1);
+  return (ctf_set_errno (fp, err));
+}
+
+int
+ctf_compress_write_chunked (ctf_file_t *fp, int fd, size_t chunksz)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_compress_write_chunked_held (fp, fd, chunksz);
+  ctf_resid_release (fp);
+  return rc;
+}
+
+/* Set the zlib compression level and strategy used when this container is
+   written out compressed, by ctf_compress_write(), by
+   ctf_compress_serialize_to_fd(), or as a member of an archive.  LEVEL is
+   Z_DEFAULT_COMPRESSION or from 0 (none) to 9 (best); STRATEGY is one of
+   zlib's Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or Z_FIXED.  */
+int
+ctf_setcompression (ctf_file_t *fp, int level, int strategy)
+{
+  if (level != Z_DEFAULT_COMPRESSION
+      && (level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION))
+    return (ctf_set_errno (fp, EINVAL));
+
+  switch (strategy)
+    {
+    case Z_DEFAULT_STRATEGY:
+    case Z_FILTERED:
+    case Z_HUFFMAN_ONLY:
+    case Z_RLE:
+    case Z_FIXED:
+      break;
+    default:
+      return (ctf_set_errno (fp, EINVAL));
+    }
+
+  fp->ctf_zlevel = level;
+  fp->ctf_zstrategy = strategy;
+  return 0;
+}
+
+/* Return the compression level and strategy set by ctf_setcompression().  */
+void
+ctf_getcompression (ctf_file_t *fp, int *level, int *strategy)
+{
+  if (level != NULL)
+    *level = fp->ctf_zlevel;
+  if (strategy != NULL)
+    *strategy = fp->ctf_zstrategy;
 }
 
 /* Write the uncompressed CTF data stream to the specified file descriptor.
    This is useful for saving the results of dynamic CTF containers.  */
-int
-ctf_write (ctf_file_t *fp, int fd)
+static int
+ctf_write_held (ctf_file_t *fp, int fd)
 {
   const unsigned char *buf = fp->ctf_base;
   ssize_t resid = fp->ctf_size;
   ssize_t len;
+  int err;
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    return (ctf_set_errno (fp, err));
 
   while (resid != 0)
     {
@@ -467,6 +878,17 @@ ctf_write (ctf_file_t *fp, int fd)
   return 0;
 }
 
+int
+ctf_write (ctf_file_t *fp, int fd)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_write_held (fp, fd);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Set the CTF library client version to the specified version.  If version is
    zero, we just return the default library version number.  */
 int
@@ -9,6 +9,7 @@
 
 #include <gelf.h>
 #include <string.h>
+#include <fnmatch.h>
 #include <ctf-impl.h>
 
 /* Compare the given input string and length against a table of known C storage
@@ -58,8 +59,8 @@ isqualifier (const char *s, size_t len)
    finds the things that we actually care about: structs, unions, enums,
    integers, floats, typedefs, and pointers to any of these named types.  */
 
-ctf_id_t
-ctf_lookup_by_name (ctf_file_t *fp, const char *name)
+static ctf_id_t
+ctf_lookup_by_name_held (ctf_file_t *fp, const char *name)
 {
   static const char delimiters[] = " \t\n\r\v\f*";
 
@@ -68,10 +69,14 @@ ctf_lookup_by_name (ctf_file_t *fp, const char *name)
   const char *p, *q, *end;
   ctf_id_t type = 0;
   ctf_id_t ntype, ptype;
+  int err;
 
   if (name == NULL)
     return (ctf_set_errno (fp, EINVAL));
 
+  if ((err = ctf_lazy_names (fp)) != 0)
+    return (ctf_set_errno (fp, err));
+
   for (p = name, end = name + strlen (name); *p != '\0'; p = q)
     {
       while (isspace (*p))
@@ -164,6 +169,17 @@ err:
   return CTF_ERR;
 }
 
+ctf_id_t
+ctf_lookup_by_name (ctf_file_t *fp, const char *name)
+{
+  ctf_id_t type;
+
+  ctf_resid_hold (fp);
+  type = ctf_lookup_by_name_held (fp, name);
+  ctf_resid_release (fp);
+  return type;
+}
+
 typedef struct ctf_lookup_var_key
 {
   ctf_file_t *clvk_fp;
@@ -181,23 +197,27 @@ ctf_lookup_var (const void *key_, const void *memb_)
   return (strcmp (key->clvk_name, ctf_strptr (key->clvk_fp, memb->ctv_name)));
 }
 
-/* Given a variable name, return the type of the variable with that name.  */
+/* Look up a variable whose name has hash H in this container and its
+   parent.  */
 
-ctf_id_t
-ctf_lookup_variable (ctf_file_t *fp, const char *name)
+static ctf_id_t
+ctf_lookup_variable_internal (ctf_file_t *fp, const char *name,
+			      unsigned long h)
 {
-  ctf_varent_t *ent;
+  ctf_varent_t *ent = NULL;
   ctf_lookup_var_key_t key = { fp, name };
 
-  /* This array is sorted, so we can bsearch for it.  */
+  /* This array is sorted, so we can bsearch for it: but the Bloom filter can
+     tell us that most absent variables are absent without even doing that.  */
 
-  ent = bsearch (&key, fp->ctf_vars, fp->ctf_nvars, sizeof (ctf_varent_t),
-		 ctf_lookup_var);
+  if (ctf_bloom_test (&fp->ctf_varbloom, h))
+    ent = bsearch (&key, fp->ctf_vars, fp->ctf_nvars, sizeof (ctf_varent_t),
+		   ctf_lookup_var);
 
   if (ent == NULL)
     {
       if (fp->ctf_parent != NULL)
-	return ctf_lookup_variable (fp->ctf_parent, name);
+	return ctf_lookup_variable_internal (fp->ctf_parent, name, h);
 
       return (ctf_set_errno (fp, ECTF_NOTYPEDAT));
     }
@@ -205,6 +225,303 @@ ctf_lookup_variable (ctf_file_t *fp, const char *name)
   return ent->ctv_typeidx;
 }
 
+/* Given a variable name, return the type of the variable with that name.  */
+
+ctf_id_t
+ctf_lookup_variable (ctf_file_t *fp, const char *name)
+{
+  return ctf_lookup_variable_internal (fp, name,
+				       ctf_hash_compute (name, strlen (name)));
+}
+
+/* Sorted name indexes, for prefix and glob searches.
+
+   For each namespace that can be searched we keep a permutation of the root
+   types of the appropriate kind, sorted by name, which is built the first time
+   that namespace is searched.  Variables need no index: ctf_vars is already
+   sorted by name.  A search binary-searches the index for the range of names
+   starting with the literal prefix of the query, and a cursor then walks that
+   range, filtering through fnmatch() if the query is a glob.  */
+
+struct ctf_name_cursor
+{
+  ctf_file_t *cnc_fp;		/* Container being searched.  */
+  const ctf_nameidx_t *cnc_idx;	/* Type index, or NULL for variables.  */
+  unsigned long cnc_pos;	/* Next position in index or ctf_vars.  */
+  unsigned long cnc_end;	/* End of range matching the prefix.  */
+  char *cnc_glob;		/* Glob pattern, or NULL.  */
+};
+
+/* Return the name at position I in the given index or in the variables.  */
+
+static const char *
+ctf_nameidx_name (ctf_file_t *fp, const ctf_nameidx_t *idx, unsigned long i)
+{
+  if (idx == NULL)
+    return ctf_strptr (fp, fp->ctf_vars[i].ctv_name);
+
+  return ctf_strptr (fp, LCTF_INDEX_TO_TYPEPTR (fp,
+						 idx->cni_types[i])->ctt_name);
+}
+
+static int
+ctf_nameidx_cmp (const void *a, const void *b, void *arg)
+{
+  ctf_file_t *fp = arg;
+  const ctf_type_t *ta = LCTF_INDEX_TO_TYPEPTR (fp, *(const uint32_t *) a);
+  const ctf_type_t *tb = LCTF_INDEX_TO_TYPEPTR (fp, *(const uint32_t *) b);
+
+  return strcmp (ctf_strptr (fp, ta->ctt_name), ctf_strptr (fp, tb->ctt_name));
+}
+
+static ctf_nameidx_t *
+ctf_nameidx_build (ctf_file_t *fp, int kind)
+{
+  ctf_nameidx_t *idx;
+  unsigned long i, n = 0;
+
+  for (i = 1; i <= fp->ctf_typemax; i++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, i);
+
+      if (LCTF_INFO_KIND (fp, tp->ctt_info) == (uint32_t) kind
+	  && LCTF_INFO_ISROOT (fp, tp->ctt_info) && tp->ctt_name != 0)
+	n++;
+    }
+
+  idx = ctf_alloc (sizeof (ctf_nameidx_t) + n * sizeof (uint32_t));
+  if (idx == NULL)
+    return NULL;
+
+  idx->cni_n = 0;
+  for (i = 1; i <= fp->ctf_typemax; i++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, i);
+
+      if (LCTF_INFO_KIND (fp, tp->ctt_info) == (uint32_t) kind
+	  && LCTF_INFO_ISROOT (fp, tp->ctt_info) && tp->ctt_name != 0)
+	idx->cni_types[idx->cni_n++] = i;
+    }
+
+  qsort_r (idx->cni_types, idx->cni_n, sizeof (uint32_t), ctf_nameidx_cmp,
+	   fp);
+  return idx;
+}
+
+/* Return the name index for the given kind, building it if need be.
+   Concurrent readers may race to build it: the loser frees its copy.  */
+
+static const ctf_nameidx_t *
+ctf_nameidx (ctf_file_t *fp, int kind)
+{
+  ctf_nameidx_t *idx, *old = NULL;
+
+  idx = __atomic_load_n (&fp->ctf_nameidx[kind], __ATOMIC_ACQUIRE);
+  if (idx != NULL)
+    {
+      ctf_resid_touch (fp);
+      return idx;
+    }
+
+  if ((idx = ctf_nameidx_build (fp, kind)) == NULL)
+    return NULL;
+
+  if (!__atomic_compare_exchange_n (&fp->ctf_nameidx[kind], &old, idx, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      ctf_free (idx, sizeof (ctf_nameidx_t) + idx->cni_n * sizeof (uint32_t));
+      idx = old;
+    }
+  else
+    ctf_resid_add (fp, sizeof (ctf_nameidx_t) + idx->cni_n * sizeof (uint32_t));
+
+  return idx;
+}
+
+void
+ctf_nameidx_destroy (ctf_file_t *fp)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof (fp->ctf_nameidx) / sizeof (fp->ctf_nameidx[0]); i++)
+    {
+      ctf_nameidx_t *idx = fp->ctf_nameidx[i];
+
+      if (idx != NULL)
+	ctf_free (idx, sizeof (ctf_nameidx_t) + idx->cni_n * sizeof (uint32_t));
+      fp->ctf_nameidx[i] = NULL;
+    }
+}
+
+/* Return the first position in the index (or in ctf_vars) whose name compares
+   greater than PREFIX (if UPPER) or not less than it (otherwise), considering
+   only the first LEN characters of each name.  */
+
+static unsigned long
+ctf_nameidx_bound (ctf_file_t *fp, const ctf_nameidx_t *idx, unsigned long n,
+		   const char *prefix, size_t len, int upper)
+{
+  unsigned long lo = 0, hi = n;
+
+  while (lo < hi)
+    {
+      unsigned long mid = lo + (hi - lo) / 2;
+      int cmp = strncmp (ctf_nameidx_name (fp, idx, mid), prefix, len);
+
+      if (cmp < 0 || (upper && cmp == 0))
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+static ctf_name_cursor_t *
+ctf_name_search (ctf_file_t *fp, int ns, const char *prefix, size_t len,
+		 const char *glob)
+{
+  const ctf_nameidx_t *idx = NULL;
+  ctf_name_cursor_t *cur;
+  unsigned long n;
+  int err;
+
+  if (prefix == NULL)
+    {
+      (void) ctf_set_errno (fp, EINVAL);
+      return NULL;
+    }
+
+  /* The cursor holds the container until it is closed.  */
+
+  ctf_resid_hold (fp);
+
+  switch (ns)
+    {
+    case CTF_NS_VARIABLE:
+      n = fp->ctf_nvars;
+      break;
+    case CTF_K_INTEGER:
+    case CTF_K_FLOAT:
+    case CTF_K_STRUCT:
+    case CTF_K_UNION:
+    case CTF_K_ENUM:
+    case CTF_K_FORWARD:
+    case CTF_K_TYPEDEF:
+      if ((err = ctf_lazy_load_all (fp)) != 0)
+	goto err;
+      if ((idx = ctf_nameidx (fp, ns)) == NULL)
+	{
+	  err = EAGAIN;
+	  goto err;
+	}
+      n = idx->cni_n;
+      break;
+    default:
+      err = EINVAL;
+      goto err;
+    }
+
+  if ((cur = ctf_alloc (sizeof (ctf_name_cursor_t))) == NULL)
+    {
+      err = EAGAIN;
+      goto err;
+    }
+
+  cur->cnc_fp = fp;
+  cur->cnc_idx = idx;
+  cur->cnc_pos = ctf_nameidx_bound (fp, idx, n, prefix, len, 0);
+  cur->cnc_end = ctf_nameidx_bound (fp, idx, n, prefix, len, 1);
+  cur->cnc_glob = NULL;
+
+  if (glob != NULL && (cur->cnc_glob = ctf_strdup (glob)) == NULL)
+    {
+      ctf_free (cur, sizeof (ctf_name_cursor_t));
+      err = EAGAIN;
+      goto err;
+    }
+
+  return cur;
+
+err:
+  ctf_resid_release (fp);
+  (void) ctf_set_errno (fp, err);
+  return NULL;
+}
+
+/* Search for names in the given namespace (a type kind which has names, or
+   CTF_NS_VARIABLE) which start with PREFIX.  Returns a cursor over the
+   matches, in name order, or NULL on error.  Only this container is searched,
+   not its parent.  */
+
+ctf_name_cursor_t *
+ctf_lookup_prefix (ctf_file_t *fp, int ns, const char *prefix)
+{
+  return ctf_name_search (fp, ns, prefix, prefix ? strlen (prefix) : 0, NULL);
+}
+
+/* Search for names in the given namespace that match the fnmatch() glob
+   PATTERN.  Only the part of the pattern before the first metacharacter
+   narrows the search: patterns starting with a wildcard visit every name.  */
+
+ctf_name_cursor_t *
+ctf_lookup_glob (ctf_file_t *fp, int ns, const char *pattern)
+{
+  if (pattern == NULL)
+    {
+      (void) ctf_set_errno (fp, EINVAL);
+      return NULL;
+    }
+
+  return ctf_name_search (fp, ns, pattern, strcspn (pattern, "*?[\\"),
+			  pattern);
+}
+
+/* Return the next match from a name cursor, and its name in *NAMEP if NAMEP is
+   non-NULL.  For types, the type ID is returned: for variables, the type of
+   the variable.  At the end of the matches, CTF_ERR is returned and the
+   container's errno is set to ECTF_NEXT_END.  */
+
+ctf_id_t
+ctf_name_next (ctf_name_cursor_t *cur, const char **namep)
+{
+  ctf_file_t *fp = cur->cnc_fp;
+
+  while (cur->cnc_pos < cur->cnc_end)
+    {
+      unsigned long i = cur->cnc_pos++;
+      const char *name = ctf_nameidx_name (fp, cur->cnc_idx, i);
+
+      if (cur->cnc_glob != NULL && fnmatch (cur->cnc_glob, name, 0) != 0)
+	continue;
+
+      if (namep != NULL)
+	*namep = name;
+
+      if (cur->cnc_idx == NULL)
+	return fp->ctf_vars[i].ctv_typeidx;
+
+      return LCTF_INDEX_TO_TYPE (fp, cur->cnc_idx->cni_types[i],
+				 (fp->ctf_flags & LCTF_CHILD));
+    }
+
+  return (ctf_set_errno (fp, ECTF_NEXT_END));
+}
+
+/* Free a name cursor.  */
+
+void
+ctf_name_cursor_close (ctf_name_cursor_t *cur)
+{
+  if (cur == NULL)
+    return;
+
+  ctf_resid_release (cur->cnc_fp);
+  if (cur->cnc_glob != NULL)
+    ctf_free (cur->cnc_glob, strlen (cur->cnc_glob) + 1);
+  ctf_free (cur, sizeof (ctf_name_cursor_t));
+}
+
 /* Given a symbol table index, return the type of the data object described
    by the corresponding entry in the symbol table.  */
 
@@ -213,6 +530,7 @@ ctf_lookup_by_symbol (ctf_file_t *fp, unsigned long symidx)
 {
   const ctf_sect_t *sp = &fp->ctf_symtab;
   ctf_id_t type;
+  int err;
 
   if (sp->cts_data == NULL)
     return (ctf_set_errno (fp, ECTF_NOSYMTAB));
@@ -233,6 +551,9 @@ ctf_lookup_by_symbol (ctf_file_t *fp, unsigned long symidx)
 	return (ctf_set_errno (fp, ECTF_NOTDATA));
     }
 
+  if ((err = ctf_symtab_fill (fp, symidx)) != 0)
+    return (ctf_set_errno (fp, err));
+
   if (fp->ctf_sxlate[symidx] == -1u)
     return (ctf_set_errno (fp, ECTF_NOTYPEDAT));
 
@@ -262,6 +583,16 @@ ctf_lookup_by_id (ctf_file_t **fpp, ctf_id_t type)
   type = LCTF_TYPE_TO_INDEX (fp, type);
   if (type > 0 && (unsigned long) type <= fp->ctf_typemax)
     {
+      int err;
+
+      /* Types in lazily-opened containers may not be loaded yet.  */
+
+      if (fp->ctf_lazy != NULL && (err = ctf_lazy_load (fp, type)) != 0)
+	{
+	  (void) ctf_set_errno (*fpp, err);
+	  return NULL;
+	}
+
       *fpp = fp;		/* Function returns ending CTF container.  */
       return (LCTF_INDEX_TO_TYPEPTR (fp, type));
     }
@@ -279,6 +610,7 @@ ctf_func_info (ctf_file_t *fp, unsigned long symidx, ctf_funcinfo_t *fip)
   const ctf_sect_t *sp = &fp->ctf_symtab;
   const uint32_t *dp;
   uint32_t info, kind, n;
+  int err;
 
   if (sp->cts_data == NULL)
     return (ctf_set_errno (fp, ECTF_NOSYMTAB));
@@ -299,6 +631,9 @@ ctf_func_info (ctf_file_t *fp, unsigned long symidx, ctf_funcinfo_t *fip)
 	return (ctf_set_errno (fp, ECTF_NOTFUNC));
     }
 
+  if ((err = ctf_symtab_fill (fp, symidx)) != 0)
+    return (ctf_set_errno (fp, err));
+
   if (fp->ctf_sxlate[symidx] == -1u)
     return (ctf_set_errno (fp, ECTF_NOFUNCDAT));
 
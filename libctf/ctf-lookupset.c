@@ -0,0 +1,671 @@
+/* Name lookup across many CTF containers at once.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <ctype.h>
+#include <string.h>
+
+/* A lookup set resolves unqualified type and variable names across many
+   containers (typically a kernel and all its modules) without probing each
+   in turn.  It keeps one hash of the names of the root types and variables of
+   every container added, mapping each name to all its definitions.
+
+   When several containers define a name, the definition used is chosen by
+   these rules, in order: a definition beats a forward declaration; a higher
+   priority beats a lower one; a container added earlier beats one added
+   later.  So a lookup always gives the same answer for the same set of
+   containers added in the same order, whatever else has come and gone.
+
+   Containers can be added and removed at any time; each holds a reference to
+   its container until removed.  A container's parent, if any, must be
+   imported before it is added.  A set may be searched from several threads
+   at once, but must not be modified while it is being searched.  */
+
+enum
+{
+  CTF_LS_STRUCT,
+  CTF_LS_UNION,
+  CTF_LS_ENUM,
+  CTF_LS_NAMES,
+  CTF_LS_VARS
+};
+
+typedef struct ctf_lsmemb ctf_lsmemb_t;
+
+/* One definition of a name.  */
+
+typedef struct ctf_lsent
+{
+  ctf_list_t cle_list;		/* Hash bucket forward/back pointers.  */
+  const char *cle_name;		/* Name, in the container's string table.  */
+  unsigned long cle_hash;	/* Hash of namespace and name.  */
+  int cle_ns;			/* Namespace (CTF_LS_*).  */
+  int cle_fwd;			/* Nonzero if a forward declaration.  */
+  ctf_id_t cle_type;		/* Type, or type of variable.  */
+  ctf_lsmemb_t *cle_memb;	/* Container defining it.  */
+} ctf_lsent_t;
+
+/* One container in the set.  */
+
+struct ctf_lsmemb
+{
+  ctf_list_t clm_list;		/* Members in precedence order.  */
+  ctf_file_t *clm_fp;		/* Container.  */
+  const ctf_archive_t *clm_arc;	/* Archive it came from, if any.  */
+  const char *clm_name;		/* Its name in that archive.  */
+  int clm_prio;			/* Priority.  */
+  unsigned long clm_seq;	/* Order added.  */
+  ctf_lsent_t *clm_ents;	/* Its definitions.  */
+  size_t clm_nents;		/* Number of definitions.  */
+  int clm_outside;		/* Nonzero if its parent is not in the set.  */
+};
+
+struct ctf_lookupset
+{
+  ctf_list_t cls_membs;		/* Members in precedence order.  */
+  ctf_list_t *cls_buckets;	/* Hash buckets of ctf_lsent_t.  */
+  size_t cls_nbuckets;		/* Number of buckets (a power of two).  */
+  size_t cls_nents;		/* Number of definitions hashed.  */
+  unsigned long cls_seq;	/* Next member sequence number.  */
+  size_t cls_noutside;		/* Members whose parent is not in the set.  */
+  int cls_errno;		/* Error code for most recent error.  */
+};
+
+#define CTF_LS_INITBUCKETS 256
+
+static unsigned long
+ctf_ls_hash (int ns, const char *name, size_t len)
+{
+  return ctf_hash_compute (name, len) * 31 + ns;
+}
+
+static int
+ctf_ls_set_errno (ctf_lookupset_t *set, int err)
+{
+  set->cls_errno = err;
+  return CTF_ERR;
+}
+
+/* Return nonzero if definition A takes precedence over definition B.  */
+
+static int
+ctf_ls_better (const ctf_lsent_t *a, const ctf_lsent_t *b)
+{
+  if (a->cle_fwd != b->cle_fwd)
+    return a->cle_fwd < b->cle_fwd;
+  if (a->cle_memb->clm_prio != b->cle_memb->clm_prio)
+    return a->cle_memb->clm_prio > b->cle_memb->clm_prio;
+  return a->cle_memb->clm_seq < b->cle_memb->clm_seq;
+}
+
+/* Create an empty lookup set.  */
+
+ctf_lookupset_t *
+ctf_lookupset_create (int *errp)
+{
+  ctf_lookupset_t *set;
+
+  if ((set = ctf_alloc (sizeof (ctf_lookupset_t))) == NULL)
+    {
+      if (errp)
+	*errp = ENOMEM;
+      return NULL;
+    }
+
+  memset (set, 0, sizeof (ctf_lookupset_t));
+  set->cls_nbuckets = CTF_LS_INITBUCKETS;
+  if ((set->cls_buckets = calloc (set->cls_nbuckets,
+				  sizeof (ctf_list_t))) == NULL)
+    {
+      ctf_free (set, sizeof (ctf_lookupset_t));
+      if (errp)
+	*errp = ENOMEM;
+      return NULL;
+    }
+
+  return set;
+}
+
+/* Double the number of hash buckets.  */
+
+static int
+ctf_ls_grow (ctf_lookupset_t *set)
+{
+  size_t nbuckets = set->cls_nbuckets * 2;
+  ctf_list_t *buckets;
+  size_t i;
+
+  if ((buckets = calloc (nbuckets, sizeof (ctf_list_t))) == NULL)
+    return ENOMEM;
+
+  for (i = 0; i < set->cls_nbuckets; i++)
+    {
+      ctf_lsent_t *ent, *next;
+
+      for (ent = ctf_list_next (&set->cls_buckets[i]); ent != NULL;
+	   ent = next)
+	{
+	  next = ctf_list_next (ent);
+	  ctf_list_append (&buckets[ent->cle_hash & (nbuckets - 1)], ent);
+	}
+    }
+
+  free (set->cls_buckets);
+  set->cls_buckets = buckets;
+  set->cls_nbuckets = nbuckets;
+  return 0;
+}
+
+static void
+ctf_ls_ent (ctf_lsmemb_t *memb, int ns, int fwd, const char *name,
+	    ctf_id_t type)
+{
+  ctf_lsent_t *ent = &memb->clm_ents[memb->clm_nents++];
+
+  ent->cle_name = name;
+  ent->cle_hash = ctf_ls_hash (ns, name, strlen (name));
+  ent->cle_ns = ns;
+  ent->cle_fwd = fwd;
+  ent->cle_type = type;
+  ent->cle_memb = memb;
+}
+
+/* Collect the definitions in MEMB's container into clm_ents.  */
+
+static int
+ctf_ls_collect (ctf_lsmemb_t *memb)
+{
+  ctf_file_t *fp = memb->clm_fp;
+  int child = (fp->ctf_flags & LCTF_CHILD);
+  unsigned long i, n = fp->ctf_nvars;
+  int err;
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    return err;
+
+  for (i = 1; i <= fp->ctf_typemax; i++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, i);
+
+      if (LCTF_INFO_ISROOT (fp, tp->ctt_info) && tp->ctt_name != 0)
+	n++;
+    }
+
+  if (n == 0)
+    return 0;
+
+  if ((memb->clm_ents = malloc (n * sizeof (ctf_lsent_t))) == NULL)
+    return ENOMEM;
+
+  for (i = 1; i <= fp->ctf_typemax; i++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, i);
+      uint32_t kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      const char *name;
+      int ns;
+
+      if (!LCTF_INFO_ISROOT (fp, tp->ctt_info) || tp->ctt_name == 0)
+	continue;
+
+      name = ctf_strptr (fp, tp->ctt_name);
+      if (name[0] == '\0')
+	continue;
+
+      switch (kind == CTF_K_FORWARD ? tp->ctt_type : kind)
+	{
+	case CTF_K_STRUCT:
+	  ns = CTF_LS_STRUCT;
+	  break;
+	case CTF_K_UNION:
+	  ns = CTF_LS_UNION;
+	  break;
+	case CTF_K_ENUM:
+	  ns = CTF_LS_ENUM;
+	  break;
+	default:
+	  ns = CTF_LS_NAMES;
+	}
+
+      ctf_ls_ent (memb, ns, kind == CTF_K_FORWARD, name,
+		  LCTF_INDEX_TO_TYPE (fp, i, child));
+    }
+
+  for (i = 0; i < fp->ctf_nvars; i++)
+    ctf_ls_ent (memb, CTF_LS_VARS, 0,
+		ctf_strptr (fp, fp->ctf_vars[i].ctv_name),
+		fp->ctf_vars[i].ctv_typeidx);
+
+  return 0;
+}
+
+/* Return the member of the set holding FP, or NULL if none.  */
+
+static ctf_lsmemb_t *
+ctf_ls_member (const ctf_lookupset_t *set, const ctf_file_t *fp)
+{
+  ctf_lsmemb_t *m;
+
+  for (m = ctf_list_next (&set->cls_membs); m != NULL; m = ctf_list_next (m))
+    if (m->clm_fp == fp)
+      return m;
+  return NULL;
+}
+
+/* Note whether MEMB's parent is outside the set, which only names missing
+   from the hash are looked up in.  */
+
+static void
+ctf_ls_set_outside (ctf_lookupset_t *set, ctf_lsmemb_t *memb, int outside)
+{
+  set->cls_noutside += outside - memb->clm_outside;
+  memb->clm_outside = outside;
+}
+
+static int
+ctf_ls_add (ctf_lookupset_t *set, ctf_file_t *fp, const ctf_archive_t *arc,
+	    const char *name, int priority)
+{
+  ctf_lsmemb_t *memb, *m;
+  size_t i;
+  int err;
+
+  if (ctf_ls_member (set, fp) != NULL)
+    return ctf_ls_set_errno (set, ECTF_DUPLICATE);
+
+  if ((memb = ctf_alloc (sizeof (ctf_lsmemb_t))) == NULL)
+    return ctf_ls_set_errno (set, ENOMEM);
+
+  memset (memb, 0, sizeof (ctf_lsmemb_t));
+  memb->clm_fp = fp;
+  memb->clm_arc = arc;
+  memb->clm_name = name;
+  memb->clm_prio = priority;
+  memb->clm_seq = set->cls_seq++;
+
+  ctf_resid_hold (fp);
+  err = ctf_ls_collect (memb);
+  ctf_resid_release (fp);
+
+  if (err != 0)
+    {
+      ctf_free (memb, sizeof (ctf_lsmemb_t));
+      return ctf_ls_set_errno (set, err);
+    }
+
+  while (set->cls_nents + memb->clm_nents > set->cls_nbuckets)
+    if ((err = ctf_ls_grow (set)) != 0)
+      {
+	free (memb->clm_ents);
+	ctf_free (memb, sizeof (ctf_lsmemb_t));
+	return ctf_ls_set_errno (set, err);
+      }
+
+  for (i = 0; i < memb->clm_nents; i++)
+    {
+      ctf_lsent_t *ent = &memb->clm_ents[i];
+
+      ctf_list_append (&set->cls_buckets[ent->cle_hash
+					 & (set->cls_nbuckets - 1)], ent);
+    }
+  set->cls_nents += memb->clm_nents;
+
+  /* Keep the members in precedence order, for lookups of names that the hash
+     cannot answer.  Ties go to the earlier member, which is already there.  */
+
+  for (m = ctf_list_next (&set->cls_membs); m != NULL
+	 && m->clm_prio >= priority; m = ctf_list_next (m));
+
+  if (m == NULL)
+    ctf_list_append (&set->cls_membs, memb);
+  else
+    {
+      /* ctf_list has no insert-before, so splice by hand.  */
+      ctf_list_t *prev = m->clm_list.l_prev;
+
+      memb->clm_list.l_prev = prev;
+      memb->clm_list.l_next = &m->clm_list;
+      m->clm_list.l_prev = &memb->clm_list;
+      if (prev != NULL)
+	prev->l_next = &memb->clm_list;
+      else
+	set->cls_membs.l_next = &memb->clm_list;
+    }
+
+  for (m = ctf_list_next (&set->cls_membs); m != NULL; m = ctf_list_next (m))
+    if (m->clm_fp->ctf_parent == fp)
+      ctf_ls_set_outside (set, m, 0);
+  ctf_ls_set_outside (set, memb, fp->ctf_parent != NULL
+		      && ctf_ls_member (set, fp->ctf_parent) == NULL);
+
+  fp->ctf_refcnt++;
+  return 0;
+}
+
+/* Add a container to the set, with the given PRIORITY: higher priorities take
+   precedence.  The set holds a reference to FP until it is removed.  Returns
+   0 or CTF_ERR.  */
+
+int
+ctf_lookupset_add (ctf_lookupset_t *set, ctf_file_t *fp, int priority)
+{
+  return ctf_ls_add (set, fp, NULL, NULL, priority);
+}
+
+static void
+ctf_ls_remove (ctf_lookupset_t *set, ctf_lsmemb_t *memb)
+{
+  ctf_lsmemb_t *m;
+  size_t i;
+
+  for (i = 0; i < memb->clm_nents; i++)
+    {
+      ctf_lsent_t *ent = &memb->clm_ents[i];
+
+      ctf_list_delete (&set->cls_buckets[ent->cle_hash
+					 & (set->cls_nbuckets - 1)], ent);
+    }
+  set->cls_nents -= memb->clm_nents;
+
+  ctf_ls_set_outside (set, memb, 0);
+  ctf_list_delete (&set->cls_membs, memb);
+  for (m = ctf_list_next (&set->cls_membs); m != NULL; m = ctf_list_next (m))
+    if (m->clm_fp->ctf_parent == memb->clm_fp)
+      ctf_ls_set_outside (set, m, 1);
+  ctf_close (memb->clm_fp);
+  free (memb->clm_ents);
+  ctf_free (memb, sizeof (ctf_lsmemb_t));
+}
+
+/* Remove a container from the set.  Returns 0 or CTF_ERR.  */
+
+int
+ctf_lookupset_remove (ctf_lookupset_t *set, ctf_file_t *fp)
+{
+  ctf_lsmemb_t *memb;
+
+  for (memb = ctf_list_next (&set->cls_membs); memb != NULL;
+       memb = ctf_list_next (memb))
+    if (memb->clm_fp == fp)
+      {
+	ctf_ls_remove (set, memb);
+	return 0;
+      }
+
+  return ctf_ls_set_errno (set, EINVAL);
+}
+
+typedef struct ctf_ls_arc_arg
+{
+  ctf_lookupset_t *cla_set;
+  const ctf_archive_t *cla_arc;
+  int cla_prio;
+  int cla_err;
+} ctf_ls_arc_arg_t;
+
+static int
+ctf_ls_add_arc_member (ctf_file_t *fp, const char *name, void *arg)
+{
+  ctf_ls_arc_arg_t *a = arg;
+
+  if (ctf_ls_add (a->cla_set, fp, a->cla_arc, name, a->cla_prio) < 0)
+    {
+      a->cla_err = a->cla_set->cls_errno;
+      return -1;
+    }
+  return 0;
+}
+
+/* Add every member of an archive to the set, with the given PRIORITY.  Members
+   whose parent is also in the archive are imported into it.  Returns 0 or
+   CTF_ERR, in which case no members are added.  */
+
+int
+ctf_lookupset_add_archive (ctf_lookupset_t *set, const ctf_archive_t *arc,
+			   int priority)
+{
+  ctf_ls_arc_arg_t arg = { set, arc, priority, 0 };
+  ctf_lsmemb_t *memb;
+  int rc;
+
+  if ((rc = ctf_archive_iter (arc, ctf_ls_add_arc_member, &arg)) != 0)
+    {
+      int err = arg.cla_err ? arg.cla_err : rc;
+
+      (void) ctf_lookupset_remove_archive (set, arc);
+      return ctf_ls_set_errno (set, err);
+    }
+
+  for (memb = ctf_list_next (&set->cls_membs); memb != NULL;
+       memb = ctf_list_next (memb))
+    {
+      const char *parname = ctf_parent_name (memb->clm_fp);
+      ctf_lsmemb_t *par;
+
+      if (memb->clm_arc != arc || parname == NULL
+	  || ctf_parent_file (memb->clm_fp) != NULL)
+	continue;
+
+      for (par = ctf_list_next (&set->cls_membs); par != NULL;
+	   par = ctf_list_next (par))
+	if (par != memb && par->clm_arc == arc
+	    && strcmp (par->clm_name, parname) == 0)
+	  {
+	    (void) ctf_import (memb->clm_fp, par->clm_fp);
+	    break;
+	  }
+    }
+
+  return 0;
+}
+
+/* Remove every member of an archive from the set.  Returns 0 or CTF_ERR if
+   none were present.  */
+
+int
+ctf_lookupset_remove_archive (ctf_lookupset_t *set, const ctf_archive_t *arc)
+{
+  ctf_lsmemb_t *memb, *next;
+  int found = 0;
+
+  for (memb = ctf_list_next (&set->cls_membs); memb != NULL; memb = next)
+    {
+      next = ctf_list_next (memb);
+      if (memb->clm_arc == arc)
+	{
+	  ctf_ls_remove (set, memb);
+	  found = 1;
+	}
+    }
+
+  return found ? 0 : ctf_ls_set_errno (set, EINVAL);
+}
+
+/* Destroy a lookup set, releasing all its containers.  */
+
+void
+ctf_lookupset_destroy (ctf_lookupset_t *set)
+{
+  ctf_lsmemb_t *memb, *next;
+
+  if (set == NULL)
+    return;
+
+  for (memb = ctf_list_next (&set->cls_membs); memb != NULL; memb = next)
+    {
+      next = ctf_list_next (memb);
+      ctf_ls_remove (set, memb);
+    }
+
+  free (set->cls_buckets);
+  ctf_free (set, sizeof (ctf_lookupset_t));
+}
+
+/* Return the definition of the LEN-byte NAME in namespace NS that takes
+   precedence, or NULL if none.  */
+
+static const ctf_lsent_t *
+ctf_ls_find (const ctf_lookupset_t *set, int ns, const char *name, size_t len)
+{
+  unsigned long h = ctf_ls_hash (ns, name, len);
+  const ctf_lsent_t *ent, *best = NULL;
+
+  for (ent = ctf_list_next (&set->cls_buckets[h & (set->cls_nbuckets - 1)]);
+       ent != NULL; ent = ctf_list_next (ent))
+    {
+      if (ent->cle_hash != h || ent->cle_ns != ns
+	  || strncmp (ent->cle_name, name, len) != 0
+	  || ent->cle_name[len] != '\0')
+	continue;
+
+      if (best == NULL || ctf_ls_better (ent, best))
+	best = ent;
+    }
+
+  return best;
+}
+
+/* Return nonzero if the LEN bytes at S contain a type qualifier.  */
+
+static int
+ctf_ls_qualified (const char *s, size_t len)
+{
+  static const char *const quals[] = { "const", "volatile", "restrict" };
+  size_t i, j;
+
+  for (i = 0; i < len; i++)
+    {
+      if (i > 0 && !isspace ((unsigned char) s[i - 1]))
+	continue;
+
+      for (j = 0; j < sizeof (quals) / sizeof (quals[0]); j++)
+	{
+	  size_t qlen = strlen (quals[j]);
+
+	  if (len - i >= qlen && strncmp (s + i, quals[j], qlen) == 0
+	      && (len - i == qlen || isspace ((unsigned char) s[i + qlen])))
+	    return 1;
+	}
+    }
+  return 0;
+}
+
+/* Look up a type by name, as ctf_lookup_by_name() does, in the container
+   defining it that takes precedence.  Returns the type, and the container
+   in *FPP, or CTF_ERR.
+
+   The name of the base type is looked up in the hash.  Names with pointer,
+   array or function declarators are then resolved in the container found.
+   Names with qualifiers, declarators not found that way, and names not in the
+   hash that may come from a parent outside the set, are tried in each
+   container in precedence order.  */
+
+ctf_id_t
+ctf_lookupset_by_name (ctf_lookupset_t *set, const char *name,
+		       ctf_file_t **fpp)
+{
+  static const struct
+  {
+    const char *prefix;
+    int ns;
+  } prefixes[] = { { "struct", CTF_LS_STRUCT }, { "union", CTF_LS_UNION },
+		   { "enum", CTF_LS_ENUM } };
+  const ctf_lsent_t *ent;
+  const ctf_lsmemb_t *memb;
+  const char *p = name;
+  size_t i, len;
+  int ns = CTF_LS_NAMES;
+  int decl, qual;
+  ctf_id_t type;
+
+  while (isspace ((unsigned char) *p))
+    p++;
+
+  for (i = 0; i < sizeof (prefixes) / sizeof (prefixes[0]); i++)
+    {
+      size_t plen = strlen (prefixes[i].prefix);
+
+      if (strncmp (p, prefixes[i].prefix, plen) == 0
+	  && isspace ((unsigned char) p[plen]))
+	{
+	  ns = prefixes[i].ns;
+	  for (p += plen; isspace ((unsigned char) *p); p++);
+	  break;
+	}
+    }
+
+  len = strcspn (p, "*[(");
+  decl = p[len] != '\0';
+  while (len > 0 && isspace ((unsigned char) p[len - 1]))
+    len--;
+
+  qual = ctf_ls_qualified (p, len);
+  ent = qual ? NULL : ctf_ls_find (set, ns, p, len);
+
+  if (ent != NULL)
+    {
+      if (!decl)
+	{
+	  *fpp = ent->cle_memb->clm_fp;
+	  return ent->cle_type;
+	}
+
+      if ((type = ctf_lookup_by_name (ent->cle_memb->clm_fp,
+				      name)) != CTF_ERR)
+	{
+	  *fpp = ent->cle_memb->clm_fp;
+	  return type;
+	}
+    }
+
+  /* An unqualified name not in the hash can still be defined in the parent of
+     a member, if that parent is not in the set itself; only those members need
+     trying, and usually there are none.  */
+
+  if (!qual && ent == NULL && set->cls_noutside == 0)
+    return ctf_ls_set_errno (set, ECTF_NOTYPE);
+
+  for (memb = ctf_list_next (&set->cls_membs); memb != NULL;
+       memb = ctf_list_next (memb))
+    {
+      if (!qual && ent == NULL && !memb->clm_outside)
+	continue;
+
+      if ((type = ctf_lookup_by_name (memb->clm_fp, name)) != CTF_ERR)
+	{
+	  *fpp = memb->clm_fp;
+	  return type;
+	}
+    }
+
+  return ctf_ls_set_errno (set, ECTF_NOTYPE);
+}
+
+/* Look up a variable by name in the container defining it that takes
+   precedence.  Returns its type, and the container in *FPP, or CTF_ERR.  */
+
+ctf_id_t
+ctf_lookupset_variable (ctf_lookupset_t *set, const char *name,
+			ctf_file_t **fpp)
+{
+  const ctf_lsent_t *ent;
+
+  if ((ent = ctf_ls_find (set, CTF_LS_VARS, name, strlen (name))) == NULL)
+    return ctf_ls_set_errno (set, ECTF_NOTYPEDAT);
+
+  *fpp = ent->cle_memb->clm_fp;
+  return ent->cle_type;
+}
+
+/* Return the error code for the most recent error on this set.  */
+
+int
+ctf_lookupset_errno (ctf_lookupset_t *set)
+{
+  return set->cls_errno;
+}
@@ -14,6 +14,7 @@
 #include <ctf-impl.h>
 #include <sys/mman.h>
 #include <zlib.h>
+#include <pthread.h>
 
 static const ctf_dmodel_t _libctf_models[] = {
   {"ILP32", CTF_MODEL_ILP32, 4, 1, 2, 4, 4},
@@ -233,30 +234,48 @@ sym_to_gelf (const Elf32_Sym *src, Elf64_Sym *dst)
   return dst;
 }
 
-/* Initialize the symtab translation table by filling each entry with the
-  offset of the CTF type or function data corresponding to each STT_FUNC or
-  STT_OBJECT entry in the symbol table.  */
+/* The symtab translation table is filled lazily, CTF_SXLATE_BLOCK symbols at a
+   time, on the first lookup of a symbol in each block not yet translated.  The
+   data object and function sections are ordered to match the symbol table, so
+   the offset for one symbol depends on every symbol before it: the state of
+   the walk at the end of the last block filled is kept in ctf_sxfill, and
+   filling resumes from there.
 
-static int
-init_symtab (ctf_file_t *fp, const ctf_header_t *hp,
-	     const ctf_sect_t *sp, const ctf_sect_t *strp)
+   Lookups may be concurrent, so filling takes a lock, and publishes the count
+   of translated symbols only once they are in place.  Lookups of symbols
+   already translated take no lock.  */
+
+#define CTF_SXLATE_BLOCK 4096
+
+static pthread_mutex_t ctf_sxlate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Fill in the symtab translation table from csx_next up to (but excluding)
+   symbol END, by filling each entry with the offset of the CTF type or
+   function data corresponding to each STT_FUNC or STT_OBJECT entry in the
+   symbol table.  Called with the lock held.  */
+
+static void
+fill_symtab (ctf_file_t *fp, unsigned long end)
 {
-  const unsigned char *symp = sp->cts_data;
-  uint32_t *xp = fp->ctf_sxlate;
-  uint32_t *xend = xp + fp->ctf_nsyms;
+  const ctf_sect_t *sp = &fp->ctf_symtab;
+  const ctf_sect_t *strp = &fp->ctf_strtab;
+  ctf_sxfill_t *sx = &fp->ctf_sxfill;
+  const unsigned char *symp;
+  uint32_t *xp = fp->ctf_sxlate + sx->csx_next;
+  uint32_t *xend = fp->ctf_sxlate + end;
 
-  uint32_t objtoff = hp->cth_objtoff;
-  uint32_t funcoff = hp->cth_funcoff;
+  uint32_t objtoff = sx->csx_objtoff;
+  uint32_t funcoff = sx->csx_funcoff;
 
-  unsigned short info, vlen;
+  uint32_t info, vlen;
   Elf64_Sym sym, *gsp;
   const char *name;
 
-  /* The CTF data object and function type sections are ordered to match
-     the relative order of the respective symbol types in the symtab.
-     If no type information is available for a symbol table entry, a
-     pad is inserted in the CTF section.  As a further optimization,
-     anonymous or undefined symbols are omitted from the CTF data.  */
+  symp = (const unsigned char *) sp->cts_data + sx->csx_next * sp->cts_entsize;
+
+  /* If no type information is available for a symbol table entry, a pad is
+     inserted in the CTF section.  As a further optimization, anonymous or
+     undefined symbols are omitted from the CTF data.  */
 
   for (; xp < xend; xp++, symp += sp->cts_entsize)
     {
@@ -271,7 +290,8 @@ init_symtab (ctf_file_t *fp, const ctf_header_t *hp,
 	name = _CTF_NULLSTR;
 
       if (gsp->st_name == 0 || gsp->st_shndx == SHN_UNDEF
-	  || strcmp (name, "_START_") == 0 || strcmp (name, "_END_") == 0)
+	  || (name[0] == '_'
+	      && (strcmp (name, "_START_") == 0 || strcmp (name, "_END_") == 0)))
 	{
 	  *xp = -1u;
 	  continue;
@@ -280,7 +300,7 @@ init_symtab (ctf_file_t *fp, const ctf_header_t *hp,
       switch (ELF64_ST_TYPE (gsp->st_info))
 	{
 	case STT_OBJECT:
-	  if (objtoff >= hp->cth_funcoff
+	  if (objtoff >= sx->csx_objtend
 	      || (gsp->st_shndx == SHN_ABS && gsp->st_value == 0))
 	    {
 	      *xp = -1u;
@@ -292,7 +312,7 @@ init_symtab (ctf_file_t *fp, const ctf_header_t *hp,
 	  break;
 
 	case STT_FUNC:
-	  if (funcoff >= hp->cth_typeoff)
+	  if (funcoff >= sx->csx_funcend)
 	    {
 	      *xp = -1u;
 	      break;
@@ -319,7 +339,70 @@ init_symtab (ctf_file_t *fp, const ctf_header_t *hp,
 	}
     }
 
-  ctf_dprintf ("loaded %lu symtab entries\n", fp->ctf_nsyms);
+  sx->csx_objtoff = objtoff;
+  sx->csx_funcoff = funcoff;
+  __atomic_store_n (&sx->csx_next, end, __ATOMIC_RELEASE);
+
+  if (end == fp->ctf_nsyms)
+    ctf_dprintf ("loaded %lu symtab entries\n", fp->ctf_nsyms);
+}
+
+/* Make sure the symtab translation table entry for SYMIDX, which must be less
+   than ctf_nsyms, is filled in.  Returns zero or an errno value.  */
+
+int
+ctf_symtab_fill (ctf_file_t *fp, unsigned long symidx)
+{
+  unsigned long end;
+  int err = 0;
+
+  if (symidx < __atomic_load_n (&fp->ctf_sxfill.csx_next, __ATOMIC_ACQUIRE))
+    return 0;
+
+  pthread_mutex_lock (&ctf_sxlate_lock);
+
+  if (symidx < fp->ctf_sxfill.csx_next)
+    goto out;
+
+  if (fp->ctf_sxlate == NULL
+      && (fp->ctf_sxlate = ctf_alloc (fp->ctf_nsyms
+				      * sizeof (uint32_t))) == NULL)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+
+  end = (symidx / CTF_SXLATE_BLOCK + 1) * CTF_SXLATE_BLOCK;
+  if (end > fp->ctf_nsyms)
+    end = fp->ctf_nsyms;
+
+  fill_symtab (fp, end);
+
+out:
+  pthread_mutex_unlock (&ctf_sxlate_lock);
+  return err;
+}
+
+/* Populate the Bloom filter over variable names, so that lookups of variables
+   not in this container can skip the binary search.  */
+
+static int
+init_varbloom (ctf_file_t *fp)
+{
+  unsigned long i;
+  int err;
+
+  if ((err = ctf_bloom_create (&fp->ctf_varbloom, fp->ctf_nvars)) != 0)
+    return err;
+
+  for (i = 0; i < fp->ctf_nvars; i++)
+    {
+      const char *name = ctf_strptr (fp, fp->ctf_vars[i].ctv_name);
+
+      ctf_bloom_add (&fp->ctf_varbloom, ctf_hash_compute (name,
+							  strlen (name)));
+    }
+
   return 0;
 }
 
@@ -632,82 +715,24 @@ upgrade_types (ctf_file_t *fp, ctf_header_t *cth)
 }
 #endif /* !NO_COMPAT */
 
-/* Initialize the type ID translation table with the byte offset of each type,
-   and initialize the hash tables of each named type.  Upgrade the type table to
-   the latest supported representation in the process, if needed, and if this
-   recension of libctf supports upgrading.  */
+/* Allocate the hash tables and pointer table of FP, whose type translation
+   table is filled in, and add every named type to the appropriate hash.  POP
+   is the number of types of each kind, counting forwards under the kind of
+   their tag too.  */
 
 static int
-init_types (ctf_file_t *fp, ctf_header_t *cth)
+init_names (ctf_file_t *fp, const unsigned long *pop)
 {
-  const ctf_type_t *tbuf;
-  const ctf_type_t *tend;
-
-  unsigned long pop[CTF_K_MAX + 1] = { 0 };
   const ctf_type_t *tp;
   ctf_hash_t *hp;
   uint32_t id, dst;
-  uint32_t *xp;
 
-  /* We determine whether the container is a child or a parent based on
-     the value of cth_parname.  */
-
-  int child = cth->cth_parname != 0;
+  int child = (fp->ctf_flags & LCTF_CHILD) != 0;
   int nlstructs = 0, nlunions = 0;
   int err;
 
-#ifndef NO_COMPAT
-  if (_libctf_unlikely_ (fp->ctf_version == CTF_VERSION_1))
-    {
-      int err;
-      if ((err = upgrade_types (fp, cth)) != 0)
-	return err;				/* Upgrade failed.  */
-    }
-#endif /* !NO_COMPAT */
-
-  tbuf = (ctf_type_t *) (fp->ctf_buf + cth->cth_typeoff);
-  tend = (ctf_type_t *) (fp->ctf_buf + cth->cth_stroff);
-
-  /* We make two passes through the entire type section.  In this first
-     pass, we count the number of each type and the total number of types.  */
-
-  for (tp = tbuf; tp < tend; fp->ctf_typemax++)
-    {
-      unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
-      unsigned long vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
-      ssize_t size, increment, vbytes;
-
-      (void) ctf_get_ctt_size (fp, tp, &size, &increment);
-      vbytes = LCTF_VBYTES (fp, kind, size, vlen);
-
-      if (vbytes < 0)
-	return ECTF_CORRUPT;
-
-      if (kind == CTF_K_FORWARD)
-	{
-	  /* For forward declarations, ctt_type is the CTF_K_* kind for the tag,
-	     so bump that population count too.  If ctt_type is unknown, treat
-	     the tag as a struct.  */
-
-	  if (tp->ctt_type == CTF_K_UNKNOWN || tp->ctt_type >= CTF_K_MAX)
-	    pop[CTF_K_STRUCT]++;
-	  else
-	    pop[tp->ctt_type]++;
-	}
-      tp = (ctf_type_t *) ((uintptr_t) tp + increment + vbytes);
-      pop[kind]++;
-    }
-
-  if (child)
-    {
-      ctf_dprintf ("CTF container %p is a child\n", (void *) fp);
-      fp->ctf_flags |= LCTF_CHILD;
-    }
-  else
-    ctf_dprintf ("CTF container %p is a parent\n", (void *) fp);
-
   /* Now that we've counted up the number of each type, we can allocate
-     the hash tables, type translation table, and pointer table.  */
+     the hash tables and pointer table.  */
 
   if ((err = ctf_hash_create (&fp->ctf_structs, pop[CTF_K_STRUCT])) != 0)
     return err;
@@ -725,34 +750,30 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
 			      pop[CTF_K_CONST] + pop[CTF_K_RESTRICT])) != 0)
     return err;
 
-  fp->ctf_txlate = ctf_alloc (sizeof (uint32_t) * (fp->ctf_typemax + 1));
   fp->ctf_ptrtab = ctf_alloc (sizeof (uint32_t) * (fp->ctf_typemax + 1));
 
-  if (fp->ctf_txlate == NULL || fp->ctf_ptrtab == NULL)
+  if (fp->ctf_ptrtab == NULL)
     return ENOMEM;		/* Memory allocation failed.  */
 
-  xp = fp->ctf_txlate;
-  *xp++ = 0;			/* Type id 0 is used as a sentinel value.  */
-
-  memset (fp->ctf_txlate, 0, sizeof (uint32_t) * (fp->ctf_typemax + 1));
   memset (fp->ctf_ptrtab, 0, sizeof (uint32_t) * (fp->ctf_typemax + 1));
 
-  /* In the second pass through the types, we fill in each entry of the
-     type and pointer tables and add names to the appropriate hashes.  */
+  /* Now fill in each entry of the pointer table and add names to the
+     appropriate hashes.  */
 
-  for (id = 1, tp = tbuf; tp < tend; xp++, id++)
+  for (id = 1; id <= fp->ctf_typemax; id++)
     {
-      unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
-      unsigned short flag = LCTF_INFO_ISROOT (fp, tp->ctt_info);
-      unsigned long vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
-      ssize_t size, increment, vbytes;
+      unsigned short kind, flag;
+      ssize_t size, increment;
 
       const char *name;
       ctf_helem_t *hep;
 
+      tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
+      kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      flag = LCTF_INFO_ISROOT (fp, tp->ctt_info);
+
       (void) ctf_get_ctt_size (fp, tp, &size, &increment);
       name = ctf_strptr (fp, tp->ctt_name);
-      vbytes = LCTF_VBYTES (fp, kind, size, vlen);
 
       switch (kind)
 	{
@@ -879,12 +900,8 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
 	    return err;
 	  break;
 	}
-
-      *xp = (uint32_t) ((uintptr_t) tp - (uintptr_t) fp->ctf_buf);
-      tp = (ctf_type_t *) ((uintptr_t) tp + increment + vbytes);
     }
 
-  ctf_dprintf ("%lu total types processed\n", fp->ctf_typemax);
   ctf_dprintf ("%u enum names hashed\n", ctf_hash_size (&fp->ctf_enums));
   ctf_dprintf ("%u struct names hashed (%d long)\n",
 	       ctf_hash_size (&fp->ctf_structs), nlstructs);
@@ -914,20 +931,166 @@ init_types (ctf_file_t *fp, ctf_header_t *cth)
   return 0;
 }
 
-/* Decode the specified CTF buffer and optional symbol table and create a new
-   CTF container representing the symbolic debugging information.  This code
-   can be used directly by the debugger, or it can be used as the engine for
-   ctf_fdopen() or ctf_open(), below.  */
+/* Initialize the type ID translation table with the byte offset of each type,
+   and initialize the hash tables of each named type.  Upgrade the type table to
+   the latest supported representation in the process, if needed, and if this
+   recension of libctf supports upgrading.  */
 
-ctf_file_t *
-ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
-	     const ctf_sect_t *strsect, int *errp)
+static int
+init_types (ctf_file_t *fp, ctf_header_t *cth)
+{
+  const ctf_type_t *tbuf;
+  const ctf_type_t *tend;
+
+  unsigned long pop[CTF_K_MAX + 1] = { 0 };
+  const ctf_type_t *tp;
+  uint32_t *xp;
+
+#ifndef NO_COMPAT
+  if (_libctf_unlikely_ (fp->ctf_version == CTF_VERSION_1))
+    {
+      int err;
+      if ((err = upgrade_types (fp, cth)) != 0)
+	return err;				/* Upgrade failed.  */
+    }
+#endif /* !NO_COMPAT */
+
+  tbuf = (ctf_type_t *) (fp->ctf_buf + cth->cth_typeoff);
+  tend = (ctf_type_t *) (fp->ctf_buf + cth->cth_stroff);
+
+  /* We make two passes through the entire type section.  In this first
+     pass, we count the number of each type and the total number of types.  */
+
+  for (tp = tbuf; tp < tend; fp->ctf_typemax++)
+    {
+      unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      unsigned long vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
+      ssize_t size, increment, vbytes;
+
+      (void) ctf_get_ctt_size (fp, tp, &size, &increment);
+      vbytes = LCTF_VBYTES (fp, kind, size, vlen);
+
+      if (vbytes < 0)
+	return ECTF_CORRUPT;
+
+      if (kind == CTF_K_FORWARD)
+	{
+	  /* For forward declarations, ctt_type is the CTF_K_* kind for the tag,
+	     so bump that population count too.  If ctt_type is unknown, treat
+	     the tag as a struct.  */
+
+	  if (tp->ctt_type == CTF_K_UNKNOWN || tp->ctt_type >= CTF_K_MAX)
+	    pop[CTF_K_STRUCT]++;
+	  else
+	    pop[tp->ctt_type]++;
+	}
+      tp = (ctf_type_t *) ((uintptr_t) tp + increment + vbytes);
+      pop[kind]++;
+    }
+
+  /* We determine whether the container is a child or a parent based on
+     the value of cth_parname.  */
+
+  if (cth->cth_parname != 0)
+    {
+      ctf_dprintf ("CTF container %p is a child\n", (void *) fp);
+      fp->ctf_flags |= LCTF_CHILD;
+    }
+  else
+    ctf_dprintf ("CTF container %p is a parent\n", (void *) fp);
+
+  /* In the second pass through the types, we fill in each entry of the type
+     table.  */
+
+  fp->ctf_txlate = ctf_alloc (sizeof (uint32_t) * (fp->ctf_typemax + 1));
+
+  if (fp->ctf_txlate == NULL)
+    return ENOMEM;		/* Memory allocation failed.  */
+
+  xp = fp->ctf_txlate;
+  *xp++ = 0;			/* Type id 0 is used as a sentinel value.  */
+
+  for (tp = tbuf; tp < tend; xp++)
+    {
+      unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      unsigned long vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
+      ssize_t size, increment, vbytes;
+
+      (void) ctf_get_ctt_size (fp, tp, &size, &increment);
+      vbytes = LCTF_VBYTES (fp, kind, size, vlen);
+
+      *xp = (uint32_t) ((uintptr_t) tp - (uintptr_t) fp->ctf_buf);
+      tp = (ctf_type_t *) ((uintptr_t) tp + increment + vbytes);
+    }
+
+  ctf_dprintf ("%lu total types processed\n", fp->ctf_typemax);
+
+  return init_names (fp, pop);
+}
+
+/* Build the hash tables and pointer table of a lazily-opened container, once
+   all its types are loaded.  */
+
+int
+ctf_init_names (ctf_file_t *fp)
+{
+  unsigned long pop[CTF_K_MAX + 1] = { 0 };
+  uint32_t id;
+
+  for (id = 1; id <= fp->ctf_typemax; id++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
+      unsigned short kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+
+      if (kind == CTF_K_FORWARD)
+	{
+	  if (tp->ctt_type == CTF_K_UNKNOWN || tp->ctt_type >= CTF_K_MAX)
+	    pop[CTF_K_STRUCT]++;
+	  else
+	    pop[tp->ctt_type]++;
+	}
+      pop[kind]++;
+    }
+
+  return init_names (fp, pop);
+}
+
+/* Free the hash tables and pointer table of FP.  */
+
+void
+ctf_fini_names (ctf_file_t *fp)
+{
+  if (fp->ctf_ptrtab != NULL)
+    ctf_free (fp->ctf_ptrtab, sizeof (uint32_t) * (fp->ctf_typemax + 1));
+  fp->ctf_ptrtab = NULL;
+
+  ctf_hash_destroy (&fp->ctf_structs);
+  ctf_hash_destroy (&fp->ctf_unions);
+  ctf_hash_destroy (&fp->ctf_enums);
+  ctf_hash_destroy (&fp->ctf_names);
+  memset (&fp->ctf_structs, 0, sizeof (ctf_hash_t));
+  memset (&fp->ctf_unions, 0, sizeof (ctf_hash_t));
+  memset (&fp->ctf_enums, 0, sizeof (ctf_hash_t));
+  memset (&fp->ctf_names, 0, sizeof (ctf_hash_t));
+}
+
+/* Decode the specified CTF buffer and optional symbol table and create a new
+   CTF container representing the symbolic debugging information.  If LAZY is
+   set, the buffer will outlive the container, so if it is chunked, the type
+   chunks can be inflated as they are used, and if it is compressed, they can
+   be thrown away and inflated again: see ctf-lazy.c.  */
+
+static ctf_file_t *
+ctf_bufopen_internal (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
+		      const ctf_sect_t *strsect, int lazy, int *errp)
 {
   const ctf_preamble_t *pp;
   ctf_header_t hp;
   ctf_file_t *fp;
+  ctf_lazy_t *lz = NULL;
   void *buf, *base;
-  size_t size, hdrsz;
+  size_t size, hdrsz, resident;
+  long ntypes = -1;
   int err;
 
   if (ctfsect == NULL || ((symsect == NULL) != (strsect == NULL)))
@@ -1014,6 +1177,11 @@ ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
      init_types().  */
 #endif /* !NO_COMPAT */
 
+  /* Only containers with no need of upgrading can be loaded lazily, since
+     upgrading needs every type.  */
+
+  lazy = lazy && hp.cth_version == CTF_VERSION;
+
   if (hp.cth_flags & CTF_F_COMPRESS)
     {
       size_t srclen, dstlen;
@@ -1024,33 +1192,65 @@ ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
 	return (ctf_set_open_errno (errp, ECTF_ZALLOC));
 
       memcpy (base, ctfsect->cts_data, hdrsz);
-      ((ctf_preamble_t *) base)->ctp_flags &= ~CTF_F_COMPRESS;
+      ((ctf_preamble_t *) base)->ctp_flags &= ~(CTF_F_COMPRESS
+						| CTF_F_CHUNKED);
       buf = (unsigned char *) base + hdrsz;
 
       src = (unsigned char *) ctfsect->cts_data + hdrsz;
       srclen = ctfsect->cts_size - hdrsz;
       dstlen = size;
 
-      if ((rc = uncompress (buf, &dstlen, src, srclen)) != Z_OK)
+      if (hp.cth_flags & CTF_F_CHUNKED)
 	{
-	  ctf_dprintf ("zlib inflate err: %s\n", zError (rc));
-	  ctf_data_free (base, size + hdrsz);
-	  return (ctf_set_open_errno (errp, ECTF_DECOMPRESS));
-	}
+	  if ((err = ctf_lazy_create (&hp, src, srclen, &lz)) == 0)
+	    err = ctf_lazy_inflate (lz, buf, !lazy);
 
-      if (dstlen != size)
-	{
-	  ctf_dprintf ("zlib inflate short -- got %lu of %lu "
-		       "bytes\n", (unsigned long) dstlen, (unsigned long) size);
-	  ctf_data_free (base, size + hdrsz);
-	  return (ctf_set_open_errno (errp, ECTF_CORRUPT));
+	  if (err != 0)
+	    {
+	      ctf_lazy_destroy (lz);
+	      ctf_data_free (base, size + hdrsz);
+	      return (ctf_set_open_errno (errp, err));
+	    }
+
+	  ntypes = ctf_lazy_ntypes (lz);
+	  if (!lazy)
+	    {
+	      ctf_lazy_destroy (lz);
+	      lz = NULL;
+	    }
 	}
+      else
+	{
+	  if ((rc = uncompress (buf, &dstlen, src, srclen)) != Z_OK)
+	    {
+	      ctf_dprintf ("zlib inflate err: %s\n", zError (rc));
+	      ctf_data_free (base, size + hdrsz);
+	      return (ctf_set_open_errno (errp, ECTF_DECOMPRESS));
+	    }
 
+	  if (dstlen != size)
+	    {
+	      ctf_dprintf ("zlib inflate short -- got %lu of %lu "
+			   "bytes\n", (unsigned long) dstlen,
+			   (unsigned long) size);
+	      ctf_data_free (base, size + hdrsz);
+	      return (ctf_set_open_errno (errp, ECTF_CORRUPT));
+	    }
+
+	  if (lazy && (err = ctf_lazy_create (&hp, src, srclen, &lz)) != 0)
+	    {
+	      ctf_data_free (base, size + hdrsz);
+	      return (ctf_set_open_errno (errp, err));
+	    }
+	}
     }
   else
     {
       base = (void *) ctfsect->cts_data;
       buf = (unsigned char *) base + hdrsz;
+
+      if (lazy && (err = ctf_lazy_create (&hp, NULL, 0, &lz)) != 0)
+	return (ctf_set_open_errno (errp, err));
     }
 
   /* Once we have uncompressed and validated the CTF data buffer, we can
@@ -1062,9 +1262,15 @@ ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
      ctf_set_base() and ctf_realloc_base().  */
 
   if ((fp = ctf_alloc (sizeof (ctf_file_t))) == NULL)
-    return (ctf_set_open_errno (errp, ENOMEM));
+    {
+      ctf_lazy_destroy (lz);
+      if (base != (void *) ctfsect->cts_data)
+	ctf_data_free (base, size + hdrsz);
+      return (ctf_set_open_errno (errp, ENOMEM));
+    }
 
   memset (fp, 0, sizeof (ctf_file_t));
+  fp->ctf_lazy = lz;
   ctf_set_version (fp, &hp, hp.cth_version);
 
 #ifndef NO_COMPAT
@@ -1107,7 +1313,36 @@ ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
   ctf_set_base (fp, &hp, base);
   fp->ctf_size = size + hdrsz;
 
-  if ((err = init_types (fp, &hp)) != 0)
+  /* A lazily-loaded chunked container knows how many types it has from its
+     chunk index, and fills in its type translation table as chunks are
+     loaded.  */
+
+  if (lz != NULL && (hp.cth_flags & CTF_F_CHUNKED))
+    {
+      fp->ctf_typemax = ntypes;
+      if (hp.cth_parname != 0)
+	fp->ctf_flags |= LCTF_CHILD;
+
+      if ((fp->ctf_txlate = ctf_alloc (sizeof (uint32_t)
+				       * (fp->ctf_typemax + 1))) == NULL)
+	{
+	  (void) ctf_set_open_errno (errp, ENOMEM);
+	  goto bad;
+	}
+      memset (fp->ctf_txlate, 0, sizeof (uint32_t) * (fp->ctf_typemax + 1));
+    }
+  else if ((err = init_types (fp, &hp)) != 0)
+    {
+      (void) ctf_set_open_errno (errp, err);
+      goto bad;
+    }
+  else if (ntypes >= 0 && fp->ctf_typemax != (unsigned long) ntypes)
+    {
+      (void) ctf_set_open_errno (errp, ECTF_CORRUPT);
+      goto bad;
+    }
+
+  if ((err = init_varbloom (fp)) != 0)
     {
       (void) ctf_set_open_errno (errp, err);
       goto bad;
@@ -1116,30 +1351,23 @@ ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
   /* The ctf region may have been reallocated by init_types(), but now
      that is done, it will not move again, so we can protect it, as long
      as it didn't come from the ctfsect, wihcih might have been allocated
-     with malloc().  */
+     with malloc(), and as long as it was not opened lazily, so that no
+     chunks will ever be inflated into it.  */
 
-  if (fp->ctf_base != (void *) ctfsect->cts_data)
+  if (fp->ctf_base != (void *) ctfsect->cts_data && lz == NULL)
     ctf_data_protect ((void *) fp->ctf_base, fp->ctf_size);
 
-  /* If we have a symbol table section, allocate and initialize
-     the symtab translation table, pointed to by ctf_sxlate.  */
+  /* If we have a symbol table section, prepare to fill in the symtab
+     translation table, pointed to by ctf_sxlate, when it is first used.  */
 
   if (symsect != NULL)
     {
       fp->ctf_nsyms = symsect->cts_size / symsect->cts_entsize;
-      fp->ctf_sxlate = ctf_alloc (fp->ctf_nsyms * sizeof (uint32_t));
-
-      if (fp->ctf_sxlate == NULL)
-	{
-	  (void) ctf_set_open_errno (errp, ENOMEM);
-	  goto bad;
-	}
-
-      if ((err = init_symtab (fp, &hp, symsect, strsect)) != 0)
-	{
-	  (void) ctf_set_open_errno (errp, err);
-	  goto bad;
-	}
+      fp->ctf_sxfill.csx_next = 0;
+      fp->ctf_sxfill.csx_objtoff = hp.cth_objtoff;
+      fp->ctf_sxfill.csx_funcoff = hp.cth_funcoff;
+      fp->ctf_sxfill.csx_objtend = hp.cth_funcoff;
+      fp->ctf_sxfill.csx_funcend = hp.cth_typeoff;
     }
 
   /* Initialize the ctf_lookup_by_name top-level dictionary.  We keep an
@@ -1171,7 +1399,16 @@ ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
   else
     (void) ctf_setmodel (fp, CTF_MODEL_NATIVE);
 
+  fp->ctf_zlevel = Z_DEFAULT_COMPRESSION;
+  fp->ctf_zstrategy = Z_DEFAULT_STRATEGY;
   fp->ctf_refcnt = 1;
+
+  /* Whatever of a lazily-opened container can be thrown away and rebuilt is
+     now subject to the residency budget.  */
+
+  if (lz != NULL && (resident = ctf_lazy_resident (fp)) != 0)
+    ctf_resid_add (fp, resident);
+
   return fp;
 
 bad:
@@ -1179,6 +1416,28 @@ bad:
   return NULL;
 }
 
+/* Decode the specified CTF buffer and optional symbol table and create a new
+   CTF container representing the symbolic debugging information.  This code
+   can be used directly by the debugger, or it can be used as the engine for
+   ctf_fdopen() or ctf_open(), below.  */
+
+ctf_file_t *
+ctf_bufopen (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
+	     const ctf_sect_t *strsect, int *errp)
+{
+  return ctf_bufopen_internal (ctfsect, symsect, strsect, 0, errp);
+}
+
+/* Like ctf_bufopen(), but for buffers that the caller guarantees will last
+   as long as the container, which can therefore be loaded lazily.  */
+
+ctf_file_t *
+ctf_bufopen_lazy (const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
+		  const ctf_sect_t *strsect, int *errp)
+{
+  return ctf_bufopen_internal (ctfsect, symsect, strsect, 1, errp);
+}
+
 /* Close the specified CTF container and free associated data structures.  Note
    that ctf_close() is a reference counted operation: if the specified file is
    the parent of other active containers, its reference count will be greater
@@ -1201,10 +1460,18 @@ ctf_close (ctf_file_t *fp)
       return;
     }
 
+  ctf_pub_destroy (fp);
+
+  /* Stop any eviction before freeing what it might free.  */
+
+  ctf_resid_forget (fp);
+
   if (fp->ctf_dynparname != NULL)
     ctf_free (fp->ctf_dynparname, strlen (fp->ctf_dynparname) + 1);
 
-  if (fp->ctf_parent != NULL)
+  /* Snapshots do not hold a reference to their parent.  */
+
+  if (fp->ctf_parent != NULL && !(fp->ctf_flags & LCTF_SNAPSHOT))
     ctf_close (fp->ctf_parent);
 
   for (dtd = ctf_list_next (&fp->ctf_dtdefs); dtd != NULL; dtd = ntd)
@@ -1255,13 +1522,13 @@ ctf_close (ctf_file_t *fp)
   if (fp->ctf_txlate != NULL)
       ctf_free (fp->ctf_txlate, sizeof (uint32_t) * (fp->ctf_typemax + 1));
 
-  if (fp->ctf_ptrtab != NULL)
-      ctf_free (fp->ctf_ptrtab, sizeof (uint32_t) * (fp->ctf_typemax + 1));
-
-  ctf_hash_destroy (&fp->ctf_structs);
-  ctf_hash_destroy (&fp->ctf_unions);
-  ctf_hash_destroy (&fp->ctf_enums);
-  ctf_hash_destroy (&fp->ctf_names);
+  ctf_typesum_destroy (fp);
+  ctf_nameidx_destroy (fp);
+  ctf_fpidx_destroy (fp);
+  ctf_membidx_destroy (fp);
+  ctf_bloom_destroy (&fp->ctf_varbloom);
+  ctf_fini_names (fp);
+  ctf_lazy_destroy (fp->ctf_lazy);
 
   ctf_free (fp, sizeof (ctf_file_t));
 }
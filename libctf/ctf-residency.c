@@ -0,0 +1,224 @@
+/* Memory-budgeted residency of rebuildable container state.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <pthread.h>
+
+/* Several structures hanging off a container are built lazily on first use
+   and can be thrown away and rebuilt at any time: the type summary table, the
+   sorted name indexes, the fingerprint index and the member indexes.  So can
+   the name hashes and pointer table of containers opened by ctf_fdopen() or
+   ctf_arc_open_by_name(), and, if those are compressed, the memory holding
+   their inflated types, which can be inflated again from the compressed data
+   still mapped (see ctf-lazy.c).  A long-running consumer that touches many
+   containers accumulates all this forever, so we account for it against a
+   process-wide budget.  Containers holding such state sit on a list in order
+   of last use; when the total exceeds the budget, the state of the least
+   recently used containers is freed until it fits again, to be rebuilt
+   transparently if those containers are used again.
+
+   Everything else (the strings, variables, labels and symbol sections, and the
+   type translation table) stays put, since callers are handed pointers into
+   it.  Published snapshots (see ctf_publish()) are never tracked.
+
+   Every library function that looks at a container's types or rebuildable
+   state holds it, and its parent, while it does so, taking the hold before
+   loading any pointer to that state; iterators and name cursors hold it
+   across calls.  Eviction skips held containers.  A hold is a counter bumped
+   without taking any lock, so that readers on many threads do not contend; an
+   evictor flags the container before checking the counter, and a new holder
+   checks the flag after bumping it, so either the evictor sees the hold and
+   leaves the container alone, or the holder sees the flag and waits for the
+   eviction to finish before using anything.  */
+
+static pthread_mutex_t ctf_resid_lock = PTHREAD_MUTEX_INITIALIZER;
+static ctf_list_t ctf_resid_lru;	/* Least recently used first.  */
+static size_t ctf_resid_budget;		/* Zero if unlimited.  */
+static size_t ctf_resid_total;		/* Bytes accounted for.  */
+
+/* Free all the rebuildable state of FP, unless it is in use.  Called with the
+   lock held.  */
+
+static void
+ctf_resid_evict (ctf_file_t *fp)
+{
+  ctf_resid_t *cr = &fp->ctf_resid;
+
+  __atomic_store_n (&cr->cr_evicting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&cr->cr_holds, __ATOMIC_SEQ_CST) != 0
+      || (fp->ctf_lazy != NULL && ctf_lazy_evict (fp) != 0))
+    {
+      __atomic_store_n (&cr->cr_evicting, 0, __ATOMIC_RELEASE);
+      return;
+    }
+
+  ctf_dprintf ("Evicting %lu bytes of state from %p\n",
+	       (unsigned long) cr->cr_bytes, (void *) fp);
+
+  ctf_list_delete (&ctf_resid_lru, cr);
+  ctf_resid_total -= cr->cr_bytes;
+  cr->cr_bytes = 0;
+  cr->cr_linked = 0;
+
+  ctf_typesum_destroy (fp);
+  ctf_nameidx_destroy (fp);
+  ctf_fpidx_destroy (fp);
+  ctf_membidx_destroy (fp);
+
+  __atomic_store_n (&cr->cr_evicting, 0, __ATOMIC_RELEASE);
+}
+
+/* Evict least-recently-used state until no more than TARGET bytes remain,
+   sparing KEEP, which is in use.  Called with the lock held.  */
+
+static void
+ctf_resid_shrink (size_t target, ctf_file_t *keep)
+{
+  ctf_resid_t *cr, *ncr;
+
+  for (cr = ctf_list_next (&ctf_resid_lru);
+       cr != NULL && ctf_resid_total > target; cr = ncr)
+    {
+      ncr = ctf_list_next (cr);
+      if (cr->cr_fp != keep)
+	ctf_resid_evict (cr->cr_fp);
+    }
+}
+
+/* Account for BYTES of newly-built rebuildable state in FP, which is now the
+   most recently used container, evicting state from others if the budget is
+   exceeded.  */
+
+void
+ctf_resid_add (ctf_file_t *fp, size_t bytes)
+{
+  size_t budget;
+
+  if (fp->ctf_flags & LCTF_SNAPSHOT)
+    return;
+
+  pthread_mutex_lock (&ctf_resid_lock);
+
+  if (fp->ctf_resid.cr_linked)
+    ctf_list_delete (&ctf_resid_lru, &fp->ctf_resid);
+
+  fp->ctf_resid.cr_fp = fp;
+  fp->ctf_resid.cr_bytes += bytes;
+  fp->ctf_resid.cr_linked = 1;
+  ctf_list_append (&ctf_resid_lru, &fp->ctf_resid);
+  ctf_resid_total += bytes;
+
+  budget = ctf_resid_budget;
+  if (budget != 0 && ctf_resid_total > budget)
+    ctf_resid_shrink (budget, fp);
+
+  pthread_mutex_unlock (&ctf_resid_lock);
+}
+
+/* Note a use of the rebuildable state in FP.  This only matters when a budget
+   is set, so we avoid taking the lock otherwise.  */
+
+void
+ctf_resid_touch (ctf_file_t *fp)
+{
+  if (__atomic_load_n (&ctf_resid_budget, __ATOMIC_RELAXED) == 0
+      || (fp->ctf_flags & LCTF_SNAPSHOT))
+    return;
+
+  pthread_mutex_lock (&ctf_resid_lock);
+  if (fp->ctf_resid.cr_linked)
+    {
+      ctf_list_delete (&ctf_resid_lru, &fp->ctf_resid);
+      ctf_list_append (&ctf_resid_lru, &fp->ctf_resid);
+    }
+  pthread_mutex_unlock (&ctf_resid_lock);
+}
+
+static void
+ctf_resid_hold_1 (ctf_file_t *fp)
+{
+  ctf_resid_t *cr = &fp->ctf_resid;
+
+  __atomic_add_fetch (&cr->cr_holds, 1, __ATOMIC_SEQ_CST);
+
+  /* If an eviction is under way, it started before our hold was seen, so let
+     it finish: it holds the lock throughout.  Later ones see our hold.  */
+
+  if (__atomic_load_n (&cr->cr_evicting, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock (&ctf_resid_lock);
+      pthread_mutex_unlock (&ctf_resid_lock);
+    }
+}
+
+/* Hold the rebuildable state of FP and of its parent in memory until the
+   matching ctf_resid_release().  */
+
+void
+ctf_resid_hold (ctf_file_t *fp)
+{
+  ctf_resid_hold_1 (fp);
+  if (fp->ctf_parent != NULL)
+    ctf_resid_hold_1 (fp->ctf_parent);
+}
+
+void
+ctf_resid_release (ctf_file_t *fp)
+{
+  if (fp->ctf_parent != NULL)
+    __atomic_sub_fetch (&fp->ctf_parent->ctf_resid.cr_holds, 1,
+			__ATOMIC_SEQ_CST);
+  __atomic_sub_fetch (&fp->ctf_resid.cr_holds, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Stop accounting for FP, whose rebuildable state is about to be freed or
+   moved elsewhere by ctf_close() or ctf_update().  */
+
+void
+ctf_resid_forget (ctf_file_t *fp)
+{
+  pthread_mutex_lock (&ctf_resid_lock);
+  if (fp->ctf_resid.cr_linked)
+    {
+      ctf_list_delete (&ctf_resid_lru, &fp->ctf_resid);
+      ctf_resid_total -= fp->ctf_resid.cr_bytes;
+      fp->ctf_resid.cr_bytes = 0;
+      fp->ctf_resid.cr_linked = 0;
+    }
+  pthread_mutex_unlock (&ctf_resid_lock);
+}
+
+/* Set the budget for rebuildable state across all containers, in bytes, and
+   evict state until it is met.  Zero means no limit, the default.  */
+
+void
+ctf_residency_set_budget (size_t bytes)
+{
+  pthread_mutex_lock (&ctf_resid_lock);
+  __atomic_store_n (&ctf_resid_budget, bytes, __ATOMIC_RELAXED);
+  if (bytes != 0)
+    ctf_resid_shrink (bytes, NULL);
+  pthread_mutex_unlock (&ctf_resid_lock);
+}
+
+/* Evict rebuildable state until no more than BYTES remain resident, regardless
+   of the budget, and return the number of bytes still resident.  */
+
+size_t
+ctf_residency_trim (size_t bytes)
+{
+  size_t total;
+
+  pthread_mutex_lock (&ctf_resid_lock);
+  ctf_resid_shrink (bytes, NULL);
+  total = ctf_resid_total;
+  pthread_mutex_unlock (&ctf_resid_lock);
+
+  return total;
+}
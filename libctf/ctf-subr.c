@@ -11,6 +11,7 @@
 #include <sys/mman.h>
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
 
 void *
 ctf_data_alloc (size_t size)
@@ -31,6 +32,20 @@ ctf_data_protect (void *buf, size_t size)
   (void) mprotect (buf, size, PROT_READ);
 }
 
+/* Give back the memory behind the whole pages within SIZE bytes at BUF, part
+   of a buffer from ctf_data_alloc(), which will read as zeroes thereafter.  */
+
+void
+ctf_data_discard (void *buf, size_t size)
+{
+  uintptr_t pgsz = sysconf (_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t) buf + pgsz - 1) & ~(pgsz - 1);
+  uintptr_t end = ((uintptr_t) buf + size) & ~(pgsz - 1);
+
+  if (start < end)
+    (void) madvise ((void *) start, end - start, MADV_DONTNEED);
+}
+
 void *
 ctf_alloc (size_t size)
 {
@@ -0,0 +1,264 @@
+/* Structure-of-arrays summary of the types in a container.
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+#include <ctf-impl.h>
+#include <string.h>
+
+/* Queries that want to look at one or two properties of every type in a
+   container (all root structs larger than N bytes, all pointers to some type,
+   and so on) are poorly served by the type records themselves, which are of
+   variable length and must be decoded one by one through the fileops.  So we
+   can lazily build a summary table holding the commonly-queried properties of
+   each type in dense, parallel arrays indexed by type index, and scan those in
+   fixed-size blocks with branch-free comparisons which the compiler can turn
+   into vector code.
+
+   The table is built on first use and never modified thereafter.  It describes
+   only committed types, like the other read-side structures: ctf_update()
+   leaves the old table behind in the container it swaps out, so it is freed
+   along with that.  */
+
+#define CTF_SUMMARY_BLOCK 256	/* Types matched per block.  */
+
+static ctf_typesum_t *
+ctf_typesum_build (ctf_file_t *fp)
+{
+  ctf_typesum_t *ts;
+  unsigned long n = fp->ctf_typemax + 1;
+  unsigned long i;
+  size_t size;
+  char *p;
+
+  size = sizeof (ctf_typesum_t) + n * (sizeof (uint64_t)
+				       + 3 * sizeof (uint32_t)
+				       + 2 * sizeof (unsigned char));
+
+  if ((ts = ctf_alloc (size)) == NULL)
+    return NULL;
+
+  /* Carve the arrays out of one allocation, most-aligned first.  */
+
+  p = (char *) ts + sizeof (ctf_typesum_t);
+  ts->cts_size = (uint64_t *) p;
+  p += n * sizeof (uint64_t);
+  ts->cts_vlen = (uint32_t *) p;
+  p += n * sizeof (uint32_t);
+  ts->cts_name = (uint32_t *) p;
+  p += n * sizeof (uint32_t);
+  ts->cts_ref = (uint32_t *) p;
+  p += n * sizeof (uint32_t);
+  ts->cts_kind = (unsigned char *) p;
+  p += n;
+  ts->cts_root = (unsigned char *) p;
+  ts->cts_ntypes = n;
+  ts->cts_alloc = size;
+
+  /* Slot 0 is never a valid type: make sure it never matches anything.  */
+
+  ts->cts_size[0] = 0;
+  ts->cts_vlen[0] = 0;
+  ts->cts_name[0] = 0;
+  ts->cts_ref[0] = 0;
+  ts->cts_kind[0] = CTF_K_UNKNOWN;
+  ts->cts_root[0] = 0;
+
+  for (i = 1; i < n; i++)
+    {
+      const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, i);
+      uint32_t kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+      ssize_t size;
+
+      ts->cts_kind[i] = kind;
+      ts->cts_root[i] = LCTF_INFO_ISROOT (fp, tp->ctt_info) != 0;
+      ts->cts_vlen[i] = LCTF_INFO_VLEN (fp, tp->ctt_info);
+      ts->cts_name[i] = tp->ctt_name;
+      ts->cts_ref[i] = 0;
+      ts->cts_size[i] = 0;
+
+      switch (kind)
+	{
+	case CTF_K_POINTER:
+	case CTF_K_TYPEDEF:
+	case CTF_K_VOLATILE:
+	case CTF_K_CONST:
+	case CTF_K_RESTRICT:
+	case CTF_K_FUNCTION:
+	  ts->cts_ref[i] = tp->ctt_type;
+	  break;
+	default:
+	  (void) ctf_get_ctt_size (fp, tp, &size, NULL);
+	  ts->cts_size[i] = size;
+	}
+    }
+
+  return ts;
+}
+
+/* Return the summary table for this container, building it if need be.
+
+   Concurrent readers may race to build it: the loser frees its copy.  */
+
+static const ctf_typesum_t *
+ctf_typesum (ctf_file_t *fp)
+{
+  ctf_typesum_t *ts, *old = NULL;
+  int err;
+
+  if ((ts = __atomic_load_n (&fp->ctf_typesum, __ATOMIC_ACQUIRE)) != NULL)
+    {
+      ctf_resid_touch (fp);
+      return ts;
+    }
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    {
+      (void) ctf_set_errno (fp, err);
+      return NULL;
+    }
+
+  if ((ts = ctf_typesum_build (fp)) == NULL)
+    {
+      (void) ctf_set_errno (fp, EAGAIN);
+      return NULL;
+    }
+
+  if (!__atomic_compare_exchange_n (&fp->ctf_typesum, &old, ts, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      ctf_free (ts, ts->cts_alloc);
+      ts = old;
+    }
+  else
+    ctf_resid_add (fp, ts->cts_alloc);
+
+  return ts;
+}
+
+/* Free the summary table, if any.  */
+
+void
+ctf_typesum_destroy (ctf_file_t *fp)
+{
+  if (fp->ctf_typesum != NULL)
+    ctf_free (fp->ctf_typesum, fp->ctf_typesum->cts_alloc);
+  fp->ctf_typesum = NULL;
+}
+
+/* Call FUNC for every type in the container that satisfies QUERY, in ascending
+   type ID order.  A NULL QUERY matches every type.  Returns zero if the
+   iteration completed, the nonzero return value of FUNC if it stopped early,
+   or CTF_ERR on error.  */
+
+int
+ctf_type_select (ctf_file_t *fp, const ctf_typequery_t *query,
+		 ctf_type_f *func, void *arg)
+{
+  static const ctf_typequery_t all = { -1, 0, 0, 0, 0, NULL };
+  const ctf_typesum_t *ts;
+  unsigned char match[CTF_SUMMARY_BLOCK];
+  int child = (fp->ctf_flags & LCTF_CHILD);
+  unsigned long base, n;
+  uint64_t minsize, maxsize;
+  uint32_t ref;
+  int anykind;
+  unsigned char kind;
+  unsigned char rootonly;
+
+  if (query == NULL)
+    query = &all;
+
+  /* Hold the container before getting at its table, so that it cannot be
+     evicted while we use it, nor while FUNC does.  */
+
+  ctf_resid_hold (fp);
+
+  if ((ts = ctf_typesum (fp)) == NULL)
+    {
+      ctf_resid_release (fp);
+      return CTF_ERR;			/* errno is set for us.  */
+    }
+
+  anykind = query->ctq_kind < 0;
+  kind = anykind ? 0 : query->ctq_kind;
+  rootonly = query->ctq_rootonly != 0;
+  minsize = query->ctq_minsize;
+  maxsize = query->ctq_maxsize ? query->ctq_maxsize : UINT64_MAX;
+
+  /* References are recorded as raw type IDs, which is what the caller will
+     have passed in.  */
+  ref = (uint32_t) query->ctq_ref;
+
+  for (base = 1; base < ts->cts_ntypes; base += n)
+    {
+      const unsigned char *kinds = &ts->cts_kind[base];
+      const unsigned char *roots = &ts->cts_root[base];
+      const uint64_t *sizes = &ts->cts_size[base];
+      const uint32_t *refs = &ts->cts_ref[base];
+      unsigned long i;
+
+      n = ts->cts_ntypes - base;
+      if (n > CTF_SUMMARY_BLOCK)
+	n = CTF_SUMMARY_BLOCK;
+
+      /* This loop must stay free of branches and calls, or it will not
+	 vectorize.  */
+
+      for (i = 0; i < n; i++)
+	match[i] = ((anykind | (kinds[i] == kind))
+		    & (roots[i] | !rootonly)
+		    & (sizes[i] >= minsize) & (sizes[i] <= maxsize)
+		    & ((ref == 0) | (refs[i] == ref)));
+
+      for (i = 0; i < n; i++)
+	{
+	  int rc;
+
+	  if (!match[i])
+	    continue;
+
+	  if (query->ctq_name != NULL)
+	    {
+	      const char *name = ctf_strraw (fp, ts->cts_name[base + i]);
+
+	      if (name == NULL || strcmp (name, query->ctq_name) != 0)
+		continue;
+	    }
+
+	  if ((rc = func (LCTF_INDEX_TO_TYPE (fp, base + i, child), arg)) != 0)
+	    {
+	      ctf_resid_release (fp);
+	      return rc;
+	    }
+	}
+    }
+
+  ctf_resid_release (fp);
+  return 0;
+}
+
+static int
+ctf_type_count_one (ctf_id_t id _libctf_unused_, void *arg)
+{
+  (*(unsigned long *) arg)++;
+  return 0;
+}
+
+/* Return the number of types in the container that satisfy QUERY, or CTF_ERR
+   on error.  */
+
+long
+ctf_type_count (ctf_file_t *fp, const ctf_typequery_t *query)
+{
+  unsigned long count = 0;
+
+  if (ctf_type_select (fp, query, ctf_type_count_one, &count) == CTF_ERR)
+    return CTF_ERR;
+
+  return count;
+}
@@ -27,8 +27,9 @@ ctf_type_ischild (ctf_file_t * fp, ctf_id_t id)
 /* Iterate over the members of a STRUCT or UNION.  We pass the name, member
    type, and offset of each member to the specified callback function.  */
 
-int
-ctf_member_iter (ctf_file_t *fp, ctf_id_t type, ctf_member_f *func, void *arg)
+static int
+ctf_member_iter_held (ctf_file_t *fp, ctf_id_t type, ctf_member_f *func,
+		      void *arg)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
@@ -78,11 +79,23 @@ ctf_member_iter (ctf_file_t *fp, ctf_id_t type, ctf_member_f *func, void *arg)
   return 0;
 }
 
+int
+ctf_member_iter (ctf_file_t *fp, ctf_id_t type, ctf_member_f *func, void *arg)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_member_iter_held (fp, type, func, arg);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Iterate over the members of an ENUM.  We pass the string name and associated
    integer value of each enum element to the specified callback function.  */
 
-int
-ctf_enum_iter (ctf_file_t *fp, ctf_id_t type, ctf_enum_f *func, void *arg)
+static int
+ctf_enum_iter_held (ctf_file_t *fp, ctf_id_t type, ctf_enum_f *func,
+		    void *arg)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
@@ -114,6 +127,17 @@ ctf_enum_iter (ctf_file_t *fp, ctf_id_t type, ctf_enum_f *func, void *arg)
   return 0;
 }
 
+int
+ctf_enum_iter (ctf_file_t *fp, ctf_id_t type, ctf_enum_f *func, void *arg)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_enum_iter_held (fp, type, func, arg);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Iterate over every root (user-visible) type in the given CTF container.
    We pass the type ID of each type to the specified callback function.  */
 
@@ -123,14 +147,151 @@ ctf_type_iter (ctf_file_t *fp, ctf_type_f *func, void *arg)
   ctf_id_t id, max = fp->ctf_typemax;
   int rc, child = (fp->ctf_flags & LCTF_CHILD);
 
-  for (id = 1; id <= max; id++)
+  ctf_resid_hold (fp);
+
+  if ((rc = ctf_lazy_load_all (fp)) != 0)
+    rc = ctf_set_errno (fp, rc);
+
+  for (id = 1; rc == 0 && id <= max; id++)
     {
       const ctf_type_t *tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
-      if (LCTF_INFO_ISROOT (fp, tp->ctt_info)
-	  && (rc = func (LCTF_INDEX_TO_TYPE (fp, id, child), arg)) != 0)
-	return rc;
+      if (LCTF_INFO_ISROOT (fp, tp->ctt_info))
+	rc = func (LCTF_INDEX_TO_TYPE (fp, id, child), arg);
+    }
+
+  ctf_resid_release (fp);
+  return rc;
+}
+
+/* Translate a type ID bounding a range of types in FP into an index, which
+   may be one past the last type.  Returns -1 if out of range.  */
+
+static long
+ctf_range_index (ctf_file_t *fp, ctf_id_t id)
+{
+  long idx = id;
+
+  if (fp->ctf_flags & LCTF_CHILD)
+    idx -= (long) fp->ctf_parmax + 1;
+
+  if (idx < 1 || (unsigned long) idx > fp->ctf_typemax + 1)
+    return -1;
+  return idx;
+}
+
+/* Iterate over the root types in the given CTF container whose IDs are at
+   least LO and less than HI, as ctf_type_iter() does.  HI may be one past the
+   last type in the container.
+
+   Several threads may iterate over disjoint or overlapping ranges of the same
+   container at once, as long as nothing modifies it meanwhile: the type table
+   is only read.  ctf_type_partition() splits a container into ranges of
+   similar cost for this.  */
+
+int
+ctf_type_iter_range (ctf_file_t *fp, ctf_id_t lo, ctf_id_t hi,
+		     ctf_type_f *func, void *arg)
+{
+  long id, lidx, hidx;
+  int rc, child = (fp->ctf_flags & LCTF_CHILD);
+
+  if ((lidx = ctf_range_index (fp, lo)) < 0
+      || (hidx = ctf_range_index (fp, hi)) < 0 || lidx > hidx)
+    return (ctf_set_errno (fp, EINVAL));
+
+  ctf_resid_hold (fp);
+
+  for (rc = 0, id = lidx; rc == 0 && id < hidx; id++)
+    {
+      const ctf_type_t *tp;
+
+      /* Each range only loads the types it covers, so that ranges iterated
+	 in parallel load theirs in parallel too.  */
+
+      if ((rc = ctf_lazy_load (fp, id)) != 0)
+	{
+	  rc = ctf_set_errno (fp, rc);
+	  break;
+	}
+
+      tp = LCTF_INDEX_TO_TYPEPTR (fp, id);
+      if (LCTF_INFO_ISROOT (fp, tp->ctt_info))
+	rc = func (LCTF_INDEX_TO_TYPE (fp, id, child), arg);
+    }
+
+  ctf_resid_release (fp);
+  return rc;
+}
+
+/* Return the offset of the type record with index IDX, which may be one past
+   the last type, relative to the start of the type section.  */
+
+static size_t
+ctf_type_recoff (ctf_file_t *fp, unsigned long idx)
+{
+  const ctf_header_t *hp = (const ctf_header_t *) fp->ctf_base;
+
+  if (idx > fp->ctf_typemax)
+    return hp->cth_stroff - hp->cth_typeoff;
+  return fp->ctf_txlate[idx] - hp->cth_typeoff;
+}
+
+/* Split the types in the given CTF container into NPARTS contiguous ranges
+   holding similar numbers of bytes of type records, which is a better guide to
+   the cost of visiting them than the number of types.  Range I runs from
+   BOUNDS[I] up to but not including BOUNDS[I + 1], suitable for passing to
+   ctf_type_iter_range(); BOUNDS must have room for NPARTS + 1 IDs.  Some
+   ranges may be empty if there are few types.  */
+
+int
+ctf_type_partition (ctf_file_t *fp, int nparts, ctf_id_t *bounds)
+{
+  int child = (fp->ctf_flags & LCTF_CHILD);
+  unsigned long idx = 1;
+  size_t total;
+  int i, err;
+
+  if (nparts < 1 || bounds == NULL)
+    return (ctf_set_errno (fp, EINVAL));
+
+  ctf_resid_hold (fp);
+
+  if ((err = ctf_lazy_load_all (fp)) != 0)
+    {
+      ctf_resid_release (fp);
+      return (ctf_set_errno (fp, err));
+    }
+
+  total = ctf_type_recoff (fp, fp->ctf_typemax + 1);
+  bounds[0] = LCTF_INDEX_TO_TYPE (fp, 1, child);
+
+  /* Each boundary is the first type starting at or after its share of the
+     bytes.  Record offsets increase with index, so binary-search for it,
+     starting from the previous boundary.  */
+
+  for (i = 1; i <= nparts; i++)
+    {
+      size_t want = (uint64_t) total * i / nparts;
+      unsigned long lo = idx, hi = fp->ctf_typemax + 1;
+
+      if (i == nparts)
+	lo = hi;
+
+      while (lo < hi)
+	{
+	  unsigned long mid = lo + (hi - lo) / 2;
+
+	  if (ctf_type_recoff (fp, mid) < want)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+
+      idx = lo;
+      bounds[i] = LCTF_INDEX_TO_TYPE (fp, idx, child);
     }
 
+  ctf_resid_release (fp);
   return 0;
 }
 
@@ -160,16 +321,20 @@ ctf_variable_iter (ctf_file_t *fp, ctf_variable_f *func, void *arg)
    against infinite loops, we implement simplified cycle detection and check
    each link against itself, the previous node, and the topmost node.  */
 
-ctf_id_t
-ctf_type_resolve (ctf_file_t * fp, ctf_id_t type)
+/* Resolve TYPE, whose type record *TPP is in container *FPP, as
+   ctf_type_resolve() does, leaving the record of the resolved type in *TPP
+   and its container in *FPP.  Errors are reported on OFP.  */
+
+static ctf_id_t
+ctf_type_resolve_tp (ctf_file_t *ofp, ctf_file_t **fpp, ctf_id_t type,
+		     const ctf_type_t **tpp)
 {
   ctf_id_t prev = type, otype = type;
-  ctf_file_t *ofp = fp;
-  const ctf_type_t *tp;
+  const ctf_type_t *tp = *tpp;
 
-  while ((tp = ctf_lookup_by_id (&fp, type)) != NULL)
+  for (;;)
     {
-      switch (LCTF_INFO_KIND (fp, tp->ctt_info))
+      switch (LCTF_INFO_KIND (*fpp, tp->ctt_info))
 	{
 	case CTF_K_TYPEDEF:
 	case CTF_K_VOLATILE:
@@ -183,13 +348,30 @@ ctf_type_resolve (ctf_file_t * fp, ctf_id_t type)
 	    }
 	  prev = type;
 	  type = tp->ctt_type;
+	  if ((tp = ctf_lookup_by_id (fpp, type)) == NULL)
+	    return CTF_ERR;	/* errno is set for us.  */
 	  break;
 	default:
+	  *tpp = tp;
 	  return type;
 	}
     }
+}
+
+ctf_id_t
+ctf_type_resolve (ctf_file_t * fp, ctf_id_t type)
+{
+  const ctf_type_t *tp;
+  ctf_file_t *ofp = fp;
+
+  ctf_resid_hold (ofp);
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+    type = CTF_ERR;		/* errno is set for us.  */
+  else
+    type = ctf_type_resolve_tp (ofp, &fp, type, &tp);
+  ctf_resid_release (ofp);
 
-  return CTF_ERR;		/* errno is set for us.  */
+  return type;
 }
 
 /* Lookup the given type ID and print a string name for it into buf.  Return
@@ -207,12 +389,14 @@ ctf_type_lname (ctf_file_t *fp, ctf_id_t type, char *buf, size_t len)
   if (fp == NULL && type == CTF_ERR)
     return -1;		/* Simplify caller code by permitting CTF_ERR.  */
 
+  ctf_resid_hold (fp);
   ctf_decl_init (&cd, buf, len);
   ctf_decl_push (&cd, fp, type);
 
   if (cd.cd_err != 0)
     {
       ctf_decl_fini (&cd);
+      ctf_resid_release (fp);
       return (ctf_set_errno (fp, cd.cd_err));
     }
 
@@ -296,6 +480,7 @@ ctf_type_lname (ctf_file_t *fp, ctf_id_t type, char *buf, size_t len)
     (void) ctf_set_errno (fp, ECTF_NAMELEN);
 
   ctf_decl_fini (&cd);
+  ctf_resid_release (fp);
   return cd.cd_len;
 }
 
@@ -309,22 +494,15 @@ ctf_type_name (ctf_file_t *fp, ctf_id_t type, char *buf, size_t len)
   return (rv >= 0 && (size_t) rv < len ? buf : NULL);
 }
 
-/* Resolve the type down to a base type node, and then return the size
-   of the type storage in bytes.  */
+/* Return the size of the already-resolved TYPE, whose type record TP is in
+   container FP.  */
 
-ssize_t
-ctf_type_size (ctf_file_t *fp, ctf_id_t type)
+static ssize_t
+ctf_type_size_tp (ctf_file_t *fp, ctf_id_t type, const ctf_type_t *tp)
 {
-  const ctf_type_t *tp;
   ssize_t size;
   ctf_arinfo_t ar;
 
-  if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
-    return -1;			/* errno is set for us.  */
-
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return -1;			/* errno is set for us.  */
-
   switch (LCTF_INFO_KIND (fp, tp->ctt_info))
     {
     case CTF_K_POINTER:
@@ -357,22 +535,34 @@ ctf_type_size (ctf_file_t *fp, ctf_id_t type)
     }
 }
 
-/* Resolve the type down to a base type node, and then return the alignment
-   needed for the type storage in bytes.
-
-   XXX may need arch-dependent attention.  */
+/* Resolve the type down to a base type node, and then return the size
+   of the type storage in bytes.  */
 
 ssize_t
-ctf_type_align (ctf_file_t *fp, ctf_id_t type)
+ctf_type_size (ctf_file_t *fp, ctf_id_t type)
 {
   const ctf_type_t *tp;
-  ctf_arinfo_t r;
+  ctf_file_t *ofp = fp;
+  ssize_t size;
 
-  if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
-    return -1;			/* errno is set for us.  */
+  ctf_resid_hold (ofp);
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL
+      || (type = ctf_type_resolve_tp (ofp, &fp, type, &tp)) == CTF_ERR)
+    size = -1;			/* errno is set for us.  */
+  else
+    size = ctf_type_size_tp (fp, type, tp);
+  ctf_resid_release (ofp);
 
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return -1;			/* errno is set for us.  */
+  return size;
+}
+
+/* Return the alignment of the already-resolved TYPE, whose type record TP is
+   in container FP.  */
+
+static ssize_t
+ctf_type_align_tp (ctf_file_t *fp, ctf_id_t type, const ctf_type_t *tp)
+{
+  ctf_arinfo_t r;
 
   switch (LCTF_INFO_KIND (fp, tp->ctt_info))
     {
@@ -429,24 +619,53 @@ ctf_type_align (ctf_file_t *fp, ctf_id_t type)
     }
 }
 
+/* Resolve the type down to a base type node, and then return the alignment
+   needed for the type storage in bytes.
+
+   XXX may need arch-dependent attention.  */
+
+ssize_t
+ctf_type_align (ctf_file_t *fp, ctf_id_t type)
+{
+  const ctf_type_t *tp;
+  ctf_file_t *ofp = fp;
+  ssize_t align;
+
+  ctf_resid_hold (ofp);
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL
+      || (type = ctf_type_resolve_tp (ofp, &fp, type, &tp)) == CTF_ERR)
+    align = -1;			/* errno is set for us.  */
+  else
+    align = ctf_type_align_tp (fp, type, tp);
+  ctf_resid_release (ofp);
+
+  return align;
+}
+
 /* Return the kind (CTF_K_* constant) for the specified type ID.  */
 
 int
 ctf_type_kind (ctf_file_t *fp, ctf_id_t type)
 {
+  ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
+  int kind;
 
+  ctf_resid_hold (ofp);
   if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return CTF_ERR;		/* errno is set for us.  */
+    kind = CTF_ERR;		/* errno is set for us.  */
+  else
+    kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  ctf_resid_release (ofp);
 
-  return (LCTF_INFO_KIND (fp, tp->ctt_info));
+  return kind;
 }
 
 /* If the type is one that directly references another type (such as POINTER),
    then return the ID of the type to which it refers.  */
 
-ctf_id_t
-ctf_type_reference (ctf_file_t *fp, ctf_id_t type)
+static ctf_id_t
+ctf_type_reference_held (ctf_file_t *fp, ctf_id_t type)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
@@ -467,6 +686,17 @@ ctf_type_reference (ctf_file_t *fp, ctf_id_t type)
     }
 }
 
+ctf_id_t
+ctf_type_reference (ctf_file_t *fp, ctf_id_t type)
+{
+  ctf_id_t ref;
+
+  ctf_resid_hold (fp);
+  ref = ctf_type_reference_held (fp, type);
+  ctf_resid_release (fp);
+  return ref;
+}
+
 /* Find a pointer to type by looking in fp->ctf_ptrtab.  If we can't find a
    pointer to the given type, see if we can compute a pointer to the type
    resulting from resolving the type down to its base type and use that
@@ -475,15 +705,19 @@ ctf_type_reference (ctf_file_t *fp, ctf_id_t type)
 
    XXX what about parent containers?  */
 
-ctf_id_t
-ctf_type_pointer (ctf_file_t *fp, ctf_id_t type)
+static ctf_id_t
+ctf_type_pointer_held (ctf_file_t *fp, ctf_id_t type)
 {
   ctf_file_t *ofp = fp;
   ctf_id_t ntype;
+  int err;
 
   if (ctf_lookup_by_id (&fp, type) == NULL)
     return CTF_ERR;		/* errno is set for us.  */
 
+  if ((err = ctf_lazy_names (fp)) != 0)
+    return (ctf_set_errno (ofp, err));
+
   if ((ntype = fp->ctf_ptrtab[LCTF_TYPE_TO_INDEX (fp, type)]) != 0)
     return (LCTF_INDEX_TO_TYPE (fp, ntype, (fp->ctf_flags & LCTF_CHILD)));
 
@@ -493,25 +727,35 @@ ctf_type_pointer (ctf_file_t *fp, ctf_id_t type)
   if (ctf_lookup_by_id (&fp, type) == NULL)
     return (ctf_set_errno (ofp, ECTF_NOTYPE));
 
+  if ((err = ctf_lazy_names (fp)) != 0)
+    return (ctf_set_errno (ofp, err));
+
   if ((ntype = fp->ctf_ptrtab[LCTF_TYPE_TO_INDEX (fp, type)]) != 0)
     return (LCTF_INDEX_TO_TYPE (fp, ntype, (fp->ctf_flags & LCTF_CHILD)));
 
   return (ctf_set_errno (ofp, ECTF_NOTYPE));
 }
 
-/* Return the encoding for the specified INTEGER or FLOAT.  */
+ctf_id_t
+ctf_type_pointer (ctf_file_t *fp, ctf_id_t type)
+{
+  ctf_id_t ptr;
 
-int
-ctf_type_encoding (ctf_file_t *fp, ctf_id_t type, ctf_encoding_t *ep)
+  ctf_resid_hold (fp);
+  ptr = ctf_type_pointer_held (fp, type);
+  ctf_resid_release (fp);
+  return ptr;
+}
+
+/* Fill in the encoding of the INTEGER or FLOAT whose type record TP is in
+   container FP.  Returns -1 if it is neither.  */
+
+static int
+ctf_type_encoding_tp (ctf_file_t *fp, const ctf_type_t *tp, ctf_encoding_t *ep)
 {
-  ctf_file_t *ofp = fp;
-  const ctf_type_t *tp;
   ssize_t increment;
   uint32_t data;
 
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return CTF_ERR;		/* errno is set for us.  */
-
   (void) ctf_get_ctt_size (fp, tp, NULL, &increment);
 
   switch (LCTF_INFO_KIND (fp, tp->ctt_info))
@@ -521,20 +765,109 @@ ctf_type_encoding (ctf_file_t *fp, ctf_id_t type, ctf_encoding_t *ep)
       ep->cte_format = CTF_INT_ENCODING (data);
       ep->cte_offset = CTF_INT_OFFSET (data);
       ep->cte_bits = CTF_INT_BITS (data);
-      break;
+      return 0;
     case CTF_K_FLOAT:
       data = *(const uint32_t *) ((uintptr_t) tp + increment);
       ep->cte_format = CTF_FP_ENCODING (data);
       ep->cte_offset = CTF_FP_OFFSET (data);
       ep->cte_bits = CTF_FP_BITS (data);
+      return 0;
+    default:
+      return -1;
+    }
+}
+
+/* Return the encoding for the specified INTEGER or FLOAT.  */
+
+static int
+ctf_type_encoding_held (ctf_file_t *fp, ctf_id_t type, ctf_encoding_t *ep)
+{
+  ctf_file_t *ofp = fp;
+  const ctf_type_t *tp;
+
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+    return CTF_ERR;		/* errno is set for us.  */
+
+  if (ctf_type_encoding_tp (fp, tp, ep) < 0)
+    return (ctf_set_errno (ofp, ECTF_NOTINTFP));
+
+  return 0;
+}
+
+int
+ctf_type_encoding (ctf_file_t *fp, ctf_id_t type, ctf_encoding_t *ep)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_type_encoding_held (fp, type, ep);
+  ctf_resid_release (fp);
+  return rc;
+}
+
+/* Return most of what ctf_type_kind(), ctf_type_size(), ctf_type_align(),
+   ctf_type_reference(), ctf_type_resolve() and ctf_type_encoding() would
+   return for the given type, looking it up and resolving it only once.  The
+   size, alignment and encoding are those of the resolved type.  */
+
+static int
+ctf_type_info_held (ctf_file_t *fp, ctf_id_t type, ctf_typeinfo_t *info)
+{
+  ctf_file_t *ofp = fp;
+  const ctf_type_t *tp;
+  uint32_t kind;
+
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
+    return CTF_ERR;		/* errno is set for us.  */
+
+  memset (info, 0, sizeof (ctf_typeinfo_t));
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+  info->cti_kind = kind;
+  info->cti_root = LCTF_INFO_ISROOT (fp, tp->ctt_info) != 0;
+  info->cti_name = ctf_strptr (fp, tp->ctt_name);
+  info->cti_vlen = LCTF_INFO_VLEN (fp, tp->ctt_info);
+
+  switch (kind)
+    {
+    case CTF_K_POINTER:
+    case CTF_K_TYPEDEF:
+    case CTF_K_VOLATILE:
+    case CTF_K_CONST:
+    case CTF_K_RESTRICT:
+      info->cti_ref = tp->ctt_type;
       break;
     default:
-      return (ctf_set_errno (ofp, ECTF_NOTINTFP));
+      info->cti_ref = CTF_ERR;
+    }
+
+  if ((type = ctf_type_resolve_tp (ofp, &fp, type, &tp)) == CTF_ERR)
+    return CTF_ERR;		/* errno is set for us.  */
+
+  info->cti_resolved = type;
+  (void) ctf_type_encoding_tp (fp, tp, &info->cti_encoding);
+
+  if ((info->cti_size = ctf_type_size_tp (fp, type, tp)) < 0
+      || (info->cti_align = ctf_type_align_tp (fp, type, tp)) < 0)
+    {
+      if (fp != ofp)
+	(void) ctf_set_errno (ofp, ctf_errno (fp));
+      return CTF_ERR;
     }
 
   return 0;
 }
 
+int
+ctf_type_info (ctf_file_t *fp, ctf_id_t type, ctf_typeinfo_t *info)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_type_info_held (fp, type, info);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 int
 ctf_type_cmp (ctf_file_t *lfp, ctf_id_t ltype, ctf_file_t *rfp,
 	      ctf_id_t rtype)
@@ -572,8 +905,8 @@ ctf_type_cmp (ctf_file_t *lfp, ctf_id_t ltype, ctf_file_t *rfp,
    enums / forward declarations) if they have the same name and (for structs /
    unions) member count.  */
 
-int
-ctf_type_compat (ctf_file_t *lfp, ctf_id_t ltype,
+static int
+ctf_type_compat_held (ctf_file_t *lfp, ctf_id_t ltype,
 		 ctf_file_t *rfp, ctf_id_t rtype)
 {
   const ctf_type_t *ltp, *rtp;
@@ -631,67 +964,277 @@ ctf_type_compat (ctf_file_t *lfp, ctf_id_t ltype,
     }
 }
 
-/* Return the type and offset for a given member of a STRUCT or UNION.  */
-
 int
-ctf_member_info (ctf_file_t *fp, ctf_id_t type, const char *name,
-		 ctf_membinfo_t *mip)
+ctf_type_compat (ctf_file_t *lfp, ctf_id_t ltype,
+		 ctf_file_t *rfp, ctf_id_t rtype)
 {
-  ctf_file_t *ofp = fp;
-  const ctf_type_t *tp;
-  ssize_t size, increment;
-  uint32_t kind, n;
+  int rc;
 
-  if ((type = ctf_type_resolve (fp, type)) == CTF_ERR)
-    return CTF_ERR;		/* errno is set for us.  */
+  ctf_resid_hold (lfp);
+  ctf_resid_hold (rfp);
+  rc = ctf_type_compat_held (lfp, ltype, rfp, rtype);
+  ctf_resid_release (rfp);
+  ctf_resid_release (lfp);
+  return rc;
+}
 
-  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL)
-    return CTF_ERR;		/* errno is set for us.  */
+/* Members of anonymous structs and unions are accessed as if they were
+   members of the enclosing struct or union, so ctf_member_info() looks them
+   up in a per-type hash of every member so accessible, with its offset from
+   the start of the outermost type.  These hashes are built on first use, and
+   are rebuildable state subject to the residency budget.  */
 
-  (void) ctf_get_ctt_size (fp, tp, &size, &increment);
-  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+#define CTF_MEMBIDX_MAXDEPTH 64	/* Limit on nesting of anonymous members.  */
 
-  if (kind != CTF_K_STRUCT && kind != CTF_K_UNION)
-    return (ctf_set_errno (ofp, ECTF_NOTSOU));
+typedef struct ctf_membidx_arg
+{
+  ctf_file_t *cma_fp;		/* Container of the outermost type.  */
+  ctf_membidx_t *cma_idx;	/* Index being filled, or NULL if counting.  */
+  unsigned long cma_count;	/* Number of members found.  */
+  unsigned long cma_offset;	/* Offset of the current anonymous member.  */
+  int cma_depth;		/* Nesting depth of anonymous members.  */
+} ctf_membidx_arg_t;
 
-  if (size < CTF_LSTRUCT_THRESH)
-    {
-      const ctf_member_t *mp = (const ctf_member_t *) ((uintptr_t) tp +
-						       increment);
+static int
+ctf_membidx_add (const char *name, ctf_id_t type, unsigned long offset,
+		 void *arg_)
+{
+  ctf_membidx_arg_t *arg = arg_;
+  ctf_membidx_t *idx = arg->cma_idx;
+  unsigned long h;
 
-      for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, mp++)
+  /* Unnamed members of the outermost type are entered under the empty name,
+     so that looking that up finds the first of them, as it always has.  */
+
+  if (name[0] != '\0' || arg->cma_depth == 0)
+    {
+      arg->cma_count++;
+      if (idx != NULL)
 	{
-	  if (strcmp (ctf_strptr (fp, mp->ctm_name), name) == 0)
+	  /* The first of several members of the same name wins, as it would
+	     in a linear search.  */
+
+	  for (h = ctf_hash_compute (name, strlen (name)) & idx->cmi_mask;
+	       idx->cmi_ents[h].cme_name != NULL; h = (h + 1) & idx->cmi_mask)
+	    {
+	      if (strcmp (idx->cmi_ents[h].cme_name, name) == 0)
+		break;
+	    }
+
+	  if (idx->cmi_ents[h].cme_name == NULL)
 	    {
-	      mip->ctm_type = mp->ctm_type;
-	      mip->ctm_offset = mp->ctm_offset;
-	      return 0;
+	      idx->cmi_ents[h].cme_name = name;
+	      idx->cmi_ents[h].cme_type = type;
+	      idx->cmi_ents[h].cme_offset = arg->cma_offset + offset;
 	    }
 	}
     }
+
+  if (name[0] == '\0')
+    {
+      ctf_id_t rtype = ctf_type_resolve (arg->cma_fp, type);
+      int kind = ctf_type_kind (arg->cma_fp, rtype);
+      unsigned long saved = arg->cma_offset;
+      int rc;
+
+      if (rtype == CTF_ERR
+	  || (kind != CTF_K_STRUCT && kind != CTF_K_UNION))
+	return 0;
+
+      if (arg->cma_depth >= CTF_MEMBIDX_MAXDEPTH)
+	return ECTF_CORRUPT;
+
+      arg->cma_offset += offset;
+      arg->cma_depth++;
+      rc = ctf_member_iter (arg->cma_fp, rtype, ctf_membidx_add, arg);
+      arg->cma_depth--;
+      arg->cma_offset = saved;
+      return rc;
+    }
+
+  return 0;
+}
+
+static size_t
+ctf_membidx_size (const ctf_membidx_t *idx)
+{
+  return sizeof (ctf_membidx_t) + (idx->cmi_mask + 1) * sizeof (ctf_membent_t);
+}
+
+/* Build the member index of TYPE, a struct or union in FP.  Returns NULL and
+   sets the errno on FP on error.  */
+
+static ctf_membidx_t *
+ctf_membidx_build (ctf_file_t *fp, ctf_id_t type)
+{
+  ctf_membidx_arg_t arg = { fp, NULL, 0, 0, 0 };
+  ctf_membidx_t *idx;
+  unsigned long nslots;
+  int err;
+
+  if ((err = ctf_member_iter (fp, type, ctf_membidx_add, &arg)) != 0)
+    goto err;
+
+  for (nslots = 2; nslots < arg.cma_count * 2; nslots <<= 1);
+
+  if ((idx = ctf_alloc (sizeof (ctf_membidx_t)
+			+ nslots * sizeof (ctf_membent_t))) == NULL)
+    {
+      (void) ctf_set_errno (fp, ENOMEM);
+      return NULL;
+    }
+  memset (idx->cmi_ents, 0, nslots * sizeof (ctf_membent_t));
+  idx->cmi_mask = nslots - 1;
+
+  arg.cma_idx = idx;
+  arg.cma_count = 0;
+  if ((err = ctf_member_iter (fp, type, ctf_membidx_add, &arg)) != 0)
+    {
+      ctf_free (idx, ctf_membidx_size (idx));
+      goto err;
+    }
+
+  return idx;
+
+err:
+  if (err != CTF_ERR)
+    (void) ctf_set_errno (fp, err);
+  return NULL;
+}
+
+/* Return the member index of TYPE, a struct or union in FP, building it if
+   need be.
+
+   Concurrent readers may race to build the table of indexes or the index
+   itself: the loser frees its copy.  */
+
+static const ctf_membidx_t *
+ctf_membidx (ctf_file_t *fp, ctf_id_t type)
+{
+  unsigned long i = LCTF_TYPE_TO_INDEX (fp, type);
+  ctf_membidx_t **tab, **oldtab = NULL;
+  ctf_membidx_t *idx, *old = NULL;
+
+  if ((tab = __atomic_load_n (&fp->ctf_membidx, __ATOMIC_ACQUIRE)) == NULL)
+    {
+      size_t tabsz = (fp->ctf_typemax + 1) * sizeof (ctf_membidx_t *);
+
+      if ((tab = ctf_alloc (tabsz)) == NULL)
+	{
+	  (void) ctf_set_errno (fp, ENOMEM);
+	  return NULL;
+	}
+      memset (tab, 0, tabsz);
+
+      if (!__atomic_compare_exchange_n (&fp->ctf_membidx, &oldtab, tab, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+	  ctf_free (tab, tabsz);
+	  tab = oldtab;
+	}
+      else
+	ctf_resid_add (fp, tabsz);
+    }
+
+  if ((idx = __atomic_load_n (&tab[i], __ATOMIC_ACQUIRE)) != NULL)
+    {
+      ctf_resid_touch (fp);
+      return idx;
+    }
+
+  if ((idx = ctf_membidx_build (fp, type)) == NULL)
+    return NULL;
+
+  if (!__atomic_compare_exchange_n (&tab[i], &old, idx, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      ctf_free (idx, ctf_membidx_size (idx));
+      idx = old;
+    }
   else
+    ctf_resid_add (fp, ctf_membidx_size (idx));
+
+  return idx;
+}
+
+/* Free the member indexes, if any.  */
+
+void
+ctf_membidx_destroy (ctf_file_t *fp)
+{
+  unsigned long i;
+
+  if (fp->ctf_membidx == NULL)
+    return;
+
+  for (i = 0; i <= fp->ctf_typemax; i++)
+    if (fp->ctf_membidx[i] != NULL)
+      ctf_free (fp->ctf_membidx[i], ctf_membidx_size (fp->ctf_membidx[i]));
+
+  ctf_free (fp->ctf_membidx, (fp->ctf_typemax + 1) * sizeof (ctf_membidx_t *));
+  fp->ctf_membidx = NULL;
+}
+
+/* Return the type and offset for a given member of a STRUCT or UNION.  Members
+   of anonymous struct and union members are found too, with their offsets
+   from the start of the STRUCT or UNION.  */
+
+static int
+ctf_member_info_held (ctf_file_t *fp, ctf_id_t type, const char *name,
+		 ctf_membinfo_t *mip)
+{
+  ctf_file_t *ofp = fp;
+  const ctf_type_t *tp;
+  const ctf_membidx_t *idx;
+  uint32_t kind;
+  unsigned long h;
+
+  if ((tp = ctf_lookup_by_id (&fp, type)) == NULL
+      || (type = ctf_type_resolve_tp (ofp, &fp, type, &tp)) == CTF_ERR)
+    return CTF_ERR;		/* errno is set for us.  */
+
+  kind = LCTF_INFO_KIND (fp, tp->ctt_info);
+
+  if (kind != CTF_K_STRUCT && kind != CTF_K_UNION)
+    return (ctf_set_errno (ofp, ECTF_NOTSOU));
+
+  if ((idx = ctf_membidx (fp, type)) == NULL)
     {
-      const ctf_lmember_t *lmp = (const ctf_lmember_t *) ((uintptr_t) tp +
-							  increment);
+      if (fp != ofp)
+	(void) ctf_set_errno (ofp, ctf_errno (fp));
+      return CTF_ERR;
+    }
 
-      for (n = LCTF_INFO_VLEN (fp, tp->ctt_info); n != 0; n--, lmp++)
+  for (h = ctf_hash_compute (name, strlen (name)) & idx->cmi_mask;
+       idx->cmi_ents[h].cme_name != NULL; h = (h + 1) & idx->cmi_mask)
+    {
+      if (strcmp (idx->cmi_ents[h].cme_name, name) == 0)
 	{
-	  if (strcmp (ctf_strptr (fp, lmp->ctlm_name), name) == 0)
-	    {
-	      mip->ctm_type = lmp->ctlm_type;
-	      mip->ctm_offset = (unsigned long) CTF_LMEM_OFFSET (lmp);
-	      return 0;
-	    }
+	  mip->ctm_type = idx->cmi_ents[h].cme_type;
+	  mip->ctm_offset = idx->cmi_ents[h].cme_offset;
+	  return 0;
 	}
     }
 
   return (ctf_set_errno (ofp, ECTF_NOMEMBNAM));
 }
 
+int
+ctf_member_info (ctf_file_t *fp, ctf_id_t type, const char *name,
+		 ctf_membinfo_t *mip)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_member_info_held (fp, type, name, mip);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Return the array type, index, and size information for the specified ARRAY.  */
 
-int
-ctf_array_info (ctf_file_t *fp, ctf_id_t type, ctf_arinfo_t *arp)
+static int
+ctf_array_info_held (ctf_file_t *fp, ctf_id_t type, ctf_arinfo_t *arp)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
@@ -714,11 +1257,22 @@ ctf_array_info (ctf_file_t *fp, ctf_id_t type, ctf_arinfo_t *arp)
   return 0;
 }
 
+int
+ctf_array_info (ctf_file_t *fp, ctf_id_t type, ctf_arinfo_t *arp)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_array_info_held (fp, type, arp);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Convert the specified value to the corresponding enum tag name, if a
    matching name can be found.  Otherwise NULL is returned.  */
 
-const char *
-ctf_enum_name (ctf_file_t *fp, ctf_id_t type, int value)
+static const char *
+ctf_enum_name_held (ctf_file_t *fp, ctf_id_t type, int value)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
@@ -752,11 +1306,23 @@ ctf_enum_name (ctf_file_t *fp, ctf_id_t type, int value)
   return NULL;
 }
 
+const char *
+ctf_enum_name (ctf_file_t *fp, ctf_id_t type, int value)
+{
+  const char *name;
+
+  ctf_resid_hold (fp);
+  name = ctf_enum_name_held (fp, type, value);
+  ctf_resid_release (fp);
+  return name;
+}
+
 /* Convert the specified enum tag name to the corresponding value, if a
    matching name can be found.  Otherwise CTF_ERR is returned.  */
 
-int
-ctf_enum_value (ctf_file_t * fp, ctf_id_t type, const char *name, int *valp)
+static int
+ctf_enum_value_held (ctf_file_t * fp, ctf_id_t type, const char *name,
+		     int *valp)
 {
   ctf_file_t *ofp = fp;
   const ctf_type_t *tp;
@@ -794,15 +1360,30 @@ ctf_enum_value (ctf_file_t * fp, ctf_id_t type, const char *name, int *valp)
   return CTF_ERR;
 }
 
+int
+ctf_enum_value (ctf_file_t * fp, ctf_id_t type, const char *name, int *valp)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_enum_value_held (fp, type, name, valp);
+  ctf_resid_release (fp);
+  return rc;
+}
+
 /* Recursively visit the members of any type.  This function is used as the
-   engine for ctf_type_visit, below.  We resolve the input type, recursively
-   invoke ourself for each type member if the type is a struct or union, and
-   then invoke the callback function on the current type.  If any callback
-   returns non-zero, we abort and percolate the error code back up to the top.  */
+   engine for ctf_type_visit and ctf_type_visit_limit, below.  We resolve the
+   input type, invoke the callback function on the current type, and then
+   recursively invoke ourself for each type member if the type is a struct or
+   union, unless that would exceed MAXDEPTH (if not negative).  If PRUNE is
+   set and the callback returns CTF_VISIT_SKIP, we do not descend into the
+   members of that type; if any callback returns any other non-zero value, we
+   abort and percolate the error code back up to the top.  */
 
 static int
 ctf_type_rvisit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
-		 void *arg, const char *name, unsigned long offset, int depth)
+		 void *arg, const char *name, unsigned long offset, int depth,
+		 int maxdepth, int prune)
 {
   ctf_id_t otype = type;
   const ctf_type_t *tp;
@@ -817,13 +1398,16 @@ ctf_type_rvisit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
     return CTF_ERR;		/* errno is set for us.  */
 
   if ((rc = func (name, otype, offset, depth, arg)) != 0)
-    return rc;
+    return (prune && rc == CTF_VISIT_SKIP) ? 0 : rc;
 
   kind = LCTF_INFO_KIND (fp, tp->ctt_info);
 
   if (kind != CTF_K_STRUCT && kind != CTF_K_UNION)
     return 0;
 
+  if (maxdepth >= 0 && depth >= maxdepth)
+    return 0;
+
   (void) ctf_get_ctt_size (fp, tp, &size, &increment);
 
   if (size < CTF_LSTRUCT_THRESH)
@@ -836,7 +1420,7 @@ ctf_type_rvisit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
 	  if ((rc = ctf_type_rvisit (fp, mp->ctm_type,
 				     func, arg, ctf_strptr (fp, mp->ctm_name),
 				     offset + mp->ctm_offset,
-				     depth + 1)) != 0)
+				     depth + 1, maxdepth, prune)) != 0)
 	    return rc;
 	}
 
@@ -852,7 +1436,7 @@ ctf_type_rvisit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
 				     func, arg, ctf_strptr (fp,
 							    lmp->ctlm_name),
 				     offset + (unsigned long) CTF_LMEM_OFFSET (lmp),
-				     depth + 1)) != 0)
+				     depth + 1, maxdepth, prune)) != 0)
 	    return rc;
 	}
     }
@@ -865,5 +1449,27 @@ ctf_type_rvisit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func,
 int
 ctf_type_visit (ctf_file_t *fp, ctf_id_t type, ctf_visit_f *func, void *arg)
 {
-  return (ctf_type_rvisit (fp, type, func, arg, "", 0, 0));
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_type_rvisit (fp, type, func, arg, "", 0, 0, -1, 0);
+  ctf_resid_release (fp);
+  return rc;
+}
+
+/* Visit the members of any type as ctf_type_visit() does, but descend no more
+   than MAXDEPTH levels below it (without limit if MAXDEPTH is negative), and
+   do not descend into the members of any type for which the callback function
+   returns CTF_VISIT_SKIP.  */
+
+int
+ctf_type_visit_limit (ctf_file_t *fp, ctf_id_t type, int maxdepth,
+		      ctf_visit_f *func, void *arg)
+{
+  int rc;
+
+  ctf_resid_hold (fp);
+  rc = ctf_type_rvisit (fp, type, func, arg, "", 0, 0, maxdepth, 1);
+  ctf_resid_release (fp);
+  return rc;
 }
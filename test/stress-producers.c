@@ -0,0 +1,194 @@
+/*
+   Stress test for CTF producers on concurrent threads.
+
+   Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+
+   Licensed under the Universal Permissive License v 1.0 as shown at
+   http://oss.oracle.com/licenses/upl.
+
+   Licensed under the GNU General Public License (GPL), version 2. See the file
+   COPYING in the top level of this tree.  */
+
+/* Each thread repeatedly builds a few containers, writes them to an archive of
+   its own, reads the archive back and checks every member against what was
+   built.  Nothing is shared between threads, so any failure means some state
+   in the create or archive paths is not reentrant.  */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ctf-api.h>
+
+#define NMEMBERS 3
+
+static const char *dir = ".";
+static int rounds = 4;
+
+/* Report a failed check and give up.  */
+
+#define CHECK(cond)							\
+  do									\
+    {									\
+      if (!(cond))							\
+	{								\
+	  fprintf (stderr, "%s:%i: check failed: %s\n", __FILE__,	\
+		   __LINE__, #cond);					\
+	  exit (1);							\
+	}								\
+    }									\
+  while (0)
+
+/* Build a container with NSTRUCTS structures, each with a variable of its
+   type, and some other types besides.  The variables are added in reverse
+   name order so that ctf_update() has some sorting to do.  */
+
+static ctf_file_t *
+build (int nstructs)
+{
+  ctf_encoding_t e = { CTF_INT_SIGNED, 0, 32 };
+  ctf_file_t *fp;
+  ctf_id_t i, p, en;
+  char name[64];
+  int err, k;
+
+  CHECK ((fp = ctf_create (&err)) != NULL);
+  CHECK ((i = ctf_add_integer (fp, CTF_ADD_ROOT, "int", &e)) != CTF_ERR);
+  CHECK ((p = ctf_add_pointer (fp, CTF_ADD_ROOT, i)) != CTF_ERR);
+  CHECK ((en = ctf_add_enum (fp, CTF_ADD_ROOT, "color")) != CTF_ERR);
+  CHECK (ctf_add_enumerator (fp, en, "RED", 0) == 0);
+  CHECK (ctf_add_enumerator (fp, en, "GREEN", 1) == 0);
+  CHECK (ctf_update (fp) == 0);
+
+  for (k = nstructs - 1; k >= 0; k--)
+    {
+      ctf_id_t s;
+
+      snprintf (name, sizeof (name), "s_%i", k);
+      CHECK ((s = ctf_add_struct (fp, CTF_ADD_ROOT, name)) != CTF_ERR);
+      CHECK (ctf_add_member (fp, s, "a", i) == 0);
+      CHECK (ctf_add_member (fp, s, "b", p) == 0);
+      snprintf (name, sizeof (name), "v_%i", k);
+      CHECK (ctf_add_variable (fp, name, s) == 0);
+    }
+
+  CHECK (ctf_update (fp) == 0);
+  return fp;
+}
+
+/* Check that FP holds what build (NSTRUCTS) put there.  */
+
+static void
+verify (ctf_file_t *fp, int nstructs)
+{
+  ctf_membinfo_t mi;
+  char name[64];
+  int val, k;
+
+  CHECK (ctf_enum_value (fp, ctf_lookup_by_name (fp, "enum color"),
+			 "GREEN", &val) == 0 && val == 1);
+
+  for (k = 0; k < nstructs; k++)
+    {
+      ctf_id_t s;
+
+      snprintf (name, sizeof (name), "struct s_%i", k);
+      CHECK ((s = ctf_lookup_by_name (fp, name)) != CTF_ERR);
+      CHECK (ctf_member_info (fp, s, "b", &mi) == 0);
+      snprintf (name, sizeof (name), "v_%i", k);
+      CHECK (ctf_lookup_variable (fp, name) == s);
+    }
+  snprintf (name, sizeof (name), "v_%i", nstructs);
+  CHECK (ctf_lookup_variable (fp, name) == CTF_ERR);
+}
+
+static void *
+producer (void *arg)
+{
+  /* Out of name order, so that ctf_arc_write() has some sorting to do.  */
+  static const char *names[NMEMBERS] = { "zeta", "alpha", "mid" };
+  long n = (long) arg;
+  char path[PATH_MAX];
+  int r, k, err;
+
+  CHECK (snprintf (path, sizeof (path), "%s/stress-%i-%li.ctfa", dir,
+		   (int) getpid (), n) < (int) sizeof (path));
+
+  for (r = 0; r < rounds; r++)
+    {
+      ctf_file_t *fps[NMEMBERS];
+      ctf_archive_t *arc;
+
+      for (k = 0; k < NMEMBERS; k++)
+	fps[k] = build (50 + 10 * k + n);
+
+      /* Compress some members but not others.  */
+      CHECK (ctf_arc_write (path, fps, NMEMBERS, names, 4096) == 0);
+      CHECK ((arc = ctf_arc_open (path, &err)) != NULL);
+
+      for (k = 0; k < NMEMBERS; k++)
+	{
+	  ctf_file_t *fp;
+
+	  CHECK ((fp = ctf_arc_open_by_name (arc, names[k], &err)) != NULL);
+	  verify (fp, 50 + 10 * k + n);
+	  ctf_close (fp);
+	  ctf_close (fps[k]);
+	}
+      ctf_arc_close (arc);
+    }
+
+  unlink (path);
+  return NULL;
+}
+
+static void
+usage (char *argv[])
+{
+  fprintf (stderr, "Syntax: %s [-d dir] [-r rounds] [-t threads]\n\n"
+	   "Build, write and read back archives in DIR on many threads "
+	   "at once.\n", argv[0]);
+}
+
+int
+main (int argc, char *argv[])
+{
+  pthread_t *threads;
+  long nthreads = 8, i;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "d:r:t:h")) != -1)
+    {
+      switch (opt)
+	{
+	case 'd':
+	  dir = optarg;
+	  break;
+	case 'r':
+	  rounds = atoi (optarg);
+	  break;
+	case 't':
+	  nthreads = atol (optarg);
+	  break;
+	default:
+	  usage (argv);
+	  exit (1);
+	}
+    }
+
+  CHECK (nthreads > 0);
+  CHECK ((threads = calloc (nthreads, sizeof (pthread_t))) != NULL);
+
+  for (i = 0; i < nthreads; i++)
+    CHECK (pthread_create (&threads[i], NULL, producer, (void *) i) == 0);
+  for (i = 0; i < nthreads; i++)
+    CHECK (pthread_join (threads[i], NULL) == 0);
+
+  free (threads);
+  printf ("%li threads, %i rounds each: OK\n", nthreads, rounds);
+  return 0;
+}
@@ -25,7 +25,7 @@
 static void
 usage (int argc _libctf_unused_, char *argv[])
 {
-  fprintf (stderr, "Syntax: %s {-x|-t} [-vu] -i parent-ctf] "
+  fprintf (stderr, "Syntax: %s {-x|-t|-U} [-vu] -i parent-ctf] "
 	   "archive...\n\n", argv[0]);
   fprintf (stderr, "-x: Extract archive contents.\n");
   fprintf (stderr, "-t: List archive contents without extraction "
@@ -33,12 +33,14 @@ usage (int argc _libctf_unused_, char *argv[])
   fprintf (stderr, "-u: Upgrade the archive to the latest version while "
 	   "extracting.\n");
   fprintf (stderr, "-v: List archive contents while extracting.\n");
+  fprintf (stderr, "-U: Upgrade archives in place to the latest version.\n");
 }
 
 static int extraction = 0;
 static int listing_explicit = 0;
 static int quiet = 0;
 static int upgrade = 0;
+static int upgrade_in_place = 0;
 
 struct visit_data
 {
@@ -159,7 +161,7 @@ main (int argc, char *argv[])
   char **name;
   int opt;
 
-  while ((opt = getopt (argc, argv, "hxtuvi:")) != -1)
+  while ((opt = getopt (argc, argv, "hxtuUvi:")) != -1)
     {
       switch (opt)
 	{
@@ -189,7 +191,49 @@ main (int argc, char *argv[])
 	case 'u':
 	  upgrade = 1;
 	  break;
+	case 'U':
+	  upgrade_in_place = 1;
+	  break;
+	}
+    }
+
+  /* Upgraded members are written uncompressed, since the point of upgrading
+     is to make opening them cheap.  */
+
+  if (upgrade_in_place)
+    {
+      int ret = 0;
+
+      for (name = &argv[optind]; *name; name++)
+	{
+	  char tmp[PATH_MAX];
+	  int err;
+
+	  if (snprintf (tmp, sizeof (tmp), "%s.upgrade", *name)
+	      >= (int) sizeof (tmp))
+	    {
+	      fprintf (stderr, "Cannot upgrade %s: %s\n", *name,
+		       strerror (ENAMETOOLONG));
+	      ret = 1;
+	      continue;
+	    }
+	  if ((err = ctf_arc_upgrade (*name, tmp, (size_t) -1)) != 0)
+	    {
+	      fprintf (stderr, "Cannot upgrade %s: %s\n", *name,
+		       ctf_errmsg (err));
+	      unlink (tmp);
+	      ret = 1;
+	      continue;
+	    }
+	  if (rename (tmp, *name) < 0)
+	    {
+	      fprintf (stderr, "Cannot replace %s: %s\n", *name,
+		       strerror (errno));
+	      unlink (tmp);
+	      ret = 1;
+	    }
 	}
+      return ret;
     }
 
   for (name = &argv[optind]; *name; name++)